@@ -0,0 +1,871 @@
+/*
+ * File         : ldapBench.cpp
+ * Author       : B.Baransel BAĞCI
+ * Description  : Benchmarks of ldapReader against the local server started by slapd.sh.
+ *                Latency can be added with ldapDelayProxy.
+ * Compile Opt  : -O2 -lldap -llber -pthread -std=c++14, -std=c++20 for coro case
+ *
+ * Dependency   :
+ *                  ldapReader.h, ldapReaderPool.h, ldapBatchReader.h, ldapExporter.h, ldapGroupGraph.h, ldapInterner.h,
+ *                  ldapTypedReader.h, ldapSnapshot.h, ldapFilter.h, ldapReplicaSet.h, ldapCoroReader.h (c++20)
+ *
+ * Usage        : ldapBench [-H uri] [-D bindDn] [-w password] [-b base] [-n iterations] [-u users] [-g groups] [-r replicaUri]... [-t seconds] [-c cases]
+ *                cases is a comma separated list of: bind,scan,lookup,batch,decode,export,groups,intern,typed,snapshot,filter,replicas,coro,soak
+ *                (default all but soak)
+ *                replicas case uses -H and each -r uri as replicas, run other replicas with ldapDelayProxy to add latency
+ *                soak case runs queries for -t seconds (default 60) and prints resident memory, -t 86400 for a day long soak
+ */
+
+//benchmarks report statistics of readers
+#define _LDAP_STATS
+
+#include "../ldapReaderPool.h"
+#include "../ldapBatchReader.h"
+#include "../ldapExporter.h"
+#include "../ldapGroupGraph.h"
+#include "../ldapInterner.h"
+#include "../ldapTypedReader.h"
+#include "../ldapSnapshot.h"
+#include "../ldapFilter.h"
+#include "../ldapReplicaSet.h"
+#if __cplusplus >= 202002L
+#include "../ldapCoroReader.h"
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+//number of operator new calls, for allocation count of query setup
+static std::atomic<unsigned long> allocations(0);
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size == 0 ? 1 : size);
+    if( p == NULL )
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+//benchmark parameters
+struct benchOptions
+{
+    const char* uri;
+    const char* user;
+    const char* pass;
+    const char* base;
+    int iterations;
+    int users;
+    int groups;
+    int soakSeconds;
+    std::string cases;
+    std::vector<std::string> replicas;
+};
+
+//attributes of generated users, see slapd.sh
+static const char* userAttributes[] = { "uid", "cn", "sn", "mail", "description" };
+static const unsigned int userAttributeNum = 5;
+static const char* userFilter = "(objectClass=inetOrgPerson)";
+
+//long running cases are run only when given with -c
+static bool isSelected(const benchOptions& opt, const char* name, bool isDefault = true)
+{
+    if( opt.cases.empty() )
+        return isDefault;
+    
+    std::string list = "," + opt.cases + ",";
+    return list.find("," + std::string(name) + ",") != std::string::npos;
+}
+
+static std::string randomUid(const benchOptions& opt)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "user%d", rand() % opt.users);
+    return buf;
+}
+
+//print one result line. Latency columns are printed if histogram is given
+static void report(const char* name, unsigned long ops, uint64_t elapsed, const ldapHistogram* latency, const char* extra = "")
+{
+    double seconds = elapsed / 1e9;
+    
+    printf("%-36s %10lu ops %9.3f s %12.1f ops/s", name, ops, seconds, seconds > 0 ? ops / seconds : 0);
+    
+    if( latency != NULL )
+    {
+        ldapHistogramSnapshot snap;
+        latency->snapshot(snap);
+        printf("  p50 %8.3f ms  p99 %8.3f ms", snap.percentile(0.5) / 1e6, snap.percentile(0.99) / 1e6);
+    }
+    
+    printf("  %s\n", extra);
+    fflush(stdout);
+}
+
+//connect and bind on each iteration, compared with checkout from pool
+static void benchBind(const benchOptions& opt)
+{
+    ldapHistogram latency;
+    uint64_t start = ldapStats::now();
+    
+    for(int i=0; i<opt.iterations; i++)
+    {
+        uint64_t t = ldapStats::now();
+        ldapReader reader(opt.uri, opt.user, opt.pass);
+        latency.record(ldapStats::now() - t);
+    }
+    report("bind: new connection", opt.iterations, ldapStats::now() - start, &latency);
+    
+    ldapReaderPool pool(opt.uri, opt.user, opt.pass, 1, 1);
+    latency.reset();
+    start = ldapStats::now();
+    
+    for(int i=0; i<opt.iterations; i++)
+    {
+        uint64_t t = ldapStats::now();
+        ldapReader* reader = pool.acquire();
+        pool.release(reader);
+        latency.record(ldapStats::now() - t);
+    }
+    report("bind: pool checkout", opt.iterations, ldapStats::now() - start, &latency);
+}
+
+//paged full scan with different page sizes, prefetch and streaming
+static void benchScan(const benchOptions& opt)
+{
+    static const int pageSizes[] = { 100, 500, 1000 };
+    static const char* modes[] = { "paged", "prefetch 2", "streaming" };
+    ldapReader reader(opt.uri, opt.user, opt.pass);
+    
+    for(size_t p=0; p<sizeof(pageSizes) / sizeof(int); p++)
+        for(int m=0; m<3; m++)
+        {
+            char name[64];
+            char extra[64];
+            unsigned long count = 0;
+            
+            reader.setPageSize(pageSizes[p]);
+            reader.setPrefetch(m == 1 ? 2 : 0);
+            reader.setStreaming(m == 2);
+            reader.resetStats();
+            
+            uint64_t start = ldapStats::now();
+            reader.query(userFilter, opt.base, userAttributeNum, userAttributes);
+            while( reader.fetch() )
+                count++;
+            uint64_t elapsed = ldapStats::now() - start;
+            
+            ldapStatsSnapshot stats = reader.getStats();
+            snprintf(name, sizeof(name), "scan: page %d %s", pageSizes[p], modes[m]);
+            snprintf(extra, sizeof(extra), "%.1f MB/s", elapsed > 0 ? stats.counters[ldapStats::BYTES] / (elapsed / 1e9) / 1e6 : 0);
+            report(name, count, elapsed, NULL, extra);
+        }
+    
+    //adaptive paging from small first page, shows converged size
+    for(int m=0; m<2; m++)
+    {
+        char extra[96];
+        unsigned long count = 0;
+        
+        reader.setPageSize(100);
+        reader.setPrefetch(m == 1 ? 2 : 0);
+        reader.setStreaming(false);
+        reader.setAdaptivePaging(true);
+        reader.resetStats();
+        
+        uint64_t start = ldapStats::now();
+        reader.query(userFilter, opt.base, userAttributeNum, userAttributes);
+        while( reader.fetch() )
+            count++;
+        uint64_t elapsed = ldapStats::now() - start;
+        
+        ldapStatsSnapshot stats = reader.getStats();
+        snprintf(extra, sizeof(extra), "%.1f MB/s, %llu pages, last page size %d", elapsed > 0 ? stats.counters[ldapStats::BYTES] / (elapsed / 1e9) / 1e6 : 0,
+            (unsigned long long)stats.counters[ldapStats::PAGES], reader.getCurrentPageSize());
+        report(m == 1 ? "scan: adaptive from 100 prefetch 2" : "scan: adaptive from 100 paged", count, elapsed, NULL, extra);
+    }
+    reader.setAdaptivePaging(false);
+}
+
+//one query per key. Also counts c++ allocations of query setup
+static void benchLookup(const benchOptions& opt)
+{
+    ldapHistogram latency;
+    ldapReader reader(opt.uri, opt.user, opt.pass);
+    unsigned long found = 0;
+    unsigned long allocs = 0;
+    char filter[64];
+    char extra[64];
+    
+    uint64_t start = ldapStats::now();
+    for(int i=0; i<opt.iterations; i++)
+    {
+        snprintf(filter, sizeof(filter), "(uid=%s)", randomUid(opt).c_str());
+        
+        uint64_t t = ldapStats::now();
+        unsigned long a = allocations.load(std::memory_order_relaxed);
+        reader.query(filter, opt.base, 2, userAttributes);
+        allocs += allocations.load(std::memory_order_relaxed) - a;
+        while( reader.fetch() )
+            found++;
+        latency.record(ldapStats::now() - t);
+    }
+    
+    snprintf(extra, sizeof(extra), "%lu found, %.2f new/query", found, (double)allocs / opt.iterations);
+    report("lookup: one query per key", opt.iterations, ldapStats::now() - start, &latency, extra);
+}
+
+//keys coalesced into OR filters, lookups/sec by batch size
+static void benchBatch(const benchOptions& opt)
+{
+    static const unsigned int batchSizes[] = { 1, 10, 50, 100, 200 };
+    std::vector<std::string> keys;
+    ldapBatchReader reader(opt.uri, opt.user, opt.pass);
+    
+    for(int i=0; i<opt.iterations; i++)
+        keys.push_back(randomUid(opt));
+    
+    for(size_t b=0; b<sizeof(batchSizes) / sizeof(unsigned int); b++)
+    {
+        char name[64];
+        char extra[64];
+        unsigned long found = 0;
+        
+        reader.setBatchSize(batchSizes[b]);
+        
+        uint64_t start = ldapStats::now();
+        reader.lookup("uid", keys, opt.base, 2, userAttributes);
+        while( reader.fetchKey() )
+            found++;
+        uint64_t elapsed = ldapStats::now() - start;
+        
+        snprintf(name, sizeof(name), "batch: %u keys per filter", batchSizes[b]);
+        snprintf(extra, sizeof(extra), "%lu found", found);
+        report(name, keys.size(), elapsed, NULL, extra);
+    }
+}
+
+//time of reading attributes only, copied values compared with views
+static void benchDecode(const benchOptions& opt)
+{
+    ldapReader reader(opt.uri, opt.user, opt.pass);
+    
+    for(int view=0; view<2; view++)
+    {
+        unsigned long count = 0;
+        unsigned long values = 0;
+        uint64_t elapsed = 0;
+        char extra[64];
+        
+        reader.query(userFilter, opt.base, userAttributeNum, userAttributes);
+        while( reader.fetch() )
+        {
+            uint64_t t = ldapStats::now();
+            for(unsigned int i=0; i<userAttributeNum; i++)
+            {
+                if( view )
+                {
+                    struct berval* v;
+                    values += reader.getAttributeView(userAttributes[i], &v);
+                }
+                else
+                {
+                    struct berval** v = reader.getAttribute(userAttributes[i]);
+                    values += ldap_count_values_len(v);
+                    ldapReader::clearBerval(v);
+                }
+            }
+            elapsed += ldapStats::now() - t;
+            count++;
+        }
+        
+        snprintf(extra, sizeof(extra), "%.0f ns/object, %lu values", count > 0 ? (double)elapsed / count : 0, values);
+        report(view ? "decode: getAttributeView" : "decode: getAttribute", count, elapsed, NULL, extra);
+    }
+}
+
+static std::string groupDn(const benchOptions& opt, int g)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "cn=group%d,ou=groups,", g);
+    return buf + std::string(opt.base);
+}
+
+//expansion of all groups, deep or wide by GROUP_FANOUT of slapd.sh, then membership checks from graph
+static void benchGroups(const benchOptions& opt)
+{
+    static const int threads[] = { 1, 4 };
+    ldapReaderPool pool(opt.uri, opt.user, opt.pass, 1, 4);
+    std::vector<std::string> groups;
+    
+    for(int g=0; g<opt.groups; g++)
+        groups.push_back(groupDn(opt, g));
+    
+    //each group expanded on its own without shared memo, like walking groups one query at a time
+    {
+        char extra[64];
+        unsigned long searches = 0;
+        
+        uint64_t start = ldapStats::now();
+        for(int g=0; g<opt.groups; g++)
+        {
+            ldapGroupGraph graph(pool, opt.base);
+            graph.setBatchSize(1);
+            graph.setThreads(1);
+            graph.expand(std::vector<std::string>(1, groups[g]));
+            searches += graph.getSearchCount();
+        }
+        
+        snprintf(extra, sizeof(extra), "%lu searches", searches);
+        report("groups: expand each, no memo", opt.groups, ldapStats::now() - start, NULL, extra);
+    }
+    
+    for(size_t t=0; t<sizeof(threads) / sizeof(int); t++)
+    {
+        char name[64];
+        char extra[64];
+        ldapGroupGraph graph(pool, opt.base);
+        graph.setThreads(threads[t]);
+        
+        uint64_t start = ldapStats::now();
+        graph.expand(groups);
+        uint64_t elapsed = ldapStats::now() - start;
+        
+        snprintf(name, sizeof(name), "groups: expand all, %d threads", threads[t]);
+        snprintf(extra, sizeof(extra), "%lu searches, %lu nodes", graph.getSearchCount(), (unsigned long)graph.getNodeCount());
+        report(name, opt.groups, elapsed, NULL, extra);
+        
+        if( t + 1 < sizeof(threads) / sizeof(int) )
+            continue;
+        
+        //transitive membership from graph
+        ldapHistogram latency;
+        unsigned long found = 0;
+        std::string base = std::string(",ou=users,") + opt.base;
+        
+        start = ldapStats::now();
+        for(int i=0; i<opt.iterations; i++)
+        {
+            std::string user = "uid=" + randomUid(opt) + base;
+            uint64_t q = ldapStats::now();
+            found += graph.isMember(user.c_str(), groups[rand() % opt.groups].c_str());
+            latency.record(ldapStats::now() - q);
+        }
+        
+        snprintf(extra, sizeof(extra), "%lu found", found);
+        report("groups: isMember from graph", opt.iterations, ldapStats::now() - start, &latency, extra);
+    }
+}
+
+//memory of member values of all groups, copied by getAttribute() compared with interned ids
+static void benchIntern(const benchOptions& opt)
+{
+    static const char* attrs[] = { "member" };
+    ldapReader reader(opt.uri, opt.user, opt.pass);
+    ldapInterner interner;
+    std::vector<std::vector<uint32_t> > groups;
+    unsigned long values = 0;
+    size_t copiedBytes = 0;
+    uint64_t copyTime = 0;
+    uint64_t internTime = 0;
+    char extra[96];
+    
+    reader.query("(objectClass=groupOfNames)", opt.base, 1, attrs);
+    while( reader.fetch() )
+    {
+        uint64_t t = ldapStats::now();
+        struct berval** v = reader.getAttribute("member");
+        for(int i=0; v != NULL && v[i] != NULL; i++)
+            copiedBytes += sizeof(struct berval*) + sizeof(struct berval) + v[i]->bv_len + 1;
+        ldapReader::clearBerval(v);
+        copyTime += ldapStats::now() - t;
+        
+        t = ldapStats::now();
+        groups.push_back(std::vector<uint32_t>());
+        values += interner.internAttribute(reader, "member", groups.back());
+        internTime += ldapStats::now() - t;
+    }
+    
+    size_t internedBytes = interner.getBytes() + values * sizeof(uint32_t);
+    snprintf(extra, sizeof(extra), "%.2f MB copied values", copiedBytes / 1e6);
+    report("intern: getAttribute copies", values, copyTime, NULL, extra);
+    snprintf(extra, sizeof(extra), "%.2f MB interned, %u distinct", internedBytes / 1e6, interner.size());
+    report("intern: interned ids", values, internTime, NULL, extra);
+}
+
+//generated user decoded into struct, attributes in same order as userAttributes
+struct benchUser
+{
+    std::string uid;
+    std::string cn;
+    std::string sn;
+    std::string mail;
+    std::vector<std::string> description;
+    
+    static constexpr auto ldapFields()
+    {
+        return std::make_tuple(ldapBind("uid", &benchUser::uid), ldapBind("cn", &benchUser::cn), ldapBind("sn", &benchUser::sn),
+                               ldapBind("mail", &benchUser::mail), ldapBind("description", &benchUser::description));
+    }
+};
+
+//typed fetch into struct compared with getAttribute/clearBerval loop of main.cpp, filling same struct
+static void benchTyped(const benchOptions& opt)
+{
+    ldapTypedReader<benchUser> reader(opt.uri, opt.user, opt.pass);
+    
+    for(int typed=0; typed<2; typed++)
+    {
+        benchUser u;
+        unsigned long count = 0;
+        unsigned long allocs = 0;
+        uint64_t elapsed = 0;
+        char extra[64];
+        
+        reader.query(userFilter, opt.base);
+        for(;;)
+        {
+            if( typed )
+            {
+                unsigned long a = allocations.load(std::memory_order_relaxed);
+                uint64_t t = ldapStats::now();
+                if( ! reader.fetch(u) )
+                    break;
+                elapsed += ldapStats::now() - t;
+                allocs += allocations.load(std::memory_order_relaxed) - a;
+            }
+            else
+            {
+                if( ! reader.fetch() )
+                    break;
+                
+                unsigned long a = allocations.load(std::memory_order_relaxed);
+                uint64_t t = ldapStats::now();
+                std::string* single[] = { &u.uid, &u.cn, &u.sn, &u.mail };
+                for(int i=0; i<4; i++)
+                {
+                    struct berval** v = reader.getAttribute(userAttributes[i]);
+                    if( v != NULL && v[0] != NULL )
+                        single[i]->assign(v[0]->bv_val, v[0]->bv_len);
+                    ldapReader::clearBerval(v);
+                }
+                
+                struct berval** v = reader.getAttribute("description");
+                u.description.clear();
+                for(int i=0; v != NULL && v[i] != NULL; i++)
+                    u.description.push_back(std::string(v[i]->bv_val, v[i]->bv_len));
+                ldapReader::clearBerval(v);
+                elapsed += ldapStats::now() - t;
+                allocs += allocations.load(std::memory_order_relaxed) - a;
+            }
+            count++;
+        }
+        
+        snprintf(extra, sizeof(extra), "%.0f ns/object, %.2f new/object", count > 0 ? (double)elapsed / count : 0, count > 0 ? (double)allocs / count : 0);
+        report(typed ? "typed: fetch into struct" : "typed: getAttribute loop", count, elapsed, NULL, extra);
+    }
+}
+
+//snapshot of all users, then point lookups answered from mapped file, compare with lookup case
+static void benchSnapshot(const benchOptions& opt)
+{
+    const char* path = "/tmp/ldapBench.snap";
+    ldapReader reader(opt.uri, opt.user, opt.pass);
+    ldapSnapshotWriter writer;
+    ldapHistogram latency;
+    unsigned long found = 0;
+    char filter[64];
+    char extra[64];
+    struct stat st;
+    
+    writer.addIndex("uid");
+    
+    uint64_t start = ldapStats::now();
+    reader.query(userFilter, opt.base, userAttributeNum, userAttributes);
+    unsigned long count = writer.write(reader, path);
+    uint64_t elapsed = ldapStats::now() - start;
+    
+    snprintf(extra, sizeof(extra), "%.2f MB file", stat(path, &st) == 0 ? st.st_size / 1e6 : 0);
+    report("snapshot: scan and write", count, elapsed, NULL, extra);
+    
+    start = ldapStats::now();
+    ldapSnapshot snapshot(path);
+    snprintf(extra, sizeof(extra), "%u objects", snapshot.getObjectCount());
+    report("snapshot: open", 1, ldapStats::now() - start, NULL, extra);
+    
+    start = ldapStats::now();
+    for(int i=0; i<opt.iterations; i++)
+    {
+        snprintf(filter, sizeof(filter), "(uid=%s)", randomUid(opt).c_str());
+        
+        uint64_t t = ldapStats::now();
+        snapshot.query(filter);
+        while( snapshot.fetch() )
+            found++;
+        latency.record(ldapStats::now() - t);
+    }
+    
+    snprintf(extra, sizeof(extra), "%lu found", found);
+    report("snapshot: indexed lookup", opt.iterations, ldapStats::now() - start, &latency, extra);
+    
+    start = ldapStats::now();
+    snapshot.query("(mail=user1*)");
+    for(count=0; snapshot.fetch(); count++)
+        ;
+    report("snapshot: prefix scan of mail", count, ldapStats::now() - start, NULL);
+    
+    unlink(path);
+}
+
+//client side matching of fetched users, filter parsed for each object compared with compiled once
+static void benchFilter(const benchOptions& opt)
+{
+    const char* filter = "(&(mail=*1*@bench.local)(|(description=*xyz*)(sn=surname1*)))";
+    ldapReader reader(opt.uri, opt.user, opt.pass);
+    
+    for(int compiled=0; compiled<2; compiled++)
+    {
+        ldapFilter once(filter);
+        unsigned long count = 0;
+        unsigned long matched = 0;
+        uint64_t elapsed = 0;
+        char extra[64];
+        
+        reader.query(userFilter, opt.base, userAttributeNum, userAttributes);
+        while( reader.fetch() )
+        {
+            uint64_t t = ldapStats::now();
+            if( compiled )
+                matched += once.match(reader);
+            else
+            {
+                ldapFilter parsed(filter);
+                matched += parsed.match(reader);
+            }
+            elapsed += ldapStats::now() - t;
+            count++;
+        }
+        
+        snprintf(extra, sizeof(extra), "%lu matched, %.0f ns/object", matched, count > 0 ? (double)elapsed / count : 0);
+        report(compiled ? "filter: compiled once" : "filter: parsed per object", count, elapsed, NULL, extra);
+    }
+}
+
+//point lookups over replicas by routing policy, then hedged. Give slow or spiky replicas with -r
+static void benchReplicas(const benchOptions& opt)
+{
+    static const char* names[] = { "replicas: least outstanding", "replicas: lowest latency", "replicas: hedged" };
+    std::vector<std::string> uris(1, opt.uri);
+    uris.insert(uris.end(), opt.replicas.begin(), opt.replicas.end());
+    
+    if( uris.size() < 2 )
+    {
+        printf("%-36s skipped, give other replicas with -r\n", "replicas");
+        return;
+    }
+    
+    ldapReplicaSet replicas(uris, opt.user, opt.pass);
+    replicas.setTimeout(1000, 5000);
+    replicas.startProbing(500);
+    
+    for(int mode=0; mode<3; mode++)
+    {
+        ldapHistogram latency;
+        unsigned long found = 0;
+        unsigned long hedges = replicas.getHedgeCount();
+        unsigned long wins = replicas.getHedgeWins();
+        char filter[64];
+        char extra[96];
+        
+        replicas.setPolicy(mode == 1 ? ldapReplicaSet::LOWEST_LATENCY : ldapReplicaSet::LEAST_OUTSTANDING);
+        
+        uint64_t start = ldapStats::now();
+        for(int i=0; i<opt.iterations; i++)
+        {
+            snprintf(filter, sizeof(filter), "(uid=%s)", randomUid(opt).c_str());
+            std::string f = filter;
+            std::string base = opt.base;
+            //slower hedged job outlives this iteration, so state is captured by value
+            auto lookup = [f, base](ldapReader& reader)
+            {
+                unsigned long n = 0;
+                reader.query(f.c_str(), base.c_str(), 2, userAttributes);
+                while( reader.fetch() )
+                    n++;
+                return n;
+            };
+            
+            uint64_t t = ldapStats::now();
+            if( mode == 2 )
+                found += replicas.runHedged<unsigned long>(lookup);
+            else
+                replicas.run([&found, &lookup](ldapReader& reader){ found += lookup(reader); });
+            latency.record(ldapStats::now() - t);
+        }
+        
+        snprintf(extra, sizeof(extra), "%lu found, %lu hedged, %lu hedge wins", found, replicas.getHedgeCount() - hedges, replicas.getHedgeWins() - wins);
+        report(names[mode], opt.iterations, ldapStats::now() - start, &latency, extra);
+    }
+}
+
+#if __cplusplus >= 202002L
+//one coroutine doing lookups one after another, each through a stream of its search
+static ldapTask<void> coroLookups(ldapCoroReader& coro, const benchOptions& opt, int count, ldapHistogram& latency, unsigned long& found)
+{
+    char filter[64];
+    
+    for(int i=0; i<count; i++)
+    {
+        snprintf(filter, sizeof(filter), "(uid=%s)", randomUid(opt).c_str());
+        
+        uint64_t t = ldapStats::now();
+        ldapEntryStream stream = coro.search(filter, opt.base, 2, userAttributes);
+        while( co_await stream.next() )
+            found++;
+        latency.record(ldapStats::now() - t);
+    }
+}
+
+//one coroutine scanning all users with query()
+static ldapTask<void> coroScan(ldapCoroReader& coro, const benchOptions& opt, unsigned long& count)
+{
+    count += co_await coro.query(userFilter, opt.base, userAttributeNum, userAttributes, [](ldapReader&){});
+}
+
+//lookups by concurrent coroutines over one connection compared with lookup case which waits each result,
+//then concurrent full scans sharing the connection
+static void benchCoro(const benchOptions& opt)
+{
+    static const int concurrency[] = { 1, 8, 32 };
+    static const int scans = 4;
+    ldapAsyncReader async(opt.uri, opt.user, opt.pass);
+    ldapCoroReader coro(async);
+    
+    for(size_t c=0; c<sizeof(concurrency) / sizeof(int); c++)
+    {
+        ldapHistogram latency;
+        unsigned long found = 0;
+        int perTask = opt.iterations / concurrency[c] > 0 ? opt.iterations / concurrency[c] : 1;
+        char name[64];
+        char extra[64];
+        
+        uint64_t start = ldapStats::now();
+        for(int i=0; i<concurrency[c]; i++)
+            coro.spawn(coroLookups(coro, opt, perTask, latency, found));
+        coro.run();
+        uint64_t elapsed = ldapStats::now() - start;
+        
+        snprintf(name, sizeof(name), "coro: lookups, %d coroutines", concurrency[c]);
+        snprintf(extra, sizeof(extra), "%lu found", found);
+        report(name, (unsigned long)perTask * concurrency[c], elapsed, &latency, extra);
+    }
+    
+    unsigned long count = 0;
+    uint64_t start = ldapStats::now();
+    for(int i=0; i<scans; i++)
+        coro.spawn(coroScan(coro, opt, count));
+    coro.run();
+    report("coro: 4 scans with query()", count, ldapStats::now() - start, NULL);
+}
+#else
+static void benchCoro(const benchOptions&)
+{
+    printf("%-36s skipped, build with -std=c++20\n", "coro");
+}
+#endif
+
+//resident memory of the process in bytes, 0 if /proc is not available
+static size_t residentBytes()
+{
+    FILE* f = fopen("/proc/self/statm", "r");
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    
+    if( f == NULL )
+        return 0;
+    if( fscanf(f, "%lu %lu", &size, &resident) != 2 )
+        resident = 0;
+    fclose(f);
+    
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+//lookups and full scans repeated through one reader for -t seconds, resident memory is printed on each tenth of the
+//run. First tenth warms up heap and connection buffers, growth after it means query state is leaked
+static void benchSoak(const benchOptions& opt)
+{
+    ldapReader reader(opt.uri, opt.user, opt.pass);
+    uint64_t interval = (uint64_t)opt.soakSeconds * 100000000ULL;
+    unsigned long queries = 0;
+    unsigned long count = 0;
+    size_t baseline = 0;
+    size_t resident = 0;
+    size_t peak = 0;
+    char filter[64];
+    char name[64];
+    char extra[96];
+    
+    reader.setPrefetch(1);
+    
+    uint64_t start = ldapStats::now();
+    for(int tenth=1; tenth<=10; tenth++)
+    {
+        uint64_t end = start + interval * tenth;
+        
+        while( ldapStats::now() < end )
+        {
+            //full scan once in 100 queries, lookups otherwise
+            if( queries % 100 == 0 )
+                reader.query(userFilter, opt.base, userAttributeNum, userAttributes);
+            else
+            {
+                snprintf(filter, sizeof(filter), "(uid=%s)", randomUid(opt).c_str());
+                reader.query(filter, opt.base, 2, userAttributes);
+            }
+            
+            while( reader.fetch() )
+                count++;
+            queries++;
+        }
+        
+        resident = residentBytes();
+        if( tenth == 1 )
+            baseline = resident;
+        if( resident > peak )
+            peak = resident;
+        
+        snprintf(name, sizeof(name), "soak: %d%% of %d s", tenth * 10, opt.soakSeconds);
+        snprintf(extra, sizeof(extra), "%.2f MB resident", resident / 1e6);
+        report(name, queries, ldapStats::now() - start, NULL, extra);
+    }
+    
+    snprintf(extra, sizeof(extra), "%lu entries, %+.2f MB after first tenth, %.2f MB peak", count, ((double)resident - baseline) / 1e6, peak / 1e6);
+    report("soak: total", queries, ldapStats::now() - start, NULL, extra);
+}
+
+//export of all users to /dev/null
+static void benchExport(const benchOptions& opt)
+{
+    static const char* names[] = { "export: LDIF", "export: CSV", "export: NDJSON" };
+    ldapReader reader(opt.uri, opt.user, opt.pass);
+    FILE* out = fopen("/dev/null", "w");
+    
+    if( out == NULL )
+        throw *(new ldapException("Can not open /dev/null"));
+    
+    for(int f=0; f<3; f++)
+    {
+        char extra[64];
+        ldapExporter exporter(out, (ldapExporter::format)f);
+        exporter.setColumns(userAttributeNum, userAttributes);
+        
+        uint64_t start = ldapStats::now();
+        reader.query(userFilter, opt.base, userAttributeNum, userAttributes);
+        unsigned long count = exporter.write(reader);
+        uint64_t elapsed = ldapStats::now() - start;
+        
+        snprintf(extra, sizeof(extra), "%.1f MB/s", elapsed > 0 ? exporter.getBytes() / (elapsed / 1e9) / 1e6 : 0);
+        report(names[f], count, elapsed, NULL, extra);
+    }
+    
+    fclose(out);
+}
+
+int main(int argc, char** argv)
+{
+    benchOptions opt;
+    opt.uri = "ldap://127.0.0.1:3389";
+    opt.user = "cn=admin,dc=bench,dc=local";
+    opt.pass = "secret";
+    opt.base = "dc=bench,dc=local";
+    opt.iterations = 1000;
+    opt.users = 10000;
+    opt.groups = 100;
+    opt.soakSeconds = 60;
+    
+    int c;
+    while( (c = getopt(argc, argv, "H:D:w:b:n:u:g:r:t:c:")) != -1 )
+    {
+        switch( c )
+        {
+            case 'H': opt.uri = optarg; break;
+            case 'D': opt.user = optarg; break;
+            case 'w': opt.pass = optarg; break;
+            case 'b': opt.base = optarg; break;
+            case 'n': opt.iterations = atoi(optarg); break;
+            case 'u': opt.users = atoi(optarg); break;
+            case 'g': opt.groups = atoi(optarg); break;
+            case 'r': opt.replicas.push_back(optarg); break;
+            case 't': opt.soakSeconds = atoi(optarg); break;
+            case 'c': opt.cases = optarg; break;
+            default:
+                std::cerr << "Usage: " << argv[0] << " [-H uri] [-D bindDn] [-w password] [-b base] [-n iterations] [-u users] [-g groups] [-r replicaUri]... [-t seconds] [-c bind,scan,lookup,batch,decode,export,groups,intern,typed,snapshot,filter,replicas,coro,soak]" << std::endl;
+                return -1;
+        }
+    }
+    
+    if( opt.iterations <= 0 || opt.users <= 0 || opt.groups <= 0 || opt.soakSeconds <= 0 )
+    {
+        std::cerr << "Iterations, users, groups and seconds must be positive" << std::endl;
+        return -1;
+    }
+    
+    srand(1);
+    
+    try
+    {
+        if( isSelected(opt, "bind") )
+            benchBind(opt);
+        if( isSelected(opt, "scan") )
+            benchScan(opt);
+        if( isSelected(opt, "lookup") )
+            benchLookup(opt);
+        if( isSelected(opt, "batch") )
+            benchBatch(opt);
+        if( isSelected(opt, "decode") )
+            benchDecode(opt);
+        if( isSelected(opt, "export") )
+            benchExport(opt);
+        if( isSelected(opt, "groups") )
+            benchGroups(opt);
+        if( isSelected(opt, "intern") )
+            benchIntern(opt);
+        if( isSelected(opt, "typed") )
+            benchTyped(opt);
+        if( isSelected(opt, "snapshot") )
+            benchSnapshot(opt);
+        if( isSelected(opt, "filter") )
+            benchFilter(opt);
+        if( isSelected(opt, "replicas") )
+            benchReplicas(opt);
+        if( isSelected(opt, "coro") )
+            benchCoro(opt);
+        if( isSelected(opt, "soak", false) )
+            benchSoak(opt);
+    }
+    catch(std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+    
+    std::cerr << ldapStats::global().snapshot().toJson() << std::endl;
+    
+    return 0;
+}
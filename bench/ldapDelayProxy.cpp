@@ -0,0 +1,224 @@
+/*
+ * File         : ldapDelayProxy.cpp
+ * Author       : B.Baransel BAĞCI
+ * Description  : TCP proxy which delays server responses, to run ldapBench with network latency.
+ *                Responses are held for the delay and then forwarded in order, so pipelined requests
+ *                see one round trip of latency each, like a real network link.
+ * Compile Opt  : -O2 -pthread -std=c++11
+ *
+ * Usage        : ldapDelayProxy listenPort serverHost serverPort delayMs [spikeMs spikePercent]
+ *                Example: ldapDelayProxy 3390 127.0.0.1 3389 2  (then use ldap://127.0.0.1:3390)
+ *                spikeMs is added to spikePercent of responses, for tail latency of a replica. Stop the proxy
+ *                to make the replica down.
+ */
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+//size of one read from socket
+#define _PROXY_READ_SIZE 65536
+
+//delay of responses
+struct delaySettings
+{
+    std::chrono::milliseconds delay;
+    std::chrono::milliseconds spike;
+    int spikePercent;
+};
+
+//data received from server and when it may be forwarded
+struct delayedChunk
+{
+    std::vector<char> data;
+    std::chrono::steady_clock::time_point due;
+};
+
+//responses of one connection waiting for their delay
+struct delayQueue
+{
+    std::deque<delayedChunk> chunks;
+    bool isClosed = false;
+    std::mutex mtx;
+    std::condition_variable cond;
+};
+
+static bool writeAll(int fd, const char* data, size_t len)
+{
+    while( len > 0 )
+    {
+        ssize_t n = write(fd, data, len);
+        if( n <= 0 )
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+//client to server without delay
+static void forwardRequests(int client, int server)
+{
+    char buf[_PROXY_READ_SIZE];
+    ssize_t n;
+    
+    while( (n = read(client, buf, sizeof(buf))) > 0 )
+        if( ! writeAll(server, buf, n) )
+            break;
+    
+    shutdown(server, SHUT_WR);
+}
+
+//server to queue, each chunk is due after the delay
+static void readResponses(int server, delayQueue* queue, delaySettings delays)
+{
+    char buf[_PROXY_READ_SIZE];
+    ssize_t n;
+    std::minstd_rand random(server);
+    
+    while( (n = read(server, buf, sizeof(buf))) > 0 )
+    {
+        delayedChunk chunk;
+        chunk.data.assign(buf, buf + n);
+        chunk.due = std::chrono::steady_clock::now() + delays.delay;
+        if( delays.spikePercent > 0 && (int)(random() % 100) < delays.spikePercent )
+            chunk.due += delays.spike;
+        
+        std::lock_guard<std::mutex> lock(queue->mtx);
+        queue->chunks.push_back(std::move(chunk));
+        queue->cond.notify_one();
+    }
+    
+    std::lock_guard<std::mutex> lock(queue->mtx);
+    queue->isClosed = true;
+    queue->cond.notify_one();
+}
+
+//queue to client when chunks are due
+static void writeResponses(int client, delayQueue* queue)
+{
+    for(;;)
+    {
+        std::unique_lock<std::mutex> lock(queue->mtx);
+        queue->cond.wait(lock, [queue]{ return ! queue->chunks.empty() || queue->isClosed; });
+        
+        if( queue->chunks.empty() )
+            break;
+        
+        delayedChunk chunk = std::move(queue->chunks.front());
+        queue->chunks.pop_front();
+        lock.unlock();
+        
+        std::this_thread::sleep_until(chunk.due);
+        if( ! writeAll(client, chunk.data.data(), chunk.data.size()) )
+            break;
+    }
+    
+    shutdown(client, SHUT_WR);
+}
+
+static int connectServer(const char* host, const char* port)
+{
+    struct addrinfo hints;
+    struct addrinfo* res;
+    int fd = -1;
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    
+    if( getaddrinfo(host, port, &hints, &res) != 0 )
+        return -1;
+    
+    for(struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if( fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 )
+            break;
+        if( fd != -1 )
+            close(fd);
+        fd = -1;
+    }
+    
+    freeaddrinfo(res);
+    return fd;
+}
+
+static void serveClient(int client, const char* host, const char* port, delaySettings delays)
+{
+    int one = 1;
+    int server = connectServer(host, port);
+    
+    if( server == -1 )
+    {
+        close(client);
+        return;
+    }
+    
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    delayQueue queue;
+    std::thread requests(forwardRequests, client, server);
+    std::thread responses(readResponses, server, &queue, delays);
+    
+    writeResponses(client, &queue);
+    
+    requests.join();
+    responses.join();
+    close(server);
+    close(client);
+}
+
+int main(int argc, char** argv)
+{
+    if( argc != 5 && argc != 7 )
+    {
+        std::cerr << "Usage: " << argv[0] << " listenPort serverHost serverPort delayMs [spikeMs spikePercent]" << std::endl;
+        return -1;
+    }
+    
+    int one = 1;
+    struct sockaddr_in addr;
+    delaySettings delays;
+    delays.delay = std::chrono::milliseconds(atoi(argv[4]));
+    delays.spike = std::chrono::milliseconds(argc == 7 ? atoi(argv[5]) : 0);
+    delays.spikePercent = argc == 7 ? atoi(argv[6]) : 0;
+    
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(atoi(argv[1]));
+    
+    if( bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 128) != 0 )
+    {
+        std::cerr << "Can not listen on port " << argv[1] << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+    
+    for(;;)
+    {
+        int client = accept(listener, NULL, NULL);
+        if( client == -1 )
+            continue;
+        
+        std::thread(serveClient, client, argv[2], argv[3], delays).detach();
+    }
+    
+    return 0;
+}
@@ -0,0 +1,151 @@
+#!/bin/sh
+#
+# File         : slapd.sh
+# Author       : B.Baransel BAĞCI
+# Description  : Local slapd with MDB backend loaded with generated users and groups, for ldapBench.
+#
+# Usage        : slapd.sh start|stop|load
+#                  load  : generate data and load it into a new database
+#                  start : load if there is no database, then start slapd
+#                  stop  : stop slapd
+#
+# Settings are taken from environment:
+#   BENCH_DIR       working directory of config, database and pid (default /tmp/ldapbench)
+#   PORT            listen port (default 3389)
+#   USER_COUNT      number of users (default 10000)
+#   GROUP_COUNT     number of groups (default 100)
+#   MEMBERS         user members of each group (default 200)
+#   GROUP_FANOUT    nesting of groups. 0: each group contains the previous group, a deep chain (default)
+#                   N > 0: group g contains groups g*N+1 .. g*N+N, a wide tree under group0
+#   DESCRIPTIONS    description values of each user (default 2)
+#   VALUE_SIZE      length of each description value (default 64)
+#   MAX_PAGE        max page size accepted by server (default 1000)
+#   SCHEMA_DIR      openldap schema directory (default /etc/openldap/schema or /etc/ldap/schema)
+#   MODULE_DIR      directory of back_mdb module if it is not built in
+#
+# Bind with "cn=admin,dc=bench,dc=local" / "secret". Users are uid=user<N>,ou=users,dc=bench,dc=local
+#
+
+set -e
+
+BENCH_DIR=${BENCH_DIR:-/tmp/ldapbench}
+PORT=${PORT:-3389}
+USER_COUNT=${USER_COUNT:-10000}
+GROUP_COUNT=${GROUP_COUNT:-100}
+MEMBERS=${MEMBERS:-200}
+GROUP_FANOUT=${GROUP_FANOUT:-0}
+DESCRIPTIONS=${DESCRIPTIONS:-2}
+VALUE_SIZE=${VALUE_SIZE:-64}
+MAX_PAGE=${MAX_PAGE:-1000}
+SUFFIX="dc=bench,dc=local"
+
+if [ -z "$SCHEMA_DIR" ]; then
+    for d in /etc/openldap/schema /etc/ldap/schema /usr/local/etc/openldap/schema; do
+        if [ -f "$d/core.schema" ]; then
+            SCHEMA_DIR=$d
+            break
+        fi
+    done
+fi
+
+PATH=$PATH:/usr/sbin:/usr/local/sbin:/usr/local/libexec
+
+write_config()
+{
+    mkdir -p "$BENCH_DIR/db"
+
+    {
+        echo "include $SCHEMA_DIR/core.schema"
+        echo "include $SCHEMA_DIR/cosine.schema"
+        echo "include $SCHEMA_DIR/inetorgperson.schema"
+        echo "pidfile $BENCH_DIR/slapd.pid"
+        echo "argsfile $BENCH_DIR/slapd.args"
+        if [ -n "$MODULE_DIR" ]; then
+            echo "modulepath $MODULE_DIR"
+            echo "moduleload back_mdb"
+        fi
+        # whole result is read with pages, a single page is limited by MAX_PAGE
+        echo "sizelimit size.soft=unlimited size.hard=unlimited size.pr=$MAX_PAGE size.prtotal=unlimited"
+        echo "database mdb"
+        echo "maxsize 4294967296"
+        echo "suffix \"$SUFFIX\""
+        echo "rootdn \"cn=admin,$SUFFIX\""
+        echo "rootpw secret"
+        echo "directory $BENCH_DIR/db"
+        echo "index objectClass eq"
+        echo "index uid eq"
+        echo "index member eq"
+    } > "$BENCH_DIR/slapd.conf"
+}
+
+# users with fixed shape, groups with MEMBERS users each and nested groups by GROUP_FANOUT
+generate_data()
+{
+    awk -v users="$USER_COUNT" -v groups="$GROUP_COUNT" -v members="$MEMBERS" -v fanout="$GROUP_FANOUT" -v descriptions="$DESCRIPTIONS" -v size="$VALUE_SIZE" -v suffix="$SUFFIX" '
+    BEGIN {
+        srand(1)
+        value = ""
+        for( i = 0; i < size; i++ )
+            value = value sprintf("%c", 97 + i % 26)
+
+        printf "dn: %s\nobjectClass: dcObject\nobjectClass: organization\ndc: bench\no: bench\n\n", suffix
+        printf "dn: ou=users,%s\nobjectClass: organizationalUnit\nou: users\n\n", suffix
+        printf "dn: ou=groups,%s\nobjectClass: organizationalUnit\nou: groups\n\n", suffix
+
+        for( u = 0; u < users; u++ )
+        {
+            printf "dn: uid=user%d,ou=users,%s\nobjectClass: inetOrgPerson\nuid: user%d\ncn: User %d\nsn: Surname%d\nmail: user%d@bench.local\n", u, suffix, u, u, u % 1000, u
+            for( d = 0; d < descriptions; d++ )
+                printf "description: %d %s\n", d, value
+            printf "\n"
+        }
+
+        for( g = 0; g < groups; g++ )
+        {
+            printf "dn: cn=group%d,ou=groups,%s\nobjectClass: groupOfNames\ncn: group%d\n", g, suffix, g
+            if( fanout == 0 && g > 0 )
+                printf "member: cn=group%d,ou=groups,%s\n", g - 1, suffix
+            for( c = g * fanout + 1; fanout > 0 && c <= g * fanout + fanout && c < groups; c++ )
+                printf "member: cn=group%d,ou=groups,%s\n", c, suffix
+            for( m = 0; m < members; m++ )
+                printf "member: uid=user%d,ou=users,%s\n", int(rand() * users), suffix
+            printf "\n"
+        }
+    }' > "$BENCH_DIR/data.ldif"
+}
+
+load()
+{
+    rm -rf "$BENCH_DIR/db"
+    write_config
+    generate_data
+    slapadd -q -f "$BENCH_DIR/slapd.conf" -l "$BENCH_DIR/data.ldif"
+    echo "Loaded $USER_COUNT users and $GROUP_COUNT groups into $BENCH_DIR/db"
+}
+
+start()
+{
+    if [ ! -f "$BENCH_DIR/db/data.mdb" ]; then
+        load
+    fi
+    slapd -f "$BENCH_DIR/slapd.conf" -h "ldap://127.0.0.1:$PORT/"
+    echo "slapd listens on ldap://127.0.0.1:$PORT"
+}
+
+stop()
+{
+    if [ -f "$BENCH_DIR/slapd.pid" ]; then
+        kill "$(cat "$BENCH_DIR/slapd.pid")"
+        rm -f "$BENCH_DIR/slapd.pid"
+    fi
+}
+
+case "$1" in
+    start) start ;;
+    stop) stop ;;
+    load) load ;;
+    *)
+        echo "Usage: $0 start|stop|load" >&2
+        exit 1
+        ;;
+esac
@@ -0,0 +1,605 @@
+/*
+ * File         : ldapAsyncReader.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Many outstanding searches on one connection. Results are delivered to callbacks
+ *                or futures while poll() is called from one thread.
+ * Compile Opt  : -lldap -llber -pthread -std=c++11
+ *
+ * Dependency   :
+ *                  ldapReader.h
+ */
+
+#ifndef LDAPASYNCREADER_H
+#define	LDAPASYNCREADER_H
+
+#include "ldapReader.h"
+
+//for request parameters
+#include <string>
+#include <vector>
+//for requests by message id
+#include <unordered_map>
+//for results kept while search is paused
+#include <deque>
+//for callbacks and futures
+#include <functional>
+#include <future>
+#include <memory>
+#include <exception>
+
+/*
+ * Async reader class. search() sends a search and returns at once, poll() receives results of all
+ * outstanding searches and calls their callbacks. Each search is paged separately with setPageSize().
+ *
+ * Entry callback gets the reader itself: getAttribute(), getAttributeView(), getAttributeViewAt() and getDnView()
+ * of ldapReader work on the current object of the search during callback. query()/fetch() must not be used
+ * on the same object. Not thread safe, all calls must be made from the thread which calls poll().
+ * pause() keeps results of a search until resume(), while results of other searches are delivered.
+ */
+class ldapAsyncReader : public ldapReader
+{
+    public:
+        //called for each object, with the reader positioned on it
+        typedef std::function<void(ldapReader&)> entryCallback;
+        //called once when search ends, with ldap result code
+        typedef std::function<void(int)> doneCallback;
+        
+        /*
+         * Define object, initialize session with server and bind.
+         * @param @serverUri    char* : Server connection uri. Example: "ldap://example.org:389"
+         * @param @bindUser     char* : Full dn of bind user. Example: "cn=user1,ou=Accounts,dc=example,dc=org"
+         * @param @bindPass     char* : Password of bind user. Example: "Passw0rd"
+         */
+        ldapAsyncReader(const char* serverUri, const char* bindUser, const char* bindPass)
+        : ldapReader(serverUri, bindUser, bindPass)
+        {
+            this->lastId = 0;
+        };
+        
+        /*
+         * Abandon outstanding searches. Their callbacks are not called.
+         */
+        virtual ~ldapAsyncReader()
+        {
+            for(std::unordered_map<int, ldapAsyncRequest*>::iterator it = this->requests.begin(); it != this->requests.end(); ++it)
+            {
+                if( this->isInitialized )
+                    ldap_abandon_ext(this->connection, it->first, NULL, NULL);
+                delete it->second;
+            }
+        };
+        
+        /*
+         * Send search and return at once
+         * @param @searchFilter     char* : Ldap search filter. Example: "(sAMAccountName=user1)"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         * @param @attrNum          unsigned int : Number of attributes in attributeNames, 0 for all
+         * @param @attributeNames   char** : Names of requested attributes. Example: {"displayName","memberOf"}
+         * @param @onEntry          entryCallback : Called for each object. If it throws, search is abandoned and exception is thrown from poll()
+         * @param @onDone           doneCallback : Called when search ends. Example: [](int code){ ... }
+         * @return int : Request id for cancel()
+         */
+        int search(const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames, entryCallback onEntry, doneCallback onDone)
+        {
+            ldapAsyncRequest* req = this->_createRequest(searchFilter, searchBase, attrNum, attributeNames);
+            req->onEntry = onEntry;
+            req->onDone = onDone;
+            
+            return this->_start(req);
+        };
+        
+        /*
+         * Send search and return future of it. Future gets number of objects, or ldapException if search fails.
+         * @param @searchFilter     char* : Ldap search filter. Example: "(sAMAccountName=user1)"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         * @param @attrNum          unsigned int : Number of attributes in attributeNames, 0 for all
+         * @param @attributeNames   char** : Names of requested attributes. Example: {"displayName","memberOf"}
+         * @param @onEntry          entryCallback : Called for each object. If it throws, future gets the exception
+         * @return future<int> : Completed while poll() is called
+         */
+        std::future<int> search(const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames, entryCallback onEntry)
+        {
+            ldapAsyncRequest* req = this->_createRequest(searchFilter, searchBase, attrNum, attributeNames);
+            req->onEntry = onEntry;
+            req->promise.reset(new std::promise<int>());
+            std::future<int> ret = req->promise->get_future();
+            
+            this->_start(req);
+            
+            return ret;
+        };
+        
+        /*
+         * Abandon search. Its done callback gets LDAP_USER_CANCELLED, its future gets ldapException.
+         * @param @id       int : Request id returned by search()
+         */
+        void cancel(int id)
+        {
+            std::unordered_map<int, ldapAsyncRequest*>::iterator it = this->_findRequest(id);
+            if( it == this->requests.end() )
+                return;
+            
+            ldapAsyncRequest* req = it->second;
+            ldap_abandon_ext(this->connection, it->first, NULL, NULL);
+            this->requests.erase(it);
+            this->_finish(req, LDAP_USER_CANCELLED);
+        };
+        
+        /*
+         * Keep received results of search instead of calling its callbacks, until resume(). Results are kept
+         * in order of arrival, so poll() can read results of other searches meanwhile.
+         * @param @id       int : Request id returned by search()
+         */
+        void pause(int id)
+        {
+            std::unordered_map<int, ldapAsyncRequest*>::iterator it = this->_findRequest(id);
+            if( it != this->requests.end() )
+                it->second->isPaused = true;
+        };
+        
+        /*
+         * Call callbacks of search again. Kept results are delivered first by next poll().
+         * @param @id       int : Request id returned by search()
+         */
+        void resume(int id)
+        {
+            std::unordered_map<int, ldapAsyncRequest*>::iterator it = this->_findRequest(id);
+            if( it == this->requests.end() || ! it->second->isPaused )
+                return;
+            
+            it->second->isPaused = false;
+            if( ! it->second->held.empty() )
+                this->resumed.push_back(id);
+        };
+        
+        /*
+         * Get socket of connection for external event loop (epoll, select). When it is readable, call poll(0).
+         */
+        int getDescriptor()
+        {
+            int fd = -1;
+            
+            if( ldap_get_option(this->connection, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS )
+                throw *(new ldapException("Can not get connection descriptor"));
+            
+            return fd;
+        };
+        
+        /*
+         * Receive arrived results and call callbacks. Waits for the first result up to timeout,
+         * then handles all results which are already received.
+         * @param @timeoutMs    int : Max wait in milliseconds, 0 does not wait, -1 waits until a result arrives. Example: 100
+         * @return int : Number of handled messages
+         */
+        int poll(int timeoutMs)
+        {
+            int ret;
+            int handled = this->_deliverHeld();
+            LDAPMessage* msg;
+            struct timeval tv;
+            
+            //kept results are delivered, do not wait for new ones
+            if( handled > 0 )
+                timeoutMs = 0;
+            
+            while( ! this->requests.empty() )
+            {
+                tv.tv_sec = timeoutMs / 1000;
+                tv.tv_usec = (timeoutMs % 1000) * 1000;
+                
+                ret = ldap_result(this->connection, LDAP_RES_ANY, LDAP_MSG_ONE, timeoutMs < 0 ? NULL : &tv, &msg);
+                
+                if( ret == 0 )
+                    break;
+                
+                if( ret == -1 )
+                {
+                    ldap_get_option(this->connection, LDAP_OPT_RESULT_CODE, &ret);
+                    this->_failAll(ret);
+                    throw *(new ldapException(ldap_err2string(ret), ret));
+                }
+                
+                if( this->_handle(msg) )
+                    handled++;
+                
+                //rest of received results are taken without waiting
+                timeoutMs = 0;
+            }
+            
+            return handled;
+        };
+        
+        /*
+         * Receive one result of a search and call its callbacks. Results of other searches are kept by library.
+         * @param @id           int : Request id returned by search()
+         * @param @timeoutMs    int : Max wait in milliseconds, 0 does not wait, -1 waits until a result arrives. Example: 0
+         * @return int : Number of handled messages, 0 or 1
+         */
+        int pollRequest(int id, int timeoutMs)
+        {
+            int ret;
+            LDAPMessage* msg;
+            struct timeval tv;
+            std::unordered_map<int, ldapAsyncRequest*>::iterator it = this->_findRequest(id);
+            
+            if( it == this->requests.end() || it->second->isPaused )
+                return 0;
+            
+            //results kept while search was paused come first
+            if( ! it->second->held.empty() )
+            {
+                msg = it->second->held.front();
+                it->second->held.pop_front();
+                this->_dispatch(it, msg);
+                return 1;
+            }
+            
+            tv.tv_sec = timeoutMs / 1000;
+            tv.tv_usec = (timeoutMs % 1000) * 1000;
+            
+            ret = ldap_result(this->connection, it->first, LDAP_MSG_ONE, timeoutMs < 0 ? NULL : &tv, &msg);
+            
+            if( ret == 0 )
+                return 0;
+            
+            if( ret == -1 )
+            {
+                ldap_get_option(this->connection, LDAP_OPT_RESULT_CODE, &ret);
+                this->_failAll(ret);
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            }
+            
+            return this->_handle(msg) ? 1 : 0;
+        };
+        
+        /*
+         * Call poll() until all searches end
+         */
+        void run()
+        {
+            while( ! this->requests.empty() )
+                this->poll(-1);
+        };
+        
+        /*
+         * Get number of outstanding searches
+         */
+        size_t getPending()
+        {
+            return this->requests.size();
+        };
+
+    private:
+        //search sent by search()
+        struct ldapAsyncRequest
+        {
+            int id;
+            //parameters, kept for next pages
+            std::string filter;
+            std::string base;
+            std::vector<std::string> attributes;
+            std::vector<char*> attributePointers;
+            //cookie of next page
+            struct berval cookie;
+            //number of objects received
+            int count;
+            //result handlers
+            entryCallback onEntry;
+            doneCallback onDone;
+            std::shared_ptr< std::promise<int> > promise;
+            //results received while paused, delivered after resume()
+            bool isPaused;
+            std::deque<LDAPMessage*> held;
+            
+            ldapAsyncRequest()
+            {
+                this->cookie.bv_val = NULL;
+                this->cookie.bv_len = 0;
+                this->count = 0;
+                this->isPaused = false;
+            };
+            
+            ~ldapAsyncRequest()
+            {
+                if( this->cookie.bv_val != NULL )
+                    ber_memfree(this->cookie.bv_val);
+                
+                for(size_t i=0; i<this->held.size(); i++)
+                    ldap_msgfree(this->held[i]);
+            };
+        };
+        
+        //find request by id, message id changes with each page
+        std::unordered_map<int, ldapAsyncRequest*>::iterator _findRequest(int id)
+        {
+            std::unordered_map<int, ldapAsyncRequest*>::iterator it;
+            
+            for(it = this->requests.begin(); it != this->requests.end(); ++it)
+                if( it->second->id == id )
+                    break;
+            
+            return it;
+        };
+        
+        //copy parameters of search
+        ldapAsyncRequest* _createRequest(const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            if( attrNum > _DEFAULT_MAX_NUMBER_OF_ATTRIBUTES )
+                throw *(new ldapException("Too many attributes requested."));
+            
+            ldapAsyncRequest* req = new ldapAsyncRequest();
+            req->id = ++this->lastId;
+            req->filter = searchFilter;
+            req->base = searchBase;
+            
+            req->attributes.assign(attributeNames, attributeNames + attrNum);
+            for(unsigned int i=0; i<attrNum; i++)
+                req->attributePointers.push_back((char*)req->attributes[i].c_str());
+            //attribute list must end with NULL
+            req->attributePointers.push_back(NULL);
+            
+            return req;
+        };
+        
+        //send first page of request
+        int _start(ldapAsyncRequest* req)
+        {
+            int id = req->id;
+            
+            try
+            {
+                this->_sendRequestPage(req);
+            }
+            catch(ldapException &)
+            {
+                delete req;
+                throw;
+            }
+            
+            return id;
+        };
+        
+        //send search for next page of request
+        void _sendRequestPage(ldapAsyncRequest* req)
+        {
+            int ret;
+            int msgId;
+            LDAPControl* pageCtrl = NULL;
+            LDAPControl* ctrls[2];
+            
+            ret = ldap_create_page_control(this->connection, this->pageSize, &req->cookie, this->isPagingCritical, &pageCtrl);
+            if( ret != LDAP_SUCCESS )
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            
+            ctrls[0] = pageCtrl;
+            ctrls[1] = NULL;
+            
+            ret = ldap_search_ext(this->connection, req->base.c_str(), this->scope, req->filter.c_str(), req->attributes.empty() ? NULL : &req->attributePointers[0], 0, ctrls, NULL, NULL, LDAP_NO_LIMIT, &msgId);
+            
+            //control is encoded into the request, so it can be freed
+            ldap_control_free(pageCtrl);
+            
+            if( ret != LDAP_SUCCESS )
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            
+            this->requests[msgId] = req;
+        };
+        
+        //handle one received message. Return false if it is not delivered to callbacks
+        bool _handle(LDAPMessage* msg)
+        {
+            std::unordered_map<int, ldapAsyncRequest*>::iterator it = this->requests.find(ldap_msgid(msg));
+            
+            //result of abandoned search
+            if( it == this->requests.end() )
+            {
+                ldap_msgfree(msg);
+                return false;
+            }
+            
+            //keep order of results which are waiting for resume() or for delivery
+            if( it->second->isPaused || ! it->second->held.empty() )
+            {
+                it->second->held.push_back(msg);
+                return false;
+            }
+            
+            this->_dispatch(it, msg);
+            return true;
+        };
+        
+        //deliver kept results of resumed searches, in order of resume()
+        int _deliverHeld()
+        {
+            int handled = 0;
+            
+            while( ! this->resumed.empty() )
+            {
+                //callbacks may pause, cancel or end the search, so it is found again for each result
+                std::unordered_map<int, ldapAsyncRequest*>::iterator it = this->_findRequest(this->resumed.front());
+                if( it == this->requests.end() || it->second->isPaused || it->second->held.empty() )
+                {
+                    this->resumed.pop_front();
+                    continue;
+                }
+                
+                LDAPMessage* msg = it->second->held.front();
+                it->second->held.pop_front();
+                this->_dispatch(it, msg);
+                handled++;
+            }
+            
+            return handled;
+        };
+        
+        //call callbacks of message
+        void _dispatch(std::unordered_map<int, ldapAsyncRequest*>::iterator it, LDAPMessage* msg)
+        {
+            ldapAsyncRequest* req = it->second;
+            
+            switch( ldap_msgtype(msg) )
+            {
+                case LDAP_RES_SEARCH_ENTRY:
+                    req->count++;
+                    if( req->onEntry )
+                        this->_callEntry(req, msg);
+                    else
+                        ldap_msgfree(msg);
+                    break;
+                
+                case LDAP_RES_SEARCH_RESULT:
+                    this->requests.erase(it);
+                    this->_handleResult(req, msg);
+                    break;
+                
+                //references are not followed
+                default:
+                    ldap_msgfree(msg);
+                    break;
+            }
+        };
+        
+        //position reader on object and call entry callback
+        void _callEntry(ldapAsyncRequest* req, LDAPMessage* msg)
+        {
+            int msgId = ldap_msgid(msg);
+            std::exception_ptr error;
+            std::unordered_map<int, ldapAsyncRequest*>::iterator it;
+            //callback may cancel its own request, so it must not be called from the request
+            entryCallback onEntry = req->onEntry;
+            
+            //attribute list of request is used by getAttributeViewAt()
+            this->requestedAttributes = req->attributes.empty() ? NULL : &req->attributePointers[0];
+            this->requestedNum = req->attributes.size();
+            this->viewIndex.assign(this->requestedNum, -1);
+            this->result = msg;
+            this->entry = msg;
+            
+            try
+            {
+                onEntry(*this);
+            }
+            catch(...)
+            {
+                error = std::current_exception();
+            }
+            
+            if( this->viewEntry != NULL )
+                this->_clearView();
+            ldap_msgfree(msg);
+            this->result = NULL;
+            this->entry = NULL;
+            this->requestedAttributes = NULL;
+            this->requestedNum = 0;
+            
+            if( ! error )
+                return;
+            
+            //callback may have started or cancelled searches, find request again
+            it = this->requests.find(msgId);
+            if( it == this->requests.end() )
+                std::rethrow_exception(error);
+            
+            ldap_abandon_ext(this->connection, msgId, NULL, NULL);
+            this->requests.erase(it);
+            this->_finish(req, LDAP_OTHER, error);
+        };
+        
+        //end of page: send next page or finish request
+        void _handleResult(ldapAsyncRequest* req, LDAPMessage* msg)
+        {
+            int ret;
+            int err;
+            ber_int_t estimate;
+            LDAPControl** returnedControls = NULL;
+            LDAPControl* pageResponse;
+            
+            ret = ldap_parse_result(this->connection, msg, &err, NULL, NULL, NULL, &returnedControls, 1);
+            if( ret == LDAP_SUCCESS )
+                ret = err;
+            
+            if( req->cookie.bv_val != NULL )
+            {
+                ber_memfree(req->cookie.bv_val);
+                req->cookie.bv_val = NULL;
+                req->cookie.bv_len = 0;
+            }
+            
+            if( ret == LDAP_SUCCESS )
+            {
+                pageResponse = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, returnedControls, NULL);
+                if( pageResponse != NULL )
+                    ret = ldap_parse_pageresponse_control(this->connection, pageResponse, &estimate, &req->cookie);
+            }
+            
+            if( returnedControls != NULL )
+                ldap_controls_free(returnedControls);
+            
+            if( ret == LDAP_SUCCESS && req->cookie.bv_val != NULL && req->cookie.bv_len > 0 )
+            {
+                try
+                {
+                    this->_sendRequestPage(req);
+                    return;
+                }
+                catch(ldapException &e)
+                {
+                    ret = e.getCode();
+                }
+            }
+            
+            this->_finish(req, ret);
+        };
+        
+        //complete request with result code, or with exception of its callback
+        void _finish(ldapAsyncRequest* req, int code, std::exception_ptr error = std::exception_ptr())
+        {
+            //request is freed even if callback throws
+            std::unique_ptr<ldapAsyncRequest> owner(req);
+            
+            if( req->promise )
+            {
+                if( error )
+                    req->promise->set_exception(error);
+                else if( code != LDAP_SUCCESS )
+                    req->promise->set_exception(std::make_exception_ptr(ldapException(ldap_err2string(code), code)));
+                else
+                    req->promise->set_value(req->count);
+                return;
+            }
+            
+            if( req->onDone )
+                req->onDone(code);
+            
+            if( error )
+                std::rethrow_exception(error);
+        };
+        
+        //connection is lost, finish all requests
+        void _failAll(int code)
+        {
+            std::unordered_map<int, ldapAsyncRequest*> failed;
+            failed.swap(this->requests);
+            
+            for(std::unordered_map<int, ldapAsyncRequest*>::iterator it = failed.begin(); it != failed.end(); ++it)
+            {
+                try
+                {
+                    this->_finish(it->second, code);
+                }
+                catch(...)
+                {
+                    //all requests must be finished, error of connection is thrown by poll()
+                }
+            }
+        };
+        
+        //last given request id
+        int lastId;
+        //outstanding requests by message id of their current page
+        std::unordered_map<int, ldapAsyncRequest*> requests;
+        //ids of resumed requests with kept results
+        std::deque<int> resumed;
+};
+
+#endif	/* LDAPASYNCREADER_H */
@@ -0,0 +1,364 @@
+/*
+ * File         : ldapBatchReader.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Lookup of many objects by key values. Keys are grouped into OR filters
+ *                and several searches are kept outstanding on the connection at once.
+ * Compile Opt  : -lldap -llber -std=c++11
+ *
+ * Dependency   :
+ *                  ldapReader.h
+ */
+
+#ifndef LDAPBATCHREADER_H
+#define	LDAPBATCHREADER_H
+
+#include "ldapReader.h"
+
+//for keys and filters
+#include <string>
+#include <vector>
+//for mapping objects back to keys
+#include <unordered_map>
+
+//default number of keys in one OR filter
+#define _DEFAULT_BATCH_SIZE 100
+//default number of searches sent without waiting their results
+#define _DEFAULT_BATCH_OUTSTANDING 8
+
+/*
+ * Batch lookup class. Use lookup() instead of query() and fetchKey() instead of fetch().
+ * Attributes of found objects are read with getAttribute(), getAttributeView() and getDnView() of ldapReader.
+ *
+ * Key values are matched back to objects ignoring ASCII case, like the usual case ignoring matching rules
+ * of name attributes. Keys of attributes with other matching rules (e.g. DN with spaces) may not be matched back.
+ */
+class ldapBatchReader : public ldapReader
+{
+    public:
+        /*
+         * Define object, initialize session with server and bind.
+         * @param @serverUri    char* : Server connection uri. Example: "ldap://example.org:389"
+         * @param @bindUser     char* : Full dn of bind user. Example: "cn=user1,ou=Accounts,dc=example,dc=org"
+         * @param @bindPass     char* : Password of bind user. Example: "Passw0rd"
+         */
+        ldapBatchReader(const char* serverUri, const char* bindUser, const char* bindPass)
+        : ldapReader(serverUri, bindUser, bindPass)
+        {
+            this->batchSize = _DEFAULT_BATCH_SIZE;
+            this->maxOutstanding = _DEFAULT_BATCH_OUTSTANDING;
+            this->nextKey = 0;
+        };
+        
+        virtual ~ldapBatchReader()
+        {
+            this->_abandonBatches();
+        };
+        
+        /*
+         * Set number of keys in one search. Server size limit (e.g. MaxPageSize 1000 of Active Directory) must not be exceeded.
+         * @param @size     unsigned int : Keys per filter. Example: 100
+         */
+        void setBatchSize(unsigned int size)
+        {
+            if( size == 0 )
+                throw *(new ldapException("Batch size must be positive"));
+            
+            this->batchSize = size;
+        };
+        
+        /*
+         * Set number of searches which are sent before their results arrive
+         * @param @num      unsigned int : Outstanding searches. Example: 8
+         */
+        void setMaxOutstanding(unsigned int num)
+        {
+            if( num == 0 )
+                throw *(new ldapException("Max outstanding must be positive"));
+            
+            this->maxOutstanding = num;
+        };
+        
+        /*
+         * Escape value for use in search filter (RFC 4515)
+         * @param @value    string : Raw value. Example: "a*b"
+         * @return string : Escaped value. Example: "a\2ab"
+         */
+        static std::string escape(const std::string& value)
+        {
+            static const char hex[] = "0123456789abcdef";
+            std::string ret;
+            ret.reserve(value.size());
+            
+            for(size_t i=0; i<value.size(); i++)
+            {
+                unsigned char c = value[i];
+                if( c == '*' || c == '(' || c == ')' || c == '\\' || c == '\0' )
+                {
+                    ret += '\\';
+                    ret += hex[c >> 4];
+                    ret += hex[c & 0x0f];
+                }
+                else
+                    ret += c;
+            }
+            
+            return ret;
+        };
+        
+        /*
+         * Start lookup of objects which attribute equals one of the keys, for all attributes
+         * @param @keyAttribute     char* : Attribute of keys. Example: "sAMAccountName"
+         * @param @keys             vector<string> : Key values, not escaped. Example: {"user1","user2"}
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         */
+        void lookup(const char* keyAttribute, const std::vector<std::string>& keys, const char* searchBase)
+        {
+            this->lookup(keyAttribute, keys, searchBase, 0, NULL);
+        };
+        
+        /*
+         * Start lookup of objects which attribute equals one of the keys.
+         * Key attribute is added to requested attributes if it is not in the list.
+         * @param @keyAttribute     char* : Attribute of keys. Example: "sAMAccountName"
+         * @param @keys             vector<string> : Key values, not escaped. Example: {"user1","user2"}
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         * @param @attrNum          unsigned int : Number of attributes in attributeNames
+         * @param @attributeNames   char** : Names of requested attributes. Example: {"displayName","memberOf"}
+         */
+        void lookup(const char* keyAttribute, const std::vector<std::string>& keys, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            const char* attrs[_DEFAULT_MAX_NUMBER_OF_ATTRIBUTES + 1];
+            bool hasKeyAttribute = false;
+            
+            if( attrNum > _DEFAULT_MAX_NUMBER_OF_ATTRIBUTES )
+                throw *(new ldapException("Too many attributes requested."));
+            
+            for(unsigned int i=0; i<attrNum; i++)
+            {
+                attrs[i] = attributeNames[i];
+                if( strcasecmp(attributeNames[i], keyAttribute) == 0 )
+                    hasKeyAttribute = true;
+            }
+            
+            //key attribute is needed to find which keys the object belongs to
+            if( attrNum > 0 && ! hasKeyAttribute )
+            {
+                if( attrNum == _DEFAULT_MAX_NUMBER_OF_ATTRIBUTES )
+                    throw *(new ldapException("Too many attributes requested."));
+                attrs[attrNum++] = keyAttribute;
+            }
+            
+            this->_abandonBatches();
+            this->_prepareQuery("", searchBase, attrNum, attrs);
+            
+            this->keyAttribute = keyAttribute;
+            this->keys = keys;
+            this->isKeyFound.assign(keys.size(), false);
+            this->keyIndex.clear();
+            this->keyIndex.reserve(keys.size());
+            for(size_t i=0; i<keys.size(); i++)
+                this->keyIndex[_normalize(keys[i].data(), keys[i].size())].push_back(i);
+            
+            this->nextKey = 0;
+            this->currentKeys.clear();
+            
+            while( this->outstanding.size() < this->maxOutstanding && this->nextKey < this->keys.size() )
+                this->_sendBatch();
+        };
+        
+        /*
+         * Fetch next found object. If all searches are completed, return false.
+         */
+        bool fetchKey()
+        {
+            int ret;
+            int err;
+            LDAPMessage* msg;
+            struct berval* values;
+            
+            //free previous object
+            if( this->viewEntry != NULL )
+                this->_clearView();
+            if( this->result != NULL )
+            {
+                ldap_msgfree(this->result);
+                this->result = NULL;
+                this->entry = NULL;
+            }
+            this->currentKeys.clear();
+            
+            while( ! this->outstanding.empty() )
+            {
+                ret = ldap_result(this->connection, LDAP_RES_ANY, LDAP_MSG_ONE, NULL, &msg);
+                
+                //timeout set with setTimeout() passed
+                if( ret == 0 )
+                {
+                    this->_abandonBatches();
+                    throw *(new ldapException(ldap_err2string(LDAP_TIMEOUT), LDAP_TIMEOUT));
+                }
+                
+                if( ret == -1 )
+                {
+                    ldap_get_option(this->connection, LDAP_OPT_RESULT_CODE, &ret);
+                    this->_abandonBatches();
+                    throw *(new ldapException(ldap_err2string(ret), ret));
+                }
+                
+                switch( ldap_msgtype(msg) )
+                {
+                    case LDAP_RES_SEARCH_ENTRY:
+                        this->result = msg;
+                        this->entry = msg;
+                        
+                        //find keys of object from key attribute values
+                        ret = this->getAttributeView(this->keyAttribute.c_str(), &values);
+                        for(int i=0; i<ret; i++)
+                        {
+                            std::unordered_map< std::string, std::vector<size_t> >::iterator it = this->keyIndex.find(_normalize(values[i].bv_val, values[i].bv_len));
+                            if( it == this->keyIndex.end() )
+                                continue;
+                            
+                            for(size_t j=0; j<it->second.size(); j++)
+                            {
+                                this->currentKeys.push_back(it->second[j]);
+                                this->isKeyFound[it->second[j]] = true;
+                            }
+                        }
+                        return true;
+                    
+                    case LDAP_RES_SEARCH_RESULT:
+                        this->_removeBatch(ldap_msgid(msg));
+                        
+                        ret = ldap_parse_result(this->connection, msg, &err, NULL, NULL, NULL, NULL, 1);
+                        if( ret == LDAP_SUCCESS )
+                            ret = err;
+                        
+                        //missing base means no key is found, not an error
+                        if( ret != LDAP_SUCCESS && ret != LDAP_NO_SUCH_OBJECT )
+                        {
+                            this->_abandonBatches();
+                            throw *(new ldapException(ldap_err2string(ret), ret));
+                        }
+                        
+                        //keep outstanding searches full
+                        if( this->nextKey < this->keys.size() )
+                            this->_sendBatch();
+                        break;
+                    
+                    //references are not followed
+                    default:
+                        ldap_msgfree(msg);
+                        break;
+                }
+            }
+            
+            return false;
+        };
+        
+        /*
+         * Get positions of keys (in lookup() key list) which current object belongs to
+         */
+        const std::vector<size_t>& getKeys()
+        {
+            return this->currentKeys;
+        };
+        
+        /*
+         * Get positions of keys with no object. Complete after fetchKey() returns false.
+         */
+        std::vector<size_t> getMissing()
+        {
+            std::vector<size_t> ret;
+            
+            for(size_t i=0; i<this->isKeyFound.size(); i++)
+                if( ! this->isKeyFound[i] )
+                    ret.push_back(i);
+            
+            return ret;
+        };
+
+    private:
+        //lower case ASCII value for matching
+        static std::string _normalize(const char* value, size_t len)
+        {
+            std::string ret(value, len);
+            
+            for(size_t i=0; i<len; i++)
+                if( ret[i] >= 'A' && ret[i] <= 'Z' )
+                    ret[i] += 'a' - 'A';
+            
+            return ret;
+        };
+        
+        //send search of next keys
+        void _sendBatch()
+        {
+            int ret;
+            int msgId;
+            size_t end = this->nextKey + this->batchSize;
+            std::string filter;
+            
+            if( end > this->keys.size() )
+                end = this->keys.size();
+            
+            if( end - this->nextKey > 1 )
+                filter = "(|";
+            for(size_t i=this->nextKey; i<end; i++)
+                filter += "(" + this->keyAttribute + "=" + escape(this->keys[i]) + ")";
+            if( end - this->nextKey > 1 )
+                filter += ")";
+            
+            ret = ldap_search_ext(this->connection, this->searchBase, this->scope, filter.c_str(), this->requestedAttributes, 0, NULL, NULL, NULL, LDAP_NO_LIMIT, &msgId);
+            if( ret != LDAP_SUCCESS )
+            {
+                this->_abandonBatches();
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            }
+            
+            this->outstanding.push_back(msgId);
+            this->nextKey = end;
+        };
+        
+        //forget completed search
+        void _removeBatch(int msgId)
+        {
+            for(size_t i=0; i<this->outstanding.size(); i++)
+                if( this->outstanding[i] == msgId )
+                {
+                    this->outstanding[i] = this->outstanding.back();
+                    this->outstanding.pop_back();
+                    return;
+                }
+        };
+        
+        //stop searches of previous lookup
+        void _abandonBatches()
+        {
+            if( this->isInitialized )
+                for(size_t i=0; i<this->outstanding.size(); i++)
+                    ldap_abandon_ext(this->connection, this->outstanding[i], NULL, NULL);
+            
+            this->outstanding.clear();
+            this->nextKey = this->keys.size();
+        };
+        
+        //batch parameters
+        unsigned int batchSize;
+        unsigned int maxOutstanding;
+        
+        //keys of lookup and positions of normalized key values
+        std::string keyAttribute;
+        std::vector<std::string> keys;
+        std::unordered_map< std::string, std::vector<size_t> > keyIndex;
+        std::vector<bool> isKeyFound;
+        
+        //first key not sent yet
+        size_t nextKey;
+        //message ids of sent searches
+        std::vector<int> outstanding;
+        //keys of current object
+        std::vector<size_t> currentKeys;
+};
+
+#endif	/* LDAPBATCHREADER_H */
@@ -0,0 +1,530 @@
+/*
+ * File         : ldapCoroReader.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : C++20 coroutine interface on ldapAsyncReader with a single threaded scheduler.
+ *                Coroutines wait for objects with co_await and other coroutines run meanwhile.
+ * Compile Opt  : -lldap -llber -pthread -std=c++20
+ *
+ * Dependency   :
+ *                  ldapAsyncReader.h
+ */
+
+#ifndef LDAPCOROREADER_H
+#define	LDAPCOROREADER_H
+
+#include "ldapAsyncReader.h"
+
+//for coroutine types
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+//for scheduler queues
+#include <deque>
+#include <vector>
+#include <memory>
+//for waiting on connection socket
+#include <poll.h>
+
+template<typename T> class ldapTask;
+
+//promise parts same for tasks with and without value
+struct ldapTaskPromiseBase
+{
+    //coroutine which awaits the task, resumed when task ends
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+    
+    struct ldapFinalAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        };
+        
+        template<typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept
+        {
+            std::coroutine_handle<> next = handle.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        };
+        
+        void await_resume() noexcept
+        {
+        };
+    };
+    
+    //task starts when it is awaited or spawned
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    };
+    
+    ldapFinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    };
+    
+    void unhandled_exception()
+    {
+        this->error = std::current_exception();
+    };
+};
+
+template<typename T>
+struct ldapTaskPromise : ldapTaskPromiseBase
+{
+    std::optional<T> value;
+    
+    ldapTask<T> get_return_object();
+    
+    void return_value(T v)
+    {
+        this->value = std::move(v);
+    };
+    
+    T result()
+    {
+        if( this->error )
+            std::rethrow_exception(this->error);
+        return std::move(*this->value);
+    };
+};
+
+template<>
+struct ldapTaskPromise<void> : ldapTaskPromiseBase
+{
+    ldapTask<void> get_return_object();
+    
+    void return_void()
+    {
+    };
+    
+    void result()
+    {
+        if( this->error )
+            std::rethrow_exception(this->error);
+    };
+};
+
+/*
+ * Lazy coroutine. Starts when it is awaited with co_await or given to ldapCoroReader::spawn().
+ */
+template<typename T = void>
+class ldapTask
+{
+    public:
+        typedef ldapTaskPromise<T> promise_type;
+        
+        explicit ldapTask(std::coroutine_handle<promise_type> h) : handle(h)
+        {
+        };
+        
+        ldapTask(ldapTask&& other) noexcept : handle(std::exchange(other.handle, nullptr))
+        {
+        };
+        
+        ldapTask& operator=(ldapTask&& other) noexcept
+        {
+            if( this != &other )
+            {
+                if( this->handle )
+                    this->handle.destroy();
+                this->handle = std::exchange(other.handle, nullptr);
+            }
+            return *this;
+        };
+        
+        ldapTask(const ldapTask&) = delete;
+        ldapTask& operator=(const ldapTask&) = delete;
+        
+        virtual ~ldapTask()
+        {
+            if( this->handle )
+                this->handle.destroy();
+        };
+        
+        bool await_ready()
+        {
+            return this->isDone();
+        };
+        
+        //start task and resume awaiting coroutine when it ends
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+        {
+            this->handle.promise().continuation = awaiting;
+            return this->handle;
+        };
+        
+        T await_resume()
+        {
+            return this->handle.promise().result();
+        };
+        
+        /*
+         * Check if task is ended
+         */
+        bool isDone()
+        {
+            return ! this->handle || this->handle.done();
+        };
+        
+        /*
+         * Get value of ended task. Exception of task is thrown.
+         */
+        T getResult()
+        {
+            return this->handle.promise().result();
+        };
+        
+        std::coroutine_handle<> getHandle()
+        {
+            return this->handle;
+        };
+
+    private:
+        std::coroutine_handle<promise_type> handle;
+};
+
+template<typename T>
+inline ldapTask<T> ldapTaskPromise<T>::get_return_object()
+{
+    return ldapTask<T>(std::coroutine_handle< ldapTaskPromise<T> >::from_promise(*this));
+}
+
+inline ldapTask<void> ldapTaskPromise<void>::get_return_object()
+{
+    return ldapTask<void>(std::coroutine_handle< ldapTaskPromise<void> >::from_promise(*this));
+}
+
+//state of a stream, shared with callbacks of async reader
+struct ldapStreamState
+{
+    int id = 0;
+    //coroutine waiting in next()
+    std::coroutine_handle<> waiter;
+    //results are kept by async reader while no coroutine waits
+    bool isPaused = true;
+    bool isDone = false;
+    int code = LDAP_SUCCESS;
+};
+
+class ldapCoroReader;
+
+/*
+ * Objects of one search. co_await next() returns true when reader is positioned on next object,
+ * and false when search ends. Object is valid until the coroutine suspends again.
+ */
+class ldapEntryStream
+{
+    public:
+        ldapEntryStream(ldapCoroReader* owner, std::shared_ptr<ldapStreamState> state) : owner(owner), state(state)
+        {
+        };
+        
+        ldapEntryStream(ldapEntryStream&& other) noexcept : owner(other.owner), state(std::move(other.state))
+        {
+        };
+        
+        ldapEntryStream(const ldapEntryStream&) = delete;
+        ldapEntryStream& operator=(const ldapEntryStream&) = delete;
+        
+        //abandon search if it is not ended
+        virtual ~ldapEntryStream();
+        
+        struct ldapNextAwaiter
+        {
+            ldapEntryStream* stream;
+            
+            bool await_ready()
+            {
+                return this->stream->state->isDone;
+            };
+            
+            void await_suspend(std::coroutine_handle<> handle);
+            
+            bool await_resume()
+            {
+                if( ! this->stream->state->isDone )
+                    return true;
+                
+                if( this->stream->state->code != LDAP_SUCCESS )
+                    throw *(new ldapException(ldap_err2string(this->stream->state->code), this->stream->state->code));
+                
+                return false;
+            };
+        };
+        
+        /*
+         * Wait for next object
+         */
+        ldapNextAwaiter next()
+        {
+            return ldapNextAwaiter{this};
+        };
+        
+        /*
+         * Get reader positioned on current object
+         */
+        ldapReader& getReader();
+
+    private:
+        ldapCoroReader* owner;
+        std::shared_ptr<ldapStreamState> state;
+};
+
+/*
+ * Coroutine reader and its scheduler. All coroutines run in the thread which calls run() or step().
+ * Searches are sent at once; run() resumes each coroutine when an object of its search arrives,
+ * and waits on connection socket when no coroutine can continue. Searches whose coroutine is not waiting
+ * in next() are paused, so their objects are kept until it waits again.
+ */
+class ldapCoroReader
+{
+    public:
+        typedef std::function<void(ldapReader&)> entryCallback;
+        
+        /*
+         * Define coroutine reader on an async reader. Reader must not be polled by others.
+         * @param @reader       ldapAsyncReader& : Connected reader
+         */
+        explicit ldapCoroReader(ldapAsyncReader& reader) : reader(reader)
+        {
+        };
+        
+        /*
+         * Send search and return stream of its objects
+         * @param @searchFilter     char* : Ldap search filter. Example: "(objectClass=user)"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         * @param @attrNum          unsigned int : Number of attributes in attributeNames, 0 for all
+         * @param @attributeNames   char** : Names of requested attributes. Example: {"displayName","memberOf"}
+         */
+        ldapEntryStream search(const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            std::shared_ptr<ldapStreamState> st = std::make_shared<ldapStreamState>();
+            
+            ldapAsyncReader* async = &this->reader;
+            
+            st->id = this->reader.search(searchFilter, searchBase, attrNum, attributeNames,
+                [st, async](ldapReader&)
+                {
+                    //search is paused while no coroutine waits, so objects arrive only to waiting coroutines
+                    if( ! st->waiter )
+                        throw *(new ldapException("Object arrived while stream is not awaited"));
+                    
+                    //coroutine reads the object and runs until it awaits again
+                    std::exchange(st->waiter, nullptr).resume();
+                    
+                    //coroutine suspended somewhere else, keep next objects until it waits again
+                    if( ! st->waiter && ! st->isDone )
+                    {
+                        async->pause(st->id);
+                        st->isPaused = true;
+                    }
+                },
+                [st](int code)
+                {
+                    st->isDone = true;
+                    st->code = code;
+                    
+                    if( st->waiter )
+                        std::exchange(st->waiter, nullptr).resume();
+                });
+            
+            //nothing is polled before this, so no object is delivered before stream is awaited
+            this->reader.pause(st->id);
+            
+            return ldapEntryStream(this, st);
+        };
+        
+        /*
+         * Send search and call function for each object. Use with co_await, returns number of objects.
+         * @param @searchFilter     char* : Ldap search filter. Example: "(objectClass=user)"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         * @param @attrNum          unsigned int : Number of attributes in attributeNames, 0 for all
+         * @param @attributeNames   char** : Names of requested attributes. Example: {"displayName","memberOf"}
+         * @param @onEntry          entryCallback : Called for each object. Example: [](ldapReader& r){ ... }
+         */
+        ldapTask<int> query(const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames, entryCallback onEntry)
+        {
+            //search is sent now, so parameters need not live until the task starts
+            return _drain(this->search(searchFilter, searchBase, attrNum, attributeNames), onEntry);
+        };
+        
+        /*
+         * Start task in scheduler. Exception of task is thrown from run().
+         * @param @task     ldapTask<void> : Task to run
+         */
+        void spawn(ldapTask<void>&& task)
+        {
+            this->ready.push_back(task.getHandle());
+            this->tasks.push_back(std::move(task));
+        };
+        
+        /*
+         * Resume coroutine in scheduler, e.g. when its other I/O completes
+         * @param @handle       coroutine_handle : Suspended coroutine
+         */
+        void post(std::coroutine_handle<> handle)
+        {
+            this->ready.push_back(handle);
+        };
+        
+        struct ldapYieldAwaiter
+        {
+            ldapCoroReader* owner;
+            
+            bool await_ready()
+            {
+                return false;
+            };
+            
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                this->owner->post(handle);
+            };
+            
+            void await_resume()
+            {
+            };
+        };
+        
+        /*
+         * Let other coroutines run. Use with co_await.
+         */
+        ldapYieldAwaiter yield()
+        {
+            return ldapYieldAwaiter{this};
+        };
+        
+        /*
+         * Run coroutines until none is waiting for objects or ready to continue
+         */
+        void run()
+        {
+            while( this->step(-1) )
+                ;
+        };
+        
+        /*
+         * Run coroutines which can continue and deliver arrived objects. If none of them can continue, wait for
+         * connection up to timeout. In an outer event loop, call step(0) when descriptor of reader is readable
+         * and after post(), so other I/O is interleaved with searches.
+         * @param @timeoutMs    int : Max wait in milliseconds, 0 does not wait, -1 waits until data arrives. Example: 0
+         * @return bool : False if no coroutine is waiting for objects or ready to continue
+         */
+        bool step(int timeoutMs)
+        {
+            while( ! this->ready.empty() )
+            {
+                std::coroutine_handle<> h = this->ready.front();
+                this->ready.pop_front();
+                h.resume();
+            }
+            
+            this->_collectTasks();
+            
+            //forget streams whose coroutine is resumed
+            size_t n = 0;
+            for(size_t i=0; i<this->waiting.size(); i++)
+                if( this->waiting[i]->waiter )
+                    this->waiting[n++] = this->waiting[i];
+            this->waiting.resize(n);
+            
+            if( this->waiting.empty() )
+                return ! this->ready.empty();
+            
+            //one dispatch of all searches; objects of searches without waiting coroutine are kept by async reader,
+            //so after it returns 0 nothing is buffered in library and waiting on socket can not miss an object
+            int handled = this->reader.poll(0);
+            
+            //nothing arrived, wait for connection
+            if( handled == 0 && this->ready.empty() && timeoutMs != 0 )
+            {
+                struct pollfd pfd;
+                pfd.fd = this->reader.getDescriptor();
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                ::poll(&pfd, 1, timeoutMs);
+            }
+            
+            return true;
+        };
+        
+        ldapAsyncReader& getReader()
+        {
+            return this->reader;
+        };
+
+    private:
+        friend class ldapEntryStream;
+        
+        static ldapTask<int> _drain(ldapEntryStream stream, entryCallback onEntry)
+        {
+            int count = 0;
+            
+            while( co_await stream.next() )
+            {
+                onEntry(stream.getReader());
+                count++;
+            }
+            
+            co_return count;
+        };
+        
+        //stream waits for its next object
+        void _wait(std::shared_ptr<ldapStreamState> st)
+        {
+            this->waiting.push_back(st);
+        };
+        
+        //free ended tasks and throw their exception
+        void _collectTasks()
+        {
+            for(size_t i=0; i<this->tasks.size(); )
+            {
+                if( ! this->tasks[i].isDone() )
+                {
+                    i++;
+                    continue;
+                }
+                
+                ldapTask<void> done = std::move(this->tasks[i]);
+                this->tasks.erase(this->tasks.begin() + i);
+                done.getResult();
+            }
+        };
+        
+        ldapAsyncReader& reader;
+        //coroutines which can continue
+        std::deque< std::coroutine_handle<> > ready;
+        //streams with a coroutine waiting in next()
+        std::vector< std::shared_ptr<ldapStreamState> > waiting;
+        //spawned tasks
+        std::vector< ldapTask<void> > tasks;
+};
+
+inline ldapEntryStream::~ldapEntryStream()
+{
+    if( this->state && ! this->state->isDone )
+        this->owner->reader.cancel(this->state->id);
+}
+
+inline void ldapEntryStream::ldapNextAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    this->stream->state->waiter = handle;
+    this->stream->owner->_wait(this->stream->state);
+    
+    if( this->stream->state->isPaused )
+    {
+        this->stream->owner->reader.resume(this->stream->state->id);
+        this->stream->state->isPaused = false;
+    }
+}
+
+inline ldapReader& ldapEntryStream::getReader()
+{
+    return this->owner->reader;
+}
+
+#endif	/* LDAPCOROREADER_H */
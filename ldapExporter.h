@@ -0,0 +1,587 @@
+/*
+ * File         : ldapExporter.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Export query results to LDIF, CSV or NDJSON through a large buffer written by a separate thread.
+ * Compile Opt  : -lldap -llber -pthread -std=c++11
+ *
+ * Dependency   :
+ *                  ldapReader.h
+ */
+
+#ifndef LDAPEXPORTER_H
+#define	LDAPEXPORTER_H
+
+#include "ldapReader.h"
+
+//for output
+#include <cstdio>
+//for buffers and columns
+#include <string>
+#include <vector>
+#include <deque>
+//for writer thread
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//default size of one output buffer
+#define _DEFAULT_EXPORT_BUFFER_SIZE (1024*1024)
+//number of filled buffers which can wait for writer thread
+#define _DEFAULT_EXPORT_BUFFERS_IN_FLIGHT 2
+//default separator of multiple values in CSV
+#define _DEFAULT_EXPORT_VALUE_SEPARATOR ';'
+
+/*
+ * Exporter class. Writes all objects of a query made on ldapReader.
+ *  LDIF   : RFC 2849, unsafe values are always base64 encoded
+ *  CSV    : dn and given columns, multiple values joined with value separator. Separator and '\' in values are
+ *           escaped with '\', Example: values "a;b" and "c" are written as "a\;b;c"
+ *  NDJSON : One JSON object per line, {"dn":"...","attribute":["value",...]}, values which are not UTF-8 are always base64 encoded
+ */
+class ldapExporter
+{
+    public:
+        //output formats
+        enum format
+        {
+            LDIF,
+            CSV,
+            NDJSON
+        };
+        
+        /*
+         * Define exporter.
+         * @param @out      FILE* : Output file, it is not closed by exporter. Example: stdout
+         * @param @fmt      format : Output format. Example: ldapExporter::LDIF
+         */
+        ldapExporter(FILE* out, format fmt)
+        {
+            this->out = out;
+            this->fmt = fmt;
+            this->isBase64 = false;
+            this->valueSeparator = _DEFAULT_EXPORT_VALUE_SEPARATOR;
+            this->bufferSize = _DEFAULT_EXPORT_BUFFER_SIZE;
+            this->bytes = 0;
+            this->isDone = false;
+            this->isFailed = false;
+        };
+        
+        virtual ~ldapExporter() {};
+        
+        /*
+         * Encode binary values with base64 in CSV and NDJSON. Default is false.
+         * In NDJSON, attribute which has a binary value is written as "name;base64". LDIF always encodes unsafe values,
+         * and NDJSON always encodes attributes with values which are not valid UTF-8, since JSON strings can not hold them.
+         * @param @base64   bool : Enable base64. Example: true
+         */
+        void setBase64(bool base64)
+        {
+            this->isBase64 = base64;
+        };
+        
+        /*
+         * Set separator of multiple values in a CSV column. Default is ';'
+         * Separator and '\' in values are written with a '\' before them, so values can be split back.
+         * @param @sep      char : Separator. Example: '|'
+         */
+        void setValueSeparator(char sep)
+        {
+            this->valueSeparator = sep;
+        };
+        
+        /*
+         * Set size of output buffers. Default is 1MB
+         * @param @size     size_t : Buffer size in bytes. Example: 4194304
+         */
+        void setBufferSize(size_t size)
+        {
+            this->bufferSize = size;
+        };
+        
+        /*
+         * Set CSV columns. dn is always the first column.
+         * @param @attrNum          unsigned int : Number of columns
+         * @param @attributeNames   char** : Attribute names. Example: {"sAMAccountName","memberOf"}
+         */
+        void setColumns(unsigned int attrNum, const char** attributeNames)
+        {
+            this->columns.assign(attributeNames, attributeNames + attrNum);
+        };
+        
+        /*
+         * Write all remaining objects of the query made on reader.
+         * @return unsigned long : Number of written objects
+         * @param @reader       ldapReader& : Reader which query() is called
+         */
+        unsigned long write(ldapReader& reader)
+        {
+            unsigned long count = 0;
+            
+            this->isDone = false;
+            this->isFailed = false;
+            this->bytes = 0;
+            this->current.reserve(this->bufferSize);
+            std::thread writer(&ldapExporter::_writeBuffers, this);
+            
+            try
+            {
+                if( this->fmt == LDIF )
+                    this->_put("version: 1\n\n");
+                else if( this->fmt == CSV )
+                    this->_writeCsvHeader();
+                
+                while( reader.fetch() )
+                {
+                    switch( this->fmt )
+                    {
+                        case LDIF:
+                            this->_writeLdif(reader);
+                            break;
+                        case CSV:
+                            this->_writeCsv(reader);
+                            break;
+                        case NDJSON:
+                            this->_writeJson(reader);
+                            break;
+                    }
+                    count++;
+                    
+                    if( this->current.size() >= this->bufferSize )
+                        this->_flush();
+                }
+                
+                this->_flush();
+            }
+            catch(...)
+            {
+                this->_finish(writer);
+                //stop the search, remaining objects are not needed
+                reader.clearQuery();
+                throw;
+            }
+            
+            this->_finish(writer);
+            
+            if( this->isFailed )
+                throw *(new ldapException("Can not write output"));
+            
+            return count;
+        };
+        
+        /*
+         * Get number of bytes written by last write()
+         */
+        unsigned long long getBytes()
+        {
+            return this->bytes;
+        };
+
+    private:
+        //append to current buffer
+        void _put(const char* data, size_t len)
+        {
+            this->current.insert(this->current.end(), data, data + len);
+        };
+        
+        void _put(const char* str)
+        {
+            this->_put(str, strlen(str));
+        };
+        
+        void _put(char c)
+        {
+            this->current.push_back(c);
+        };
+        
+        void _put(const struct berval& bv)
+        {
+            this->_put(bv.bv_val, bv.bv_len);
+        };
+        
+        //append base64 encoding of value
+        void _putBase64(const struct berval& bv)
+        {
+            static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            const unsigned char* p = (const unsigned char*)bv.bv_val;
+            size_t i;
+            
+            for(i=0; i+2<bv.bv_len; i+=3)
+            {
+                this->_put(table[p[i] >> 2]);
+                this->_put(table[((p[i] & 0x03) << 4) | (p[i+1] >> 4)]);
+                this->_put(table[((p[i+1] & 0x0f) << 2) | (p[i+2] >> 6)]);
+                this->_put(table[p[i+2] & 0x3f]);
+            }
+            
+            if( i < bv.bv_len )
+            {
+                this->_put(table[p[i] >> 2]);
+                if( i+1 < bv.bv_len )
+                {
+                    this->_put(table[((p[i] & 0x03) << 4) | (p[i+1] >> 4)]);
+                    this->_put(table[(p[i+1] & 0x0f) << 2]);
+                }
+                else
+                {
+                    this->_put(table[(p[i] & 0x03) << 4]);
+                    this->_put('=');
+                }
+                this->_put('=');
+            }
+        };
+        
+        //check if value is not printable text: control characters or invalid UTF-8
+        static bool _isBinary(const struct berval& bv)
+        {
+            return ! _isText(bv, false);
+        };
+        
+        //check if value is valid UTF-8, and has no control characters if they are not allowed
+        static bool _isText(const struct berval& bv, bool isControlAllowed)
+        {
+            const unsigned char* p = (const unsigned char*)bv.bv_val;
+            size_t i = 0;
+            
+            while( i < bv.bv_len )
+            {
+                if( p[i] < 0x80 )
+                {
+                    if( ! isControlAllowed && ( p[i] < 0x20 || p[i] == 0x7f ) )
+                        return false;
+                    i++;
+                    continue;
+                }
+                
+                //length of UTF-8 sequence
+                size_t n = (p[i] & 0xe0) == 0xc0 ? 2 : (p[i] & 0xf0) == 0xe0 ? 3 : (p[i] & 0xf8) == 0xf0 ? 4 : 0;
+                if( n == 0 || i + n > bv.bv_len )
+                    return false;
+                for(size_t j=1; j<n; j++)
+                    if( (p[i+j] & 0xc0) != 0x80 )
+                        return false;
+                i += n;
+            }
+            
+            return true;
+        };
+        
+        //check if value can be written as it is in LDIF (SAFE-STRING of RFC 2849)
+        static bool _isLdifSafe(const struct berval& bv)
+        {
+            if( bv.bv_len == 0 )
+                return true;
+            
+            char first = bv.bv_val[0];
+            if( first == ' ' || first == ':' || first == '<' || bv.bv_val[bv.bv_len-1] == ' ' )
+                return false;
+            
+            for(size_t i=0; i<bv.bv_len; i++)
+            {
+                unsigned char c = bv.bv_val[i];
+                if( c == 0 || c == '\n' || c == '\r' || c > 0x7f )
+                    return false;
+            }
+            
+            return true;
+        };
+        
+        //write "name: value" or "name:: base64"
+        void _putLdifLine(const struct berval& name, const struct berval& value)
+        {
+            this->_put(name);
+            
+            if( _isLdifSafe(value) )
+            {
+                this->_put(": ");
+                this->_put(value);
+            }
+            else
+            {
+                this->_put(":: ");
+                this->_putBase64(value);
+            }
+            
+            this->_put('\n');
+        };
+        
+        void _writeLdif(ldapReader& reader)
+        {
+            struct berval name;
+            struct berval* values;
+            
+            name.bv_val = (char*)"dn";
+            name.bv_len = 2;
+            this->_putLdifLine(name, reader.getDnView());
+            
+            unsigned int attrNum = reader.getAttributeViewCount();
+            for(unsigned int i=0; i<attrNum; i++)
+            {
+                int count = reader.getAttributeViewNth(i, &name, &values);
+                for(int j=0; j<count; j++)
+                    this->_putLdifLine(name, values[j]);
+            }
+            
+            this->_put('\n');
+        };
+        
+        //write CSV field, quoted if needed
+        void _putCsvField(const struct berval& value)
+        {
+            bool quote = false;
+            for(size_t i=0; i<value.bv_len && !quote; i++)
+                quote = value.bv_val[i] == ',' || value.bv_val[i] == '"' || value.bv_val[i] == '\n' || value.bv_val[i] == '\r';
+            
+            if( ! quote )
+            {
+                this->_put(value);
+                return;
+            }
+            
+            this->_put('"');
+            for(size_t i=0; i<value.bv_len; i++)
+            {
+                if( value.bv_val[i] == '"' )
+                    this->_put('"');
+                this->_put(value.bv_val[i]);
+            }
+            this->_put('"');
+        };
+        
+        //append value to CSV field, escaping value separator and escape character
+        void _putCsvValue(const char* value, size_t len)
+        {
+            for(size_t i=0; i<len; i++)
+            {
+                if( value[i] == this->valueSeparator || value[i] == '\\' )
+                    this->field.push_back('\\');
+                this->field.push_back(value[i]);
+            }
+        };
+        
+        void _writeCsvHeader()
+        {
+            this->_put("dn");
+            for(size_t i=0; i<this->columns.size(); i++)
+            {
+                this->_put(',');
+                this->_put(this->columns[i].c_str());
+            }
+            this->_put('\n');
+        };
+        
+        void _writeCsv(ldapReader& reader)
+        {
+            struct berval* values;
+            
+            this->_putCsvField(reader.getDnView());
+            
+            for(size_t i=0; i<this->columns.size(); i++)
+            {
+                this->_put(',');
+                
+                int count = reader.getAttributeView(this->columns[i].c_str(), &values);
+                if( count == 0 )
+                    continue;
+                
+                //join values in a temporary buffer, then quote as one field
+                this->field.clear();
+                for(int j=0; j<count; j++)
+                {
+                    if( j > 0 )
+                        this->field.push_back(this->valueSeparator);
+                    
+                    if( this->isBase64 && _isBinary(values[j]) )
+                    {
+                        //encode into current buffer, then move it to field
+                        size_t start = this->current.size();
+                        this->_putBase64(values[j]);
+                        this->_putCsvValue(&this->current[start], this->current.size() - start);
+                        this->current.resize(start);
+                    }
+                    else
+                        this->_putCsvValue(values[j].bv_val, values[j].bv_len);
+                }
+                
+                struct berval joined;
+                joined.bv_val = this->field.data();
+                joined.bv_len = this->field.size();
+                this->_putCsvField(joined);
+            }
+            
+            this->_put('\n');
+        };
+        
+        //write JSON string with escapes
+        void _putJsonString(const struct berval& value)
+        {
+            static const char hex[] = "0123456789abcdef";
+            
+            this->_put('"');
+            for(size_t i=0; i<value.bv_len; i++)
+            {
+                unsigned char c = value.bv_val[i];
+                switch( c )
+                {
+                    case '"':  this->_put("\\\"", 2); break;
+                    case '\\': this->_put("\\\\", 2); break;
+                    case '\n': this->_put("\\n", 2); break;
+                    case '\r': this->_put("\\r", 2); break;
+                    case '\t': this->_put("\\t", 2); break;
+                    default:
+                        if( c < 0x20 )
+                        {
+                            this->_put("\\u00", 4);
+                            this->_put(hex[c >> 4]);
+                            this->_put(hex[c & 0x0f]);
+                        }
+                        else
+                            this->_put((char)c);
+                }
+            }
+            this->_put('"');
+        };
+        
+        void _writeJson(ldapReader& reader)
+        {
+            struct berval name;
+            struct berval* values;
+            
+            this->_put("{\"dn\":");
+            this->_putJsonString(reader.getDnView());
+            
+            unsigned int attrNum = reader.getAttributeViewCount();
+            for(unsigned int i=0; i<attrNum; i++)
+            {
+                int count = reader.getAttributeViewNth(i, &name, &values);
+                
+                //control characters are escaped in JSON strings, invalid UTF-8 can only be written as base64
+                bool binary = false;
+                for(int j=0; j<count && !binary; j++)
+                    binary = this->isBase64 ? _isBinary(values[j]) : ! _isText(values[j], true);
+                
+                this->_put(",\"");
+                this->_put(name);
+                this->_put(binary ? ";base64\":[" : "\":[");
+                
+                for(int j=0; j<count; j++)
+                {
+                    if( j > 0 )
+                        this->_put(',');
+                    
+                    if( binary )
+                    {
+                        this->_put('"');
+                        this->_putBase64(values[j]);
+                        this->_put('"');
+                    }
+                    else
+                        this->_putJsonString(values[j]);
+                }
+                
+                this->_put(']');
+            }
+            
+            this->_put("}\n");
+        };
+        
+        //give current buffer to writer thread, wait if too many buffers are waiting. Throw if a write failed
+        void _flush()
+        {
+            if( this->current.empty() )
+                return;
+            
+            std::unique_lock<std::mutex> lock(this->mtx);
+            
+            this->cond.wait(lock, [this]{ return this->filled.size() < _DEFAULT_EXPORT_BUFFERS_IN_FLIGHT || this->isFailed; });
+            
+            //output can not be written, so stop fetching instead of reading the rest of the result
+            if( this->isFailed )
+                throw *(new ldapException("Can not write output"));
+            
+            this->filled.push_back(std::vector<char>());
+            this->filled.back().swap(this->current);
+            this->cond.notify_all();
+            
+            //reuse memory of a written buffer
+            if( ! this->spare.empty() )
+            {
+                this->current.swap(this->spare.back());
+                this->spare.pop_back();
+            }
+            this->current.clear();
+            this->current.reserve(this->bufferSize);
+        };
+        
+        //writer thread
+        void _writeBuffers()
+        {
+            std::unique_lock<std::mutex> lock(this->mtx);
+            
+            for(;;)
+            {
+                this->cond.wait(lock, [this]{ return ! this->filled.empty() || this->isDone; });
+                
+                if( this->filled.empty() )
+                    return;
+                
+                std::vector<char> buf;
+                buf.swap(this->filled.front());
+                this->filled.pop_front();
+                
+                //after a failed write, remaining buffers are dropped without writing or counting them
+                bool isWriting = ! this->isFailed;
+                lock.unlock();
+                
+                bool ok = isWriting && fwrite(&buf[0], 1, buf.size(), this->out) == buf.size();
+                
+                lock.lock();
+                if( ok )
+                    this->bytes += buf.size();
+                else
+                    this->isFailed = true;
+                this->spare.push_back(std::vector<char>());
+                this->spare.back().swap(buf);
+                this->cond.notify_all();
+            }
+        };
+        
+        //stop writer thread after remaining buffers are written
+        void _finish(std::thread& writer)
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mtx);
+                this->isDone = true;
+                this->cond.notify_all();
+            }
+            
+            writer.join();
+            fflush(this->out);
+            
+            this->current.clear();
+            this->spare.clear();
+        };
+        
+        //output
+        FILE* out;
+        format fmt;
+        bool isBase64;
+        char valueSeparator;
+        size_t bufferSize;
+        std::vector<std::string> columns;
+        
+        //buffer being filled, and temporary CSV field
+        std::vector<char> current;
+        std::vector<char> field;
+        
+        //buffers waiting for writer thread, and written buffers for reuse
+        std::deque< std::vector<char> > filled;
+        std::vector< std::vector<char> > spare;
+        unsigned long long bytes;
+        bool isDone;
+        bool isFailed;
+        
+        std::mutex mtx;
+        std::condition_variable cond;
+};
+
+#endif	/* LDAPEXPORTER_H */
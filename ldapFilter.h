@@ -0,0 +1,451 @@
+/*
+ * File         : ldapFilter.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Ldap filter (RFC 4515) compiled once and matched against fetched objects on client side.
+ *                Operands are unescaped and lowered at compile time, values are compared in the received
+ *                message without copying them.
+ * Compile Opt  : -lldap -llber
+ *
+ * Dependency   :
+ *                  ldapReader.h
+ */
+
+#ifndef LDAPFILTER_H
+#define	LDAPFILTER_H
+
+#include "ldapReader.h"
+
+//for compiled filter
+#include <string>
+#include <vector>
+//for substring search of 16 bytes at once
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Filter class. Supported items are equality (cn=value), substring (cn=in*any*fin), presence (cn=*),
+ * ordering (uidNumber>=1000, modifyTimestamp<=20240101000000Z) and approximate (cn~=value, matched as equality),
+ * combined with &, | and !. Extensible match items (cn:dn:=value) are refused.
+ *
+ * Values are matched ignoring ASCII case, like caseIgnoreMatch. Ordering compares integers by value when both
+ * sides are integers, otherwise bytes, which orders generalized times of same form.
+ *
+ *      ldapFilter filter("(&(mail=*@example.org)(!(description=*temporary*)))");
+ *      reader.query("(objectClass=person)", base);
+ *      while( reader.fetch() )
+ *          if( filter.match(reader) )
+ *              ...
+ *
+ * match() keeps attribute values of the current object between items, so use one filter object per thread.
+ */
+class ldapFilter
+{
+    public:
+        /*
+         * Compile filter
+         * @param @filter       char* : Ldap filter. Example: "(&(objectClass=person)(uid=user*))"
+         * @param @ignoreCase   bool : Match values ignoring ASCII case, false for byte by byte matching
+         */
+        explicit ldapFilter(const char* filter, bool ignoreCase = true)
+        {
+            const char* p = filter;
+            
+            this->ignoreCase = ignoreCase;
+            this->_compile(p);
+            
+            if( *p != '\0' )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            
+            this->values.resize(this->attributes.size());
+        };
+        
+        virtual ~ldapFilter()
+        {
+        };
+        
+        /*
+         * Match current object of reader
+         * @param @object       R& : Positioned object with getAttributeView(name, berval**). Example: ldapReader or ldapSnapshot
+         * @return bool : Object matches filter
+         */
+        template<typename R>
+        bool match(R& object)
+        {
+            //values are read on first use in this object
+            for(size_t i=0; i<this->values.size(); i++)
+                this->values[i].count = -1;
+            
+            return this->_match(0, object);
+        };
+        
+        /*
+         * Get names of attributes used by filter, each once. They must be in attribute list of query
+         */
+        const std::vector<std::string>& getAttributes()
+        {
+            return this->attributes;
+        };
+
+    private:
+        enum operation
+        {
+            _FILTER_AND,
+            _FILTER_OR,
+            _FILTER_NOT,
+            _FILTER_EQUAL,
+            _FILTER_SUBSTRING,
+            _FILTER_PRESENT,
+            _FILTER_GREATER_EQUAL,
+            _FILTER_LESS_EQUAL
+        };
+        
+        //node of filter. Nodes are stored in prefix order, children of a node are between it and end
+        struct ldapFilterNode
+        {
+            operation op;
+            size_t end;
+            size_t attribute;
+            //equality and ordering operand, or initial part of substring
+            std::string value;
+            std::vector<std::string> any;
+            std::string suffix;
+            bool isNumber;
+            long long number;
+        };
+        
+        //values of an attribute of current object, count is -1 until they are read
+        struct ldapFilterValues
+        {
+            int count;
+            struct berval* values;
+        };
+        
+        //compile filter at p into nodes, p is moved after the filter
+        void _compile(const char*& p)
+        {
+            if( *p != '(' )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            p++;
+            
+            size_t at = this->nodes.size();
+            this->nodes.push_back(ldapFilterNode());
+            
+            if( *p == '&' || *p == '|' || *p == '!' )
+            {
+                this->nodes[at].op = *p == '&' ? _FILTER_AND : ( *p == '|' ? _FILTER_OR : _FILTER_NOT );
+                p++;
+                
+                int childNum = 0;
+                while( *p == '(' )
+                {
+                    this->_compile(p);
+                    childNum++;
+                }
+                
+                if( childNum == 0 || ( this->nodes[at].op == _FILTER_NOT && childNum != 1 ) )
+                    throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            }
+            else
+                this->_compileItem(p, at);
+            
+            if( *p != ')' )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            p++;
+            
+            this->nodes[at].end = this->nodes.size();
+        };
+        
+        void _compileItem(const char*& p, size_t at)
+        {
+            const char* name = p;
+            while( *p != '\0' && *p != '=' && *p != '~' && *p != '>' && *p != '<' && *p != '(' && *p != ')' )
+            {
+                if( *p == ':' )
+                    throw *(new ldapException("Extensible match filters are not supported", LDAP_FILTER_ERROR));
+                p++;
+            }
+            
+            if( p == name )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            
+            std::string attribute(name, p - name);
+            operation op = _FILTER_EQUAL;
+            if( *p == '>' || *p == '<' || *p == '~' )
+            {
+                op = *p == '>' ? _FILTER_GREATER_EQUAL : ( *p == '<' ? _FILTER_LESS_EQUAL : _FILTER_EQUAL );
+                p++;
+            }
+            
+            if( *p != '=' )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            p++;
+            
+            //parts separated by unescaped '*'
+            std::vector<std::string> parts(1);
+            while( *p != '\0' && *p != ')' )
+            {
+                if( *p == '*' )
+                {
+                    parts.push_back(std::string());
+                    p++;
+                }
+                else if( *p == '\\' )
+                {
+                    int hi = _hex(p[1]);
+                    int lo = hi == -1 ? -1 : _hex(p[2]);
+                    if( lo == -1 )
+                        throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+                    parts.back() += this->_fold((char)(hi * 16 + lo));
+                    p += 3;
+                }
+                else if( *p == '(' )
+                    throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+                else
+                    parts.back() += this->_fold(*p++);
+            }
+            
+            ldapFilterNode& node = this->nodes[at];
+            node.attribute = this->_attribute(attribute);
+            node.op = op;
+            node.isNumber = false;
+            
+            if( parts.size() > 1 && op != _FILTER_EQUAL )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            
+            if( parts.size() == 2 && parts[0].empty() && parts[1].empty() )
+                node.op = _FILTER_PRESENT;
+            else if( parts.size() > 1 )
+            {
+                node.op = _FILTER_SUBSTRING;
+                node.value = parts[0];
+                node.suffix = parts.back();
+                for(size_t i=1; i+1<parts.size(); i++)
+                    if( ! parts[i].empty() )
+                        node.any.push_back(parts[i]);
+            }
+            else
+            {
+                node.value = parts[0];
+                node.isNumber = _parseNumber(node.value.data(), node.value.size(), &node.number);
+            }
+        };
+        
+        //position of attribute in attribute list, added if it is new
+        size_t _attribute(const std::string& name)
+        {
+            for(size_t i=0; i<this->attributes.size(); i++)
+                if( this->attributes[i].size() == name.size() && strncasecmp(this->attributes[i].c_str(), name.c_str(), name.size()) == 0 )
+                    return i;
+            
+            this->attributes.push_back(name);
+            return this->attributes.size() - 1;
+        };
+        
+        char _fold(char c)
+        {
+            return this->ignoreCase ? (char)tolower((unsigned char)c) : c;
+        };
+        
+        static int _hex(char c)
+        {
+            if( c >= '0' && c <= '9' )
+                return c - '0';
+            if( c >= 'a' && c <= 'f' )
+                return c - 'a' + 10;
+            if( c >= 'A' && c <= 'F' )
+                return c - 'A' + 10;
+            return -1;
+        };
+        
+        //integer with optional sign, Example: "-42"
+        static bool _parseNumber(const char* v, size_t len, long long* out)
+        {
+            size_t i = 0;
+            bool isNegative = false;
+            unsigned long long n = 0;
+            
+            if( len > 0 && ( v[0] == '-' || v[0] == '+' ) )
+                isNegative = v[i++] == '-';
+            
+            //longer numbers may overflow, they are compared as bytes
+            if( i == len || len - i > 18 )
+                return false;
+            
+            for( ; i < len; i++ )
+            {
+                if( v[i] < '0' || v[i] > '9' )
+                    return false;
+                n = n * 10 + ( v[i] - '0' );
+            }
+            
+            *out = isNegative ? -(long long)n : (long long)n;
+            return true;
+        };
+        
+        template<typename R>
+        bool _match(size_t at, R& object)
+        {
+            const ldapFilterNode& node = this->nodes[at];
+            
+            switch( node.op )
+            {
+                case _FILTER_AND:
+                    for(size_t c=at+1; c<node.end; c=this->nodes[c].end)
+                        if( ! this->_match(c, object) )
+                            return false;
+                    return true;
+                
+                case _FILTER_OR:
+                    for(size_t c=at+1; c<node.end; c=this->nodes[c].end)
+                        if( this->_match(c, object) )
+                            return true;
+                    return false;
+                
+                case _FILTER_NOT:
+                    return ! this->_match(at + 1, object);
+                
+                default:
+                    break;
+            }
+            
+            ldapFilterValues& v = this->values[node.attribute];
+            if( v.count == -1 )
+                v.count = object.getAttributeView(this->attributes[node.attribute].c_str(), &v.values);
+            
+            if( node.op == _FILTER_PRESENT )
+                return v.count > 0;
+            
+            for(int i=0; i<v.count; i++)
+                if( this->_matchValue(node, v.values[i]) )
+                    return true;
+            
+            return false;
+        };
+        
+        bool _matchValue(const ldapFilterNode& node, const struct berval& v)
+        {
+            if( node.op == _FILTER_EQUAL )
+                return v.bv_len == node.value.size() && this->_equals(v.bv_val, node.value.data(), v.bv_len);
+            
+            if( node.op == _FILTER_SUBSTRING )
+                return this->_matchSubstring(node, v);
+            
+            int cmp;
+            long long n;
+            if( node.isNumber && _parseNumber(v.bv_val, v.bv_len, &n) )
+                cmp = n < node.number ? -1 : ( n > node.number ? 1 : 0 );
+            else
+                cmp = this->_compare(v.bv_val, v.bv_len, node.value.data(), node.value.size());
+            
+            return node.op == _FILTER_GREATER_EQUAL ? cmp >= 0 : cmp <= 0;
+        };
+        
+        //initial part at start, final part at end and any parts in order between them, without overlapping
+        bool _matchSubstring(const ldapFilterNode& node, const struct berval& v)
+        {
+            const char* p = v.bv_val;
+            const char* end = v.bv_val + v.bv_len;
+            
+            if( node.value.size() + node.suffix.size() > v.bv_len )
+                return false;
+            if( ! this->_equals(p, node.value.data(), node.value.size()) )
+                return false;
+            if( ! this->_equals(end - node.suffix.size(), node.suffix.data(), node.suffix.size()) )
+                return false;
+            
+            p += node.value.size();
+            end -= node.suffix.size();
+            
+            for(size_t i=0; i<node.any.size(); i++)
+            {
+                const char* found = this->_find(p, end - p, node.any[i].data(), node.any[i].size());
+                if( found == NULL )
+                    return false;
+                p = found + node.any[i].size();
+            }
+            
+            return true;
+        };
+        
+        //value bytes equal to folded operand
+        bool _equals(const char* v, const char* operand, size_t len)
+        {
+            if( ! this->ignoreCase )
+                return memcmp(v, operand, len) == 0;
+            
+            for(size_t i=0; i<len; i++)
+                if( (char)tolower((unsigned char)v[i]) != operand[i] )
+                    return false;
+            
+            return true;
+        };
+        
+        int _compare(const char* v, size_t len, const char* operand, size_t operandLen)
+        {
+            size_t n = len < operandLen ? len : operandLen;
+            
+            for(size_t i=0; i<n; i++)
+            {
+                unsigned char a = this->_fold(v[i]);
+                unsigned char b = operand[i];
+                if( a != b )
+                    return a < b ? -1 : 1;
+            }
+            
+            return len < operandLen ? -1 : ( len > operandLen ? 1 : 0 );
+        };
+        
+        /*
+         * Find folded needle in value. With SSE2 16 positions are checked at once for first and last byte
+         * of needle, and only candidates are compared.
+         */
+        const char* _find(const char* v, size_t len, const char* needle, size_t needleLen)
+        {
+            size_t i = 0;
+            
+            if( needleLen > len )
+                return NULL;
+
+#if defined(__SSE2__)
+            //letters are compared with their lowercase bit set
+            char first = needle[0];
+            char last = needle[needleLen - 1];
+            char firstBit = this->ignoreCase && first >= 'a' && first <= 'z' ? 0x20 : 0;
+            char lastBit = this->ignoreCase && last >= 'a' && last <= 'z' ? 0x20 : 0;
+            __m128i firstByte = _mm_set1_epi8(first);
+            __m128i lastByte = _mm_set1_epi8(last);
+            __m128i firstMask = _mm_set1_epi8(firstBit);
+            __m128i lastMask = _mm_set1_epi8(lastBit);
+            
+            for( ; i + needleLen - 1 + 16 <= len; i += 16 )
+            {
+                __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i*)(v + i)), firstMask);
+                __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i*)(v + i + needleLen - 1)), lastMask);
+                unsigned int bits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, firstByte), _mm_cmpeq_epi8(b, lastByte)));
+                
+                while( bits != 0 )
+                {
+                    unsigned int k = __builtin_ctz(bits);
+                    if( this->_equals(v + i + k, needle, needleLen) )
+                        return v + i + k;
+                    bits &= bits - 1;
+                }
+            }
+#endif
+
+            for( ; i + needleLen <= len; i++ )
+                if( this->_equals(v + i, needle, needleLen) )
+                    return v + i;
+            
+            return NULL;
+        };
+        
+        bool ignoreCase;
+        std::vector<ldapFilterNode> nodes;
+        std::vector<std::string> attributes;
+        //values of current object by attribute position
+        std::vector<ldapFilterValues> values;
+};
+
+#endif	/* LDAPFILTER_H */
@@ -0,0 +1,599 @@
+/*
+ * File         : ldapGroupGraph.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Recursive group expansion. Groups of each nesting level are fetched with batched OR filters
+ *                by threads using readers of a pool. Members are kept in a graph of interned dns, so shared
+ *                subgroups are fetched once and transitive membership is answered from memory.
+ * Compile Opt  : -lldap -llber -pthread -std=c++11
+ *
+ * Dependency   :
+ *                  ldapReader.h, ldapReaderPool.h, ldapBatchReader.h, ldapInterner.h
+ */
+
+#ifndef LDAPGROUPGRAPH_H
+#define	LDAPGROUPGRAPH_H
+
+#include "ldapReaderPool.h"
+#include "ldapBatchReader.h"
+#include "ldapInterner.h"
+
+//for dns and filters
+#include <string>
+#include <vector>
+//for own interner
+#include <memory>
+//for fetch threads
+#include <thread>
+#include <mutex>
+#include <functional>
+//for std::min
+#include <algorithm>
+//for 32 bit node ids
+#include <cstdint>
+
+//default number of groups in one OR filter
+#define _DEFAULT_GROUP_BATCH_SIZE 100
+//default number of threads fetching groups of a level
+#define _DEFAULT_GROUP_THREADS 4
+//default attribute of group members
+#define _DEFAULT_GROUP_MEMBER_ATTRIBUTE "member"
+//default attribute which holds dn of object for filters. Active Directory: "distinguishedName"
+#define _DEFAULT_GROUP_DN_ATTRIBUTE "entryDN"
+//default filter of group objects
+#define _DEFAULT_GROUP_FILTER "(|(objectClass=groupOfNames)(objectClass=groupOfUniqueNames)(objectClass=group))"
+
+/*
+ * Group graph class. Each dn gets a 32 bit id from an ldapInterner, and each fetched group keeps ids of its
+ * direct members and each node ids of groups containing it. The interner can be shared with other results.
+ *
+ * expand() fetches given groups and all nested groups level by level. getMembers(), isMember() and isInCycle()
+ * expand the group if it is not fetched yet, then answer from the graph. Dns which are not returned by the
+ * group filter under search base (users, missing objects) are leaves. Dns outside search base are leaves at once,
+ * without searching them. Cycles of nested groups are allowed, each group is fetched and visited once.
+ */
+class ldapGroupGraph
+{
+    public:
+        /*
+         * Define object
+         * @param @pool         ldapReaderPool& : Pool of connections used for fetching. Must live longer than graph
+         * @param @searchBase   char* : Base of group searches. Example: "ou=groups,dc=example,dc=org"
+         */
+        ldapGroupGraph(ldapReaderPool& pool, const char* searchBase)
+        : pool(pool), searchBase(searchBase), ownInterner(new ldapInterner())
+        {
+            this->interner = this->ownInterner.get();
+            this->_init();
+        };
+        
+        /*
+         * Define object with shared interner, so ids of graph are same as ids of other results
+         * @param @pool         ldapReaderPool& : Pool of connections used for fetching. Must live longer than graph
+         * @param @searchBase   char* : Base of group searches. Example: "ou=groups,dc=example,dc=org"
+         * @param @interner     ldapInterner& : Interner of dns. Must live longer than graph
+         */
+        ldapGroupGraph(ldapReaderPool& pool, const char* searchBase, ldapInterner& interner)
+        : pool(pool), searchBase(searchBase)
+        {
+            this->interner = &interner;
+            this->_init();
+        };
+        
+        virtual ~ldapGroupGraph()
+        {
+        };
+        
+        /*
+         * Get interner of dns. Node ids of graph are ids of this interner
+         */
+        ldapInterner& getInterner()
+        {
+            return *this->interner;
+        };
+        
+        /*
+         * Set attribute of group members. Default is "member"
+         * @param @name     char* : Attribute name. Example: "uniqueMember"
+         */
+        void setMemberAttribute(const char* name)
+        {
+            this->memberAttribute = name;
+        };
+        
+        /*
+         * Set attribute which can be searched with dn of object. Default is "entryDN" (OpenLDAP)
+         * @param @name     char* : Attribute name. Example: "distinguishedName" for Active Directory
+         */
+        void setDnAttribute(const char* name)
+        {
+            this->dnAttribute = name;
+        };
+        
+        /*
+         * Set filter of group objects. Default matches groupOfNames, groupOfUniqueNames and group
+         * @param @filter   char* : Ldap filter. Example: "(objectClass=group)"
+         */
+        void setGroupFilter(const char* filter)
+        {
+            this->groupFilter = filter;
+        };
+        
+        /*
+         * Set number of groups in one search. Server size limit must not be exceeded.
+         * @param @size     unsigned int : Groups per filter. Example: 100
+         */
+        void setBatchSize(unsigned int size)
+        {
+            if( size == 0 )
+                throw *(new ldapException("Batch size must be positive"));
+            
+            this->batchSize = size;
+        };
+        
+        /*
+         * Set number of threads fetching a level. Each thread takes a reader from pool. Default is 4
+         * @param @n        int : Number of threads. Example: 8
+         */
+        void setThreads(int n)
+        {
+            if( n <= 0 )
+                throw *(new ldapException("Thread count must be positive"));
+            
+            this->threadNum = n;
+        };
+        
+        /*
+         * Fetch groups and all their nested groups which are not fetched yet
+         * @param @groupDns     vector<string> : Dns of groups. Example: {"cn=admins,ou=groups,dc=example,dc=org"}
+         */
+        void expand(const std::vector<std::string>& groupDns)
+        {
+            //one expansion at a time, so queued groups always belong to the running one
+            std::lock_guard<std::mutex> expandLock(this->expandMtx);
+            std::vector<uint32_t> frontier;
+            
+            {
+                std::lock_guard<std::mutex> lock(this->mtx);
+                for(size_t i=0; i<groupDns.size(); i++)
+                    this->_enqueue(this->_intern(groupDns[i].c_str(), groupDns[i].size()), frontier);
+            }
+            
+            try
+            {
+                while( ! frontier.empty() )
+                    frontier = this->_expandLevel(frontier);
+            }
+            catch(...)
+            {
+                //groups which are not fetched are tried again in next expansion
+                std::lock_guard<std::mutex> lock(this->mtx);
+                for(size_t i=0; i<this->nodes.size(); i++)
+                    if( this->nodes[i].state == _NODE_QUEUED )
+                        this->nodes[i].state = _NODE_UNKNOWN;
+                throw;
+            }
+        };
+        
+        /*
+         * Get all members of group, including members of nested groups
+         * @param @groupDn      char* : Dn of group. Example: "cn=admins,ou=groups,dc=example,dc=org"
+         * @param @withGroups   bool : Also return nested groups. Example: false
+         * @return vector<string> : Dns of members
+         */
+        std::vector<std::string> getMembers(const char* groupDn, bool withGroups = false)
+        {
+            std::vector<std::string> ret;
+            std::vector<uint32_t> reached;
+            
+            this->expand(std::vector<std::string>(1, groupDn));
+            
+            std::lock_guard<std::mutex> lock(this->mtx);
+            uint32_t id;
+            if( ! this->_find(groupDn, &id) )
+                return ret;
+            
+            this->_walk(id, false, _NO_NODE, reached);
+            for(size_t i=0; i<reached.size(); i++)
+                if( reached[i] != id && ( withGroups || this->nodes[reached[i]].state != _NODE_GROUP ) )
+                    ret.push_back(this->_dn(reached[i]));
+            
+            return ret;
+        };
+        
+        /*
+         * Check whether object is a member of group directly or through nested groups
+         * @param @memberDn     char* : Dn of object. Example: "uid=user1,ou=users,dc=example,dc=org"
+         * @param @groupDn      char* : Dn of group. Example: "cn=admins,ou=groups,dc=example,dc=org"
+         */
+        bool isMember(const char* memberDn, const char* groupDn)
+        {
+            std::vector<uint32_t> reached;
+            
+            this->expand(std::vector<std::string>(1, groupDn));
+            
+            std::lock_guard<std::mutex> lock(this->mtx);
+            uint32_t groupId;
+            uint32_t memberId;
+            if( ! this->_find(groupDn, &groupId) || ! this->_find(memberDn, &memberId) || groupId == memberId )
+                return false;
+            
+            return this->_walk(groupId, false, memberId, reached);
+        };
+        
+        /*
+         * Get groups which contain object directly or through nested groups. Only fetched groups are searched,
+         * expand() the groups of interest before.
+         * @param @memberDn     char* : Dn of object. Example: "uid=user1,ou=users,dc=example,dc=org"
+         * @return vector<string> : Dns of groups
+         */
+        std::vector<std::string> getGroups(const char* memberDn)
+        {
+            std::vector<std::string> ret;
+            std::vector<uint32_t> reached;
+            
+            std::lock_guard<std::mutex> lock(this->mtx);
+            uint32_t id;
+            if( ! this->_find(memberDn, &id) )
+                return ret;
+            
+            this->_walk(id, true, _NO_NODE, reached);
+            for(size_t i=0; i<reached.size(); i++)
+                if( reached[i] != id )
+                    ret.push_back(this->_dn(reached[i]));
+            
+            return ret;
+        };
+        
+        /*
+         * Check whether group contains itself through nested groups
+         * @param @groupDn      char* : Dn of group. Example: "cn=admins,ou=groups,dc=example,dc=org"
+         */
+        bool isInCycle(const char* groupDn)
+        {
+            std::vector<uint32_t> reached;
+            
+            this->expand(std::vector<std::string>(1, groupDn));
+            
+            std::lock_guard<std::mutex> lock(this->mtx);
+            uint32_t id;
+            if( ! this->_find(groupDn, &id) )
+                return false;
+            
+            //target is checked before visited nodes, so walk from group finds path back to it
+            return this->_walk(id, false, id, reached);
+        };
+        
+        /*
+         * Forget members of group, it is fetched again when it is needed
+         * @param @groupDn      char* : Dn of changed group. Example: "cn=admins,ou=groups,dc=example,dc=org"
+         */
+        void invalidate(const char* groupDn)
+        {
+            std::lock_guard<std::mutex> expandLock(this->expandMtx);
+            std::lock_guard<std::mutex> lock(this->mtx);
+            uint32_t id;
+            if( ! this->_find(groupDn, &id) )
+                return;
+            
+            ldapGroupNode& node = this->nodes[id];
+            for(size_t i=0; i<node.members.size(); i++)
+            {
+                std::vector<uint32_t>& parents = this->nodes[node.members[i]].parents;
+                for(size_t p=0; p<parents.size(); p++)
+                    if( parents[p] == id )
+                    {
+                        parents[p] = parents.back();
+                        parents.pop_back();
+                        break;
+                    }
+            }
+            
+            std::vector<uint32_t>().swap(node.members);
+            node.state = _NODE_UNKNOWN;
+        };
+        
+        /*
+         * Forget all groups
+         */
+        void clear()
+        {
+            std::lock_guard<std::mutex> expandLock(this->expandMtx);
+            std::lock_guard<std::mutex> lock(this->mtx);
+            this->nodes.clear();
+        };
+        
+        /*
+         * Get number of nodes in graph, groups and members. With shared interner, it is the highest id in graph + 1
+         */
+        size_t getNodeCount()
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            return this->nodes.size();
+        };
+        
+        /*
+         * Get number of searches made since graph is created
+         */
+        unsigned long getSearchCount()
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            return this->searchCount;
+        };
+
+    private:
+        void _init()
+        {
+            this->memberAttribute = _DEFAULT_GROUP_MEMBER_ATTRIBUTE;
+            this->dnAttribute = _DEFAULT_GROUP_DN_ATTRIBUTE;
+            this->groupFilter = _DEFAULT_GROUP_FILTER;
+            this->batchSize = _DEFAULT_GROUP_BATCH_SIZE;
+            this->threadNum = _DEFAULT_GROUP_THREADS;
+            this->searchCount = 0;
+            
+            std::vector<char> buf(this->searchBase.size() + 1);
+            this->normalizedBase.assign(&buf[0], ldapInterner::normalize(this->searchBase.c_str(), this->searchBase.size(), ldapInterner::DN, &buf[0]));
+        };
+        
+        enum
+        {
+            //dn is seen as member but not fetched
+            _NODE_UNKNOWN,
+            //dn is in a batch of running expansion
+            _NODE_QUEUED,
+            //group with members
+            _NODE_GROUP,
+            //not returned by group search, or outside search base
+            _NODE_LEAF
+        };
+        
+        //no node, for walks without target
+        static const uint32_t _NO_NODE = 0xffffffff;
+        
+        struct ldapGroupNode
+        {
+            //direct members, only for groups
+            std::vector<uint32_t> members;
+            //groups which have this node as direct member
+            std::vector<uint32_t> parents;
+            unsigned char state;
+        };
+        
+        //get id of dn, add it if it is new. mtx must be locked
+        uint32_t _intern(const char* dn, size_t len)
+        {
+            uint32_t id = this->interner->intern(dn, len, ldapInterner::DN);
+            
+            if( id >= _NO_NODE )
+                throw *(new ldapException("Too many objects in group graph"));
+            
+            if( id >= this->nodes.size() )
+            {
+                ldapGroupNode node;
+                node.state = _NODE_UNKNOWN;
+                this->nodes.resize(id + 1, node);
+            }
+            
+            return id;
+        };
+        
+        //get id of dn if it is in graph. mtx must be locked
+        bool _find(const char* dn, uint32_t* id)
+        {
+            return this->interner->find(dn, strlen(dn), ldapInterner::DN, id) && *id < this->nodes.size();
+        };
+        
+        std::string _dn(uint32_t id)
+        {
+            struct berval dn = this->interner->get(id);
+            return std::string(dn.bv_val, dn.bv_len);
+        };
+        
+        //is dn search base or under it, compared normalized
+        bool _isInBase(const char* dn, size_t len)
+        {
+            size_t baseLen = this->normalizedBase.size();
+            if( baseLen == 0 )
+                return true;
+            
+            std::vector<char> buf(len + 1);
+            size_t dnLen = ldapInterner::normalize(dn, len, ldapInterner::DN, &buf[0]);
+            
+            if( dnLen == baseLen )
+                return memcmp(&buf[0], this->normalizedBase.data(), baseLen) == 0;
+            return dnLen > baseLen && buf[dnLen - baseLen - 1] == ',' && memcmp(&buf[dnLen - baseLen], this->normalizedBase.data(), baseLen) == 0;
+        };
+        
+        //add node to next level if it is not fetched. Node outside search base can not be returned, so it is a leaf
+        //without search. mtx must be locked
+        void _enqueue(uint32_t id, std::vector<uint32_t>& frontier)
+        {
+            if( this->nodes[id].state != _NODE_UNKNOWN )
+                return;
+            
+            struct berval dn = this->interner->get(id);
+            if( ! this->_isInBase(dn.bv_val, dn.bv_len) )
+            {
+                this->nodes[id].state = _NODE_LEAF;
+                return;
+            }
+            
+            this->nodes[id].state = _NODE_QUEUED;
+            frontier.push_back(id);
+        };
+        
+        /*
+         * Visit nodes reachable from start through members, or through parents if upward. Each node is visited once,
+         * so cycles end. Stops when target is reached. mtx must be locked
+         * @return bool : Target is reached
+         */
+        bool _walk(uint32_t start, bool upward, uint32_t target, std::vector<uint32_t>& reached)
+        {
+            std::vector<bool> visited(this->nodes.size(), false);
+            
+            reached.clear();
+            reached.push_back(start);
+            visited[start] = true;
+            
+            for(size_t i=0; i<reached.size(); i++)
+            {
+                const std::vector<uint32_t>& next = upward ? this->nodes[reached[i]].parents : this->nodes[reached[i]].members;
+                
+                for(size_t n=0; n<next.size(); n++)
+                {
+                    if( next[n] == target )
+                        return true;
+                    
+                    if( ! visited[next[n]] )
+                    {
+                        visited[next[n]] = true;
+                        reached.push_back(next[n]);
+                    }
+                }
+            }
+            
+            return false;
+        };
+        
+        //fetch groups of one level with threads and return groups of next level
+        std::vector<uint32_t> _expandLevel(const std::vector<uint32_t>& frontier)
+        {
+            std::vector<std::string> filters;
+            std::vector<std::vector<uint32_t> > batches;
+            std::vector<uint32_t> next;
+            
+            {
+                std::lock_guard<std::mutex> lock(this->mtx);
+                for(size_t i=0; i<frontier.size(); i += this->batchSize)
+                {
+                    std::string filter = "(&" + this->groupFilter + "(|";
+                    size_t end = std::min(frontier.size(), i + this->batchSize);
+                    
+                    for(size_t k=i; k<end; k++)
+                        filter += "(" + this->dnAttribute + "=" + ldapBatchReader::escape(this->_dn(frontier[k])) + ")";
+                    filter += "))";
+                    
+                    filters.push_back(filter);
+                    batches.push_back(std::vector<uint32_t>(frontier.begin() + i, frontier.begin() + end));
+                }
+            }
+            
+            size_t nextBatch = 0;
+            std::string error;
+            int errorCode = LDAP_SUCCESS;
+            std::vector<std::thread> workers;
+            
+            int n = this->threadNum;
+            if( (size_t)n > batches.size() )
+                n = batches.size();
+            
+            for(int i=0; i<n; i++)
+                workers.push_back(std::thread(&ldapGroupGraph::_work, this, std::cref(filters), std::cref(batches), &nextBatch, &next, &error, &errorCode));
+            
+            for(size_t i=0; i<workers.size(); i++)
+                workers[i].join();
+            
+            if( ! error.empty() )
+                throw *(new ldapException(error.c_str(), errorCode));
+            
+            return next;
+        };
+        
+        //worker thread, fetches batches until all are taken or one fails
+        void _work(const std::vector<std::string>& filters, const std::vector<std::vector<uint32_t> >& batches, size_t* nextBatch, std::vector<uint32_t>* next, std::string* error, int* errorCode)
+        {
+            try
+            {
+                for(;;)
+                {
+                    size_t b;
+                    {
+                        std::lock_guard<std::mutex> lock(this->mtx);
+                        if( *nextBatch >= batches.size() || ! error->empty() )
+                            return;
+                        b = (*nextBatch)++;
+                        this->searchCount++;
+                    }
+                    
+                    this->pool.run([&](ldapReader& reader){ this->_fetchBatch(reader, filters[b], *next); });
+                    
+                    //groups of batch which are not returned are not groups
+                    std::lock_guard<std::mutex> lock(this->mtx);
+                    for(size_t i=0; i<batches[b].size(); i++)
+                        if( this->nodes[batches[b][i]].state == _NODE_QUEUED )
+                            this->nodes[batches[b][i]].state = _NODE_LEAF;
+                }
+            }
+            catch(std::exception &e)
+            {
+                std::lock_guard<std::mutex> lock(this->mtx);
+                if( error->empty() )
+                {
+                    *error = e.what();
+                    ldapException* le = dynamic_cast<ldapException*>(&e);
+                    *errorCode = le != NULL ? le->getCode() : LDAP_OTHER;
+                }
+            }
+        };
+        
+        //search one batch and add each returned group to graph
+        void _fetchBatch(ldapReader& reader, const std::string& filter, std::vector<uint32_t>& next)
+        {
+            const char* attrs[] = { this->memberAttribute.c_str() };
+            std::vector<std::string> members;
+            
+            reader.query(filter.c_str(), this->searchBase.c_str(), 1, attrs);
+            while( reader.fetch() )
+            {
+                //members are read without lock, large groups may need range requests
+                members.clear();
+                ldapRangeIterator values(reader, this->memberAttribute.c_str());
+                while( values.fetch() )
+                {
+                    struct berval v = values.getValue();
+                    members.push_back(std::string(v.bv_val, v.bv_len));
+                }
+                
+                struct berval dn = reader.getDnView();
+                
+                std::lock_guard<std::mutex> lock(this->mtx);
+                uint32_t id = this->_intern(dn.bv_val, dn.bv_len);
+                
+                //already added, when search is repeated after reconnect
+                if( this->nodes[id].state == _NODE_GROUP )
+                    continue;
+                
+                for(size_t i=0; i<members.size(); i++)
+                {
+                    uint32_t m = this->_intern(members[i].c_str(), members[i].size());
+                    this->nodes[id].members.push_back(m);
+                    this->nodes[m].parents.push_back(id);
+                    this->_enqueue(m, next);
+                }
+                this->nodes[id].state = _NODE_GROUP;
+            }
+        };
+        
+        ldapReaderPool& pool;
+        std::string searchBase;
+        //search base normalized as dn, for skipping members outside it
+        std::string normalizedBase;
+        std::string memberAttribute;
+        std::string dnAttribute;
+        std::string groupFilter;
+        unsigned int batchSize;
+        int threadNum;
+        
+        //ids of dns
+        ldapInterner* interner;
+        std::unique_ptr<ldapInterner> ownInterner;
+        //node of each id
+        std::vector<ldapGroupNode> nodes;
+        unsigned long searchCount;
+        
+        //graph lock
+        std::mutex mtx;
+        //one expansion at a time
+        std::mutex expandMtx;
+};
+
+#endif	/* LDAPGROUPGRAPH_H */
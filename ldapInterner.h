@@ -0,0 +1,349 @@
+/*
+ * File         : ldapInterner.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Concurrent string pool which gives each distinct value a 32 bit id. Dns and attribute names
+ *                are matched after normalization, so repeated values of many objects are stored once and
+ *                compared as integers.
+ * Compile Opt  : -lldap -llber -pthread -std=c++11
+ *
+ * Dependency   :
+ *                  ldapReader.h
+ */
+
+#ifndef LDAPINTERNER_H
+#define	LDAPINTERNER_H
+
+#include "ldapReader.h"
+
+//for values of current object
+#include <vector>
+//for shards
+#include <unordered_map>
+#include <mutex>
+//for id table readable without lock
+#include <atomic>
+#include <cstdint>
+
+//default number of independently locked parts of pool
+#define _DEFAULT_INTERN_SHARDS 16
+//size of arena block of each shard
+#define _DEFAULT_INTERN_BLOCK_SIZE 65536
+//id table is made of segments doubling in size, first segment has 2^_LDAP_INTERN_FIRST_BITS entries
+#define _LDAP_INTERN_FIRST_BITS 10
+#define _LDAP_INTERN_SEGMENTS (32 - _LDAP_INTERN_FIRST_BITS + 1)
+//values up to this length are normalized on stack
+#define _LDAP_INTERN_STACK_SIZE 256
+
+/*
+ * Interner class. Ids are dense, starting from 0, so they can index arrays. Stored values are never moved
+ * or freed until the interner is destroyed, get() returns a view of them without lock.
+ *
+ * Values are matched with the rule given to intern():
+ *  EXACT       : Byte by byte
+ *  IGNORE_CASE : ASCII case ignored, for attribute names and case ignoring values
+ *  DN          : ASCII case ignored and spaces after separators removed. Example: "CN=A, DC=B" equals "cn=a,dc=b"
+ * The first seen form of a value is stored. Values interned with different rules share the id if their
+ * normalized forms are equal, so use one interner per kind of value if that matters.
+ */
+class ldapInterner
+{
+    public:
+        enum rule
+        {
+            EXACT,
+            IGNORE_CASE,
+            DN
+        };
+        
+        /*
+         * Define empty pool
+         * @param @shardNum     int : Number of independently locked parts. Example: 16
+         */
+        explicit ldapInterner(int shardNum = _DEFAULT_INTERN_SHARDS)
+        : shards(shardNum < 1 ? 1 : shardNum)
+        {
+            for(int i=0; i<_LDAP_INTERN_SEGMENTS; i++)
+                this->segments[i].store(NULL, std::memory_order_relaxed);
+            this->nextId.store(0, std::memory_order_relaxed);
+            this->bytes.store(0, std::memory_order_relaxed);
+        };
+        
+        virtual ~ldapInterner()
+        {
+            for(int i=0; i<_LDAP_INTERN_SEGMENTS; i++)
+                delete[] this->segments[i].load(std::memory_order_relaxed);
+        };
+        
+        /*
+         * Get id of value, add it if it is new
+         * @param @value    char* : Value, need not be null terminated. Example: "CN=Admins,DC=example,DC=org"
+         * @param @len      size_t : Length of value
+         * @param @r        rule : Matching rule. Example: ldapInterner::DN
+         * @return uint32_t : Id of value
+         */
+        uint32_t intern(const char* value, size_t len, rule r = EXACT)
+        {
+            char stackBuf[_LDAP_INTERN_STACK_SIZE];
+            std::vector<char> heapBuf;
+            ldapInternKey key = this->_key(value, len, r, stackBuf, heapBuf);
+            size_t hash = key.hash();
+            ldapInternShard& shard = this->shards[hash % this->shards.size()];
+            
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            
+            ldapInternMap::iterator it = shard.ids.find(key);
+            if( it != shard.ids.end() )
+                return it->second;
+            
+            //id is taken only below the limit, so counter never wraps to ids which are in use
+            uint32_t id = this->nextId.load(std::memory_order_relaxed);
+            do
+            {
+                if( id == 0xffffffff )
+                    throw *(new ldapException("Too many values in interner"));
+            }
+            while( ! this->nextId.compare_exchange_weak(id, id + 1, std::memory_order_relaxed) );
+            
+            //stored value, and normalized key after it if it differs
+            bool isSameKey = key.len == len && memcmp(key.ptr, value, len) == 0;
+            size_t size = len + 1 + ( isSameKey ? 0 : key.len + 1 );
+            char* stored = (char*)shard.arena.allocate(size);
+            memcpy(stored, value, len);
+            stored[len] = '\0';
+            
+            ldapInternKey storedKey;
+            storedKey.ptr = stored;
+            storedKey.len = key.len;
+            if( ! isSameKey )
+            {
+                storedKey.ptr = stored + len + 1;
+                memcpy(stored + len + 1, key.ptr, key.len);
+                stored[len + 1 + key.len] = '\0';
+            }
+            
+            struct berval* entry = this->_entry(id, true);
+            entry->bv_val = stored;
+            entry->bv_len = len;
+            
+            shard.ids.insert(std::make_pair(storedKey, id));
+            this->bytes.fetch_add(size, std::memory_order_relaxed);
+            
+            return id;
+        };
+        
+        /*
+         * Get id of null terminated value, add it if it is new
+         * @param @value    char* : Value. Example: "memberOf"
+         * @param @r        rule : Matching rule. Example: ldapInterner::IGNORE_CASE
+         */
+        uint32_t intern(const char* value, rule r = EXACT)
+        {
+            return this->intern(value, strlen(value), r);
+        };
+        
+        /*
+         * Get id of value if it is in pool
+         * @param @value    char* : Value, need not be null terminated. Example: "cn=admins,dc=example,dc=org"
+         * @param @len      size_t : Length of value
+         * @param @r        rule : Matching rule. Example: ldapInterner::DN
+         * @param @id       uint32_t* : Set to id of value if it is found
+         * @return bool : Value is found
+         */
+        bool find(const char* value, size_t len, rule r, uint32_t* id)
+        {
+            char stackBuf[_LDAP_INTERN_STACK_SIZE];
+            std::vector<char> heapBuf;
+            ldapInternKey key = this->_key(value, len, r, stackBuf, heapBuf);
+            ldapInternShard& shard = this->shards[key.hash() % this->shards.size()];
+            
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            
+            ldapInternMap::iterator it = shard.ids.find(key);
+            if( it == shard.ids.end() )
+                return false;
+            
+            *id = it->second;
+            return true;
+        };
+        
+        /*
+         * Get value of id without copying it. Valid until interner is destroyed, null terminated.
+         * Id must be taken from intern() or find(), an id below size() may still be written by another thread.
+         * @param @id       uint32_t : Id returned by intern() or find()
+         * @return berval : Value as first interned
+         */
+        struct berval get(uint32_t id) const
+        {
+            if( id >= this->nextId.load(std::memory_order_relaxed) )
+                throw *(new ldapException("Unknown interned id"));
+            
+            return *this->_entry(id, false);
+        };
+        
+        /*
+         * Intern values of an attribute of current object of reader, without copying them from the message
+         * @param @reader           ldapReader& : Reader positioned on an object with fetch()
+         * @param @attributeName    char* : Attribute name. Example: "memberOf"
+         * @param @ids              vector<uint32_t>& : Ids of values are appended
+         * @param @r                rule : Matching rule. Example: ldapInterner::DN
+         * @return int : Number of values
+         */
+        int internAttribute(ldapReader& reader, const char* attributeName, std::vector<uint32_t>& ids, rule r = DN)
+        {
+            struct berval* values;
+            int count = reader.getAttributeView(attributeName, &values);
+            
+            ids.reserve(ids.size() + count);
+            for(int i=0; i<count; i++)
+                ids.push_back(this->intern(values[i].bv_val, values[i].bv_len, r));
+            
+            return count;
+        };
+        
+        /*
+         * Get number of ids given. Ids are from 0 to size() - 1
+         */
+        uint32_t size() const
+        {
+            return this->nextId.load(std::memory_order_relaxed);
+        };
+        
+        /*
+         * Get bytes of stored values and keys, without tables
+         */
+        size_t getBytes() const
+        {
+            return this->bytes.load(std::memory_order_relaxed);
+        };
+        
+        /*
+         * Normalize value with rule
+         * @param @value    char* : Value. Example: "CN=Admins, DC=Example"
+         * @param @len      size_t : Length of value
+         * @param @r        rule : Matching rule. Example: ldapInterner::DN
+         * @param @out      char* : Buffer of at least len bytes, not null terminated
+         * @return size_t : Length of normalized value
+         */
+        static size_t normalize(const char* value, size_t len, rule r, char* out)
+        {
+            size_t n = 0;
+            bool afterSeparator = true;
+            
+            for(size_t i=0; i<len; i++)
+            {
+                if( r == DN )
+                {
+                    if( value[i] == ' ' && afterSeparator )
+                        continue;
+                    
+                    afterSeparator = ( value[i] == ',' || value[i] == '=' ) && ( i == 0 || value[i-1] != '\\' );
+                }
+                
+                out[n++] = r == EXACT ? value[i] : (char)tolower((unsigned char)value[i]);
+            }
+            
+            return n;
+        };
+
+    private:
+        //normalized value, points into a buffer or stored value
+        struct ldapInternKey
+        {
+            const char* ptr;
+            size_t len;
+            
+            //FNV-1a
+            size_t hash() const
+            {
+                uint64_t h = 14695981039346656037ULL;
+                for(size_t i=0; i<this->len; i++)
+                {
+                    h ^= (unsigned char)this->ptr[i];
+                    h *= 1099511628211ULL;
+                }
+                
+                return (size_t)h;
+            };
+            
+            bool operator==(const ldapInternKey& other) const
+            {
+                return this->len == other.len && memcmp(this->ptr, other.ptr, this->len) == 0;
+            };
+        };
+        
+        struct ldapInternKeyHash
+        {
+            size_t operator()(const ldapInternKey& key) const
+            {
+                return key.hash();
+            };
+        };
+        
+        typedef std::unordered_map<ldapInternKey, uint32_t, ldapInternKeyHash> ldapInternMap;
+        
+        //independently locked part of pool
+        struct ldapInternShard
+        {
+            ldapInternShard() : arena(_DEFAULT_INTERN_BLOCK_SIZE)
+            {
+            };
+            
+            std::mutex mtx;
+            ldapInternMap ids;
+            //memory of stored values and keys
+            ldapArena arena;
+        };
+        
+        //normalize value into stack buffer, or heap buffer if it is long. Exact values are not copied
+        ldapInternKey _key(const char* value, size_t len, rule r, char* stackBuf, std::vector<char>& heapBuf)
+        {
+            ldapInternKey key;
+            key.ptr = value;
+            key.len = len;
+            
+            if( r == EXACT )
+                return key;
+            
+            char* out = stackBuf;
+            if( len > _LDAP_INTERN_STACK_SIZE )
+            {
+                heapBuf.resize(len);
+                out = &heapBuf[0];
+            }
+            
+            key.len = normalize(value, len, r, out);
+            key.ptr = out;
+            return key;
+        };
+        
+        /*
+         * Get table entry of id. Segment s has 2^(_LDAP_INTERN_FIRST_BITS + s) entries and starts
+         * at id 2^_LDAP_INTERN_FIRST_BITS * (2^s - 1)
+         */
+        struct berval* _entry(uint32_t id, bool create) const
+        {
+            uint64_t pos = ((uint64_t)id >> _LDAP_INTERN_FIRST_BITS) + 1;
+            unsigned int s = 63 - __builtin_clzll(pos);
+            uint64_t offset = (uint64_t)id - (((uint64_t)1 << s) - 1) * ((uint64_t)1 << _LDAP_INTERN_FIRST_BITS);
+            
+            struct berval* segment = this->segments[s].load(std::memory_order_acquire);
+            if( segment == NULL && create )
+            {
+                //shards may create same segment at once, one of them wins
+                struct berval* created = new struct berval[(size_t)1 << (_LDAP_INTERN_FIRST_BITS + s)];
+                if( this->segments[s].compare_exchange_strong(segment, created, std::memory_order_acq_rel) )
+                    segment = created;
+                else
+                    delete[] created;
+            }
+            
+            return segment + offset;
+        };
+        
+        std::vector<ldapInternShard> shards;
+        mutable std::atomic<struct berval*> segments[_LDAP_INTERN_SEGMENTS];
+        std::atomic<uint32_t> nextId;
+        std::atomic<size_t> bytes;
+};
+
+#endif	/* LDAPINTERNER_H */
@@ -0,0 +1,499 @@
+/*
+ * File         : ldapParallelReader.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Parallel ldap read by splitting one search into shards of bases or filters.
+ *                Each worker thread makes paged search on its own connection.
+ * Compile Opt  : -lldap -llber -pthread -std=c++11
+ *
+ * Dependency   :
+ *                  ldapReader.h, ldapBatchReader.h
+ */
+
+#ifndef LDAPPARALLELREADER_H
+#define	LDAPPARALLELREADER_H
+
+#include "ldapReader.h"
+//for escape of filter values
+#include "ldapBatchReader.h"
+
+//for shard and attribute lists
+#include <string>
+#include <vector>
+#include <deque>
+//for worker threads
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+//for per thread callback
+#include <functional>
+//for std::find
+#include <algorithm>
+
+//default number of worker threads
+#define _DEFAULT_PARALLEL_THREADS 4
+
+/*
+ * One part of the parallel search
+ */
+struct ldapShard
+{
+    std::string base;
+    std::string filter;
+    int scope;
+};
+
+/*
+ * Parallel reader class. Results are returned in no particular order.
+ * Entries can be consumed with fetch()/getAttribute() from one thread like ldapReader,
+ * or with forEach() which calls given function in worker threads.
+ */
+class ldapParallelReader
+{
+    public:
+        /*
+         * Define object. Connections are made by worker threads on query.
+         * @param @serverUri    char* : Server connection uri. Example: "ldap://example.org:389"
+         * @param @bindUser     char* : Full dn of bind user. Example: "cn=user1,ou=Accounts,dc=example,dc=org"
+         * @param @bindPass     char* : Password of bind user. Example: "Passw0rd"
+         */
+        ldapParallelReader(const char* serverUri, const char* bindUser, const char* bindPass)
+        : uri(serverUri), bindUser(bindUser), bindPass(bindPass)
+        {
+            this->threadNum = _DEFAULT_PARALLEL_THREADS;
+            this->pageSize = _DEFAULT_PAGE_SIZE;
+            this->prefetchPages = _DEFAULT_PREFETCH_PAGES;
+            this->current = NULL;
+            this->runningWorkers = 0;
+            this->isStopped = false;
+            this->isFailed = false;
+            this->isStarted = false;
+            this->isCallbackMode = false;
+            this->errorCode = LDAP_SUCCESS;
+        };
+        
+        virtual ~ldapParallelReader()
+        {
+            this->_stop();
+        };
+        
+        /*
+         * Set max number of worker threads. Each thread has own connection. Default is 4
+         * @param @n        int: Number of threads. Example: 8
+         */
+        void setThreads(int n)
+        {
+            if( n < 1 )
+                throw *(new ldapException("Thread count must be positive"));
+            
+            this->threadNum = n;
+        };
+        
+        /*
+         * Set page size of searches made by workers. Default is 1000
+         * @param @ps       int: Page size, must be positive. Example: 2000
+         */
+        void setPageSize(int ps)
+        {
+            if( ps <= 0 )
+                throw *(new ldapException("Invalid page size"));
+            
+            this->pageSize = ps;
+        };
+        
+        /*
+         * Set prefetch page count of searches made by workers. Default is 0
+         * @param @pages    int: Max number of buffered pages. Example: 2
+         */
+        void setPrefetch(int pages)
+        {
+            this->prefetchPages = pages;
+        };
+        
+        /*
+         * Add a sub base. Subtree of each base is searched by a different worker.
+         * If no base is added, one level children of the search base are discovered on query.
+         * @param @base     char* : Sub base. Example: "ou=Istanbul,ou=SSO,dc=example,dc=org"
+         */
+        void addBase(const char* base)
+        {
+            this->bases.push_back(base);
+        };
+        
+        /*
+         * Add a filter partition. It is combined with the search filter by AND.
+         * Partitions must not overlap, otherwise entries are returned more than once.
+         * @param @filter   char* : Partition filter. Example: "(sAMAccountName=a*)"
+         */
+        void addFilter(const char* filter)
+        {
+            this->filters.push_back(filter);
+        };
+        
+        /*
+         * Add one filter partition for each first character of an attribute, and one
+         * partition for remaining entries, so all entries are covered.
+         * @param @attributeName    char* : Attribute name. Example: "sAMAccountName"
+         * @param @prefixes         char* : First characters. Example: "abcdefghijklmnopqrstuvwxyz0123456789"
+         */
+        void addPrefixFilters(const char* attributeName, const char* prefixes)
+        {
+            std::string rest = "(!(|";
+            
+            for(const char* p = prefixes; *p != '\0'; p++)
+            {
+                std::string f = std::string("(") + attributeName + "=" + ldapBatchReader::escape(std::string(1, *p)) + "*)";
+                this->filters.push_back(f);
+                rest += f;
+            }
+            rest += "))";
+            
+            this->filters.push_back(rest);
+        };
+        
+        /*
+         * Make query for all attributes
+         * @param @searchFilter     char* : Ldap search filter. Example: "(&(objectClass=user)(uidNumber=*))"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         */
+        void query(const char* searchFilter, const char* searchBase)
+        {
+            this->query(searchFilter,searchBase,0);
+        };
+        
+        /*
+         * Make query. Workers start with the first fetch() or forEach()
+         * @param @searchFilter     char* : Ldap search filter. Example: "(&(objectClass=user)(uidNumber=*))"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         * @param @attrNum          unsigned int : Number of attributes which requested. This also must be exact number of variables parameters
+         * @param @attributeName ...      char* : Names of requested attributes. Each attribute is different parameter. Example: "uidNumber"
+         */
+        void query(const char* searchFilter, const char* searchBase, unsigned int attrNum, ...)
+        {
+            //check requested attributes number
+            if( attrNum > _DEFAULT_MAX_NUMBER_OF_ATTRIBUTES)
+                throw *(new ldapException("Too many attributes requested."));
+            
+            //stop workers of previous query
+            this->_stop();
+            
+            this->searchFilter = searchFilter;
+            this->searchBase = searchBase;
+            this->isStarted = false;
+            
+            this->attributes.clear();
+            va_list vp;
+            va_start(vp,attrNum);
+            for(unsigned int i=0; i<attrNum; i++)
+                this->attributes.push_back(va_arg(vp,const char*));
+            va_end(vp);
+            
+            this->_prepareShards();
+        };
+        
+        /*
+         * Fetch next object from any worker. If there is no more object, return false.
+         * Worker hands over its reader with a received page, and waits until the page is consumed,
+         * so getAttribute() can be used and objects of the page are fetched without locking.
+         */
+        bool fetch()
+        {
+            if( ! this->isStarted )
+                this->_start(false);
+            
+            //take next object of current page, worker does not use its reader meanwhile
+            if( this->current != NULL && this->current->fetchInPage() )
+                return true;
+            
+            std::unique_lock<std::mutex> lock(this->mtx);
+            
+            //release worker of consumed page
+            if( this->current != NULL )
+            {
+                this->current = NULL;
+                this->workerCond.notify_all();
+            }
+            
+            this->consumerCond.wait(lock, [this]{ return ! this->ready.empty() || this->runningWorkers == 0; });
+            
+            if( ! this->ready.empty() )
+            {
+                this->current = this->ready.front();
+                this->ready.pop_front();
+                return true;
+            }
+            
+            lock.unlock();
+            this->_join();
+            
+            return false;
+        };
+        
+        /*
+         * Get attribute value from current object.
+         * @return berval** : Return multiple values in struct berval array. Must be freed with ldapReader::clearBerval()
+         * @param @attributeName    char* : Atrribute name. Example: "uidNumber"
+         */
+        struct berval** getAttribute(const char* attributeName)
+        {
+            if( this->current == NULL )
+                throw *(new ldapException("No entry retrieved from server"));
+            
+            return this->current->getAttribute(attributeName);
+        };
+        
+        /*
+         * Get dn of current object.
+         * @return char* : Dn of the object. Must be freed with ldapReader::clearDn()
+         */
+        char* getDn()
+        {
+            if( this->current == NULL )
+                throw *(new ldapException("No entry retrieved from server"));
+            
+            return this->current->getDn();
+        };
+        
+        /*
+         * Call function for each object in worker threads, return when all shards are done.
+         * Function is called concurrently from different threads, each with reader of its own worker.
+         * @param @callback     function : Called for each object. Example: [](ldapReader& r){ ... }
+         */
+        void forEach(std::function<void(ldapReader&)> callback)
+        {
+            this->callback = callback;
+            this->_start(true);
+            this->_join();
+        };
+
+    private:
+        //create shards from bases and filters
+        void _prepareShards()
+        {
+            std::vector<std::string> shardBases = this->bases;
+            this->shards.clear();
+            this->nextShard = 0;
+            
+            //discover one level children, subtree of each is a shard
+            if( shardBases.empty() )
+                this->_discoverBases(shardBases);
+            
+            std::vector<std::string> shardFilters;
+            if( this->filters.empty() )
+                shardFilters.push_back(this->searchFilter);
+            else
+                for(size_t i=0; i<this->filters.size(); i++)
+                    shardFilters.push_back("(&" + this->searchFilter + this->filters[i] + ")");
+            
+            for(size_t i=0; i<shardBases.size(); i++)
+                for(size_t j=0; j<shardFilters.size(); j++)
+                {
+                    ldapShard s;
+                    s.base = shardBases[i];
+                    s.filter = shardFilters[j];
+                    s.scope = LDAP_SCOPE_SUBTREE;
+                    this->shards.push_back(s);
+                }
+            
+            //search base itself is not under any child
+            if( this->bases.empty() )
+                for(size_t j=0; j<shardFilters.size(); j++)
+                {
+                    ldapShard s;
+                    s.base = this->searchBase;
+                    s.filter = shardFilters[j];
+                    s.scope = LDAP_SCOPE_BASE;
+                    this->shards.push_back(s);
+                }
+        };
+        
+        //find one level children of search base
+        void _discoverBases(std::vector<std::string>& out)
+        {
+            ldapReader reader(this->uri.c_str(), this->bindUser.c_str(), this->bindPass.c_str());
+            
+            reader.setPageSize(this->pageSize);
+            reader.setScope(LDAP_SCOPE_ONELEVEL);
+            //request no attributes
+            reader.query("(objectClass=*)", this->searchBase.c_str(), 1, "1.1");
+            
+            while( reader.fetch() )
+            {
+                char* dn = reader.getDn();
+                if( dn != NULL )
+                    out.push_back(dn);
+                ldapReader::clearDn(dn);
+            }
+        };
+        
+        //start worker threads
+        void _start(bool callbackMode)
+        {
+            this->_stop();
+            
+            this->isCallbackMode = callbackMode;
+            this->isStarted = true;
+            this->isStopped = false;
+            this->isFailed = false;
+            this->error.clear();
+            this->nextShard = 0;
+            
+            int n = this->threadNum;
+            if( (size_t)n > this->shards.size() )
+                n = this->shards.size();
+            
+            this->runningWorkers = n;
+            for(int i=0; i<n; i++)
+                this->workers.push_back(std::thread(&ldapParallelReader::_work, this));
+        };
+        
+        //worker thread
+        void _work()
+        {
+            ldapReader* reader = NULL;
+            
+            try
+            {
+                std::vector<const char*> attrs;
+                for(size_t i=0; i<this->attributes.size(); i++)
+                    attrs.push_back(this->attributes[i].c_str());
+                
+                reader = new ldapReader(this->uri.c_str(), this->bindUser.c_str(), this->bindPass.c_str());
+                reader->setPageSize(this->pageSize);
+                reader->setPrefetch(this->prefetchPages);
+                
+                ldapShard* shard;
+                while( (shard = this->_takeShard()) != NULL )
+                {
+                    reader->setScope(shard->scope);
+                    reader->query(shard->filter.c_str(), shard->base.c_str(), attrs.size(), attrs.empty() ? NULL : &attrs[0]);
+                    
+                    while( reader->fetch() )
+                    {
+                        if( this->isCallbackMode )
+                            this->callback(*reader);
+                        //consumer takes the rest of the page with fetchInPage(), fetch() then moves to next page
+                        else if( ! this->_handOver(reader) )
+                            break;
+                    }
+                }
+            }
+            catch(std::exception &e)
+            {
+                std::lock_guard<std::mutex> lock(this->mtx);
+                if( this->error.empty() )
+                {
+                    this->error = e.what();
+                    ldapException* le = dynamic_cast<ldapException*>(&e);
+                    this->errorCode = le != NULL ? le->getCode() : LDAP_OTHER;
+                }
+                //other workers don't take new shards
+                this->isFailed = true;
+            }
+            
+            delete reader;
+            
+            std::lock_guard<std::mutex> lock(this->mtx);
+            this->runningWorkers--;
+            this->consumerCond.notify_all();
+        };
+        
+        //get next shard to search, NULL if all are taken
+        ldapShard* _takeShard()
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            
+            if( this->isStopped || this->isFailed || this->nextShard >= this->shards.size() )
+                return NULL;
+            
+            return &this->shards[this->nextShard++];
+        };
+        
+        //give reader positioned on first object of a page to consumer and wait until the page is consumed. Return false if stopped or failed
+        bool _handOver(ldapReader* reader)
+        {
+            std::unique_lock<std::mutex> lock(this->mtx);
+            
+            if( this->isStopped || this->isFailed )
+                return false;
+            
+            this->ready.push_back(reader);
+            this->consumerCond.notify_one();
+            
+            //reader must not be deleted while consumer can use it, so failure of other workers is not waited here
+            this->workerCond.wait(lock, [this, reader]{ return this->isStopped || ( this->current != reader && std::find(this->ready.begin(), this->ready.end(), reader) == this->ready.end() ); });
+            
+            return ! this->isStopped && ! this->isFailed;
+        };
+        
+        //wait workers and throw error of workers if any
+        void _join()
+        {
+            for(size_t i=0; i<this->workers.size(); i++)
+                this->workers[i].join();
+            this->workers.clear();
+            
+            if( ! this->error.empty() )
+            {
+                std::string msg = this->error;
+                this->error.clear();
+                throw *(new ldapException(msg.c_str(), this->errorCode));
+            }
+        };
+        
+        //stop workers without waiting their results
+        void _stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mtx);
+                this->isStopped = true;
+                this->current = NULL;
+                this->ready.clear();
+                this->workerCond.notify_all();
+            }
+            
+            for(size_t i=0; i<this->workers.size(); i++)
+                this->workers[i].join();
+            this->workers.clear();
+            this->error.clear();
+        };
+        
+        //connection parameters
+        std::string uri;
+        std::string bindUser;
+        std::string bindPass;
+        
+        //query parameters
+        std::string searchFilter;
+        std::string searchBase;
+        std::vector<std::string> attributes;
+        int pageSize;
+        int prefetchPages;
+        
+        //partitions
+        std::vector<std::string> bases;
+        std::vector<std::string> filters;
+        std::vector<ldapShard> shards;
+        size_t nextShard;
+        
+        //workers
+        int threadNum;
+        std::vector<std::thread> workers;
+        int runningWorkers;
+        bool isStopped;
+        bool isFailed;
+        bool isStarted;
+        bool isCallbackMode;
+        std::function<void(ldapReader&)> callback;
+        std::string error;
+        int errorCode;
+        
+        //readers waiting for consumer, and reader of current object
+        std::deque<ldapReader*> ready;
+        ldapReader* current;
+        
+        std::mutex mtx;
+        std::condition_variable consumerCond;
+        std::condition_variable workerCond;
+};
+
+#endif	/* LDAPPARALLELREADER_H */
@@ -7,6 +7,7 @@
  * Dependency   : 
  *                  RHEL 6
  *                      openldap-devel-2.4.39-8.el6.x86_64
+ *                  ldapStats.h (only if _LDAP_STATS is defined, needs c++11)
  */
 
 #ifndef LDAPREADER_H
@@ -18,6 +19,22 @@
 #include <stdexcept>
 //for variable parameter in function query(...)
 #include <cstdarg>
+//for strlen, memcpy
+#include <cstring>
+//for queue of prefetched pages
+#include <deque>
+//for decoded attributes of current entry
+#include <vector>
+//for strncasecmp
+#include <strings.h>
+//for malloc, free
+#include <cstdlib>
+//for page measures
+#include <stdint.h>
+//for round trip time of pages
+#include <time.h>
+//for attribute names of range requests
+#include <cstdio>
 
 //default Ldap Version to 3
 #define _DEFAULT_LDAP_VERSION LDAP_VERSION3
@@ -25,8 +42,48 @@
 #define _DEFAULT_PAGE_SIZE 1000
 //in default paging is mandatory, if server does not support paging throw exception
 #define _DEFAULT_PAGING_CRITICAL 'T'
+//default search scope
+#define _DEFAULT_SCOPE LDAP_SCOPE_SUBTREE
 //max number of attributes which can be retrieved in one query.
 #define _DEFAULT_MAX_NUMBER_OF_ATTRIBUTES 50
+//size of first memory block of query arena
+#define _DEFAULT_ARENA_BLOCK_SIZE 4096
+//number of pages requested ahead while current page is consumed. 0 means no prefetch
+#define _DEFAULT_PREFETCH_PAGES 0
+//while a page request is in flight, check for its arrival once in this many fetch() calls
+#define _DEFAULT_PREFETCH_POLL_INTERVAL 64
+//in adaptive paging, memory which received pages may use. Page size is limited to budget / (bytes per entry * buffered pages)
+#define _DEFAULT_PAGE_MEMORY_BUDGET (16 * 1024 * 1024)
+//in adaptive paging, page size is kept between these limits
+#define _DEFAULT_ADAPTIVE_MIN_PAGE_SIZE 10
+#define _DEFAULT_ADAPTIVE_MAX_PAGE_SIZE 10000
+//in adaptive paging, page size is doubled while throughput of page grows more than this ratio
+#define _DEFAULT_ADAPTIVE_GAIN 1.1
+//round trip of page is timed only if the page was seen incomplete within 1/N of it before it was received.
+//Otherwise the page arrived while the caller was busy and its arrival time is not known
+#define _DEFAULT_PAGE_ARRIVAL_PRECISION 10
+
+//statistics are compiled only if _LDAP_STATS is defined, since counting adds work to each received page and object
+#if defined(_LDAP_STATS) && __cplusplus < 201103L
+#error "_LDAP_STATS needs c++11"
+#endif
+
+#ifdef _LDAP_STATS
+#include "ldapStats.h"
+//add to counter of reader and global counter
+#define _LDAP_STAT_ADD(c, n) this->_statAdd(ldapStats::c, n)
+//start time measure
+#define _LDAP_STAT_START(t) uint64_t t = ldapStats::now()
+//record time passed since start
+#define _LDAP_STAT_TIME(h, t) this->_statRecord(ldapStats::h, ldapStats::now() - (t))
+//record value to histogram of reader and global histogram
+#define _LDAP_STAT_RECORD(h, v) this->_statRecord(ldapStats::h, v)
+#else
+#define _LDAP_STAT_ADD(c, n)
+#define _LDAP_STAT_START(t)
+#define _LDAP_STAT_TIME(h, t)
+#define _LDAP_STAT_RECORD(h, v)
+#endif
 
 /*
  * Exception class for ldap communication in this library.
@@ -38,8 +95,153 @@ class ldapException : public std::runtime_error
         /*
          * Throw an runtime_error exception in the type std:exception
          * @param @msg      char* : Error message. Example: "Auth parameters doesn't exist"
+         * @param @code     int : Ldap result code of the error. Example: LDAP_SERVER_DOWN
+         */
+        explicit ldapException(const char * msg, int code = LDAP_OTHER) : std::runtime_error(msg), code(code){};
+        
+        /*
+         * Get ldap result code of the error. LDAP_OTHER if error is not reported by ldap library
+         */
+        int getCode() const
+        {
+            return this->code;
+        };
+        
+    private:
+        int code;
+};
+
+/*
+ * Memory arena for query parameters. Memory is taken from big blocks and freed all at once with reset().
+ */
+class ldapArena
+{
+    public:
+        /*
+         * Define arena. Memory is not allocated until first use.
+         * @param @blockSize    size_t : Size of first block. Example: 4096
+         */
+        explicit ldapArena(size_t blockSize = _DEFAULT_ARENA_BLOCK_SIZE)
+        {
+            this->blockSize = blockSize;
+            this->head = NULL;
+        };
+        
+        virtual ~ldapArena()
+        {
+            this->_freeBlocks();
+        };
+        
+        /*
+         * Allocate memory from arena. It is valid until reset() or destruction of arena.
+         * @return void* : Memory aligned to pointer size
+         * @param @size     size_t : Size in bytes. Example: 64
+         */
+        void* allocate(size_t size)
+        {
+            //align to pointer size
+            size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+            
+            if( this->head == NULL || this->head->used + size > this->head->size )
+                this->_addBlock(size);
+            
+            void* ret = this->_data(this->head) + this->head->used;
+            this->head->used += size;
+            
+            return ret;
+        };
+        
+        /*
+         * Copy null terminated string into arena
+         * @return char* : Copy of the string
+         * @param @str      char* : String. Example: "uidNumber"
+         */
+        char* copy(const char* str)
+        {
+            size_t len = strlen(str) + 1;
+            char* ret = (char*)this->allocate(len);
+            memcpy(ret, str, len);
+            
+            return ret;
+        };
+        
+        /*
+         * Free all memory taken from arena. If more than one block was used, they are replaced
+         * with one block of total size, so next use of same size needs no allocation.
          */
-        explicit ldapException(const char * msg) : std::runtime_error(msg){};
+        void reset()
+        {
+            if( this->head == NULL )
+                return;
+            
+            if( this->head->next == NULL )
+            {
+                this->head->used = 0;
+                return;
+            }
+            
+            size_t total = 0;
+            for(ldapArenaBlock* b = this->head; b != NULL; b = b->next)
+                total += b->size;
+            
+            this->_freeBlocks();
+            this->blockSize = total;
+            this->_addBlock(0);
+        };
+        
+    private:
+        //header of memory block, data follows it
+        struct ldapArenaBlock
+        {
+            ldapArenaBlock* next;
+            size_t size;
+            size_t used;
+        };
+        
+        //size of block header, rounded up to pointer size
+        static size_t _headerSize()
+        {
+            return (sizeof(ldapArenaBlock) + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+        };
+        
+        //data part of block
+        static char* _data(ldapArenaBlock* b)
+        {
+            return (char*)b + _headerSize();
+        };
+        
+        //add block which has at least size bytes
+        void _addBlock(size_t size)
+        {
+            size_t blockSize = this->head == NULL ? this->blockSize : this->head->size * 2;
+            if( blockSize < size )
+                blockSize = size;
+            
+            ldapArenaBlock* b = (ldapArenaBlock*)malloc(_headerSize() + blockSize);
+            if( b == NULL )
+                throw *(new ldapException("Can not allocate memory", LDAP_NO_MEMORY));
+            
+            b->next = this->head;
+            b->size = blockSize;
+            b->used = 0;
+            this->head = b;
+        };
+        
+        //free all blocks
+        void _freeBlocks()
+        {
+            while( this->head != NULL )
+            {
+                ldapArenaBlock* next = this->head->next;
+                free(this->head);
+                this->head = next;
+            }
+        };
+        
+        //size of first block
+        size_t blockSize;
+        //last added block, memory is taken from it
+        ldapArenaBlock* head;
 };
 
 /*
@@ -138,7 +340,30 @@ class ldapReader
             this->bind(bindUser,bindPass);
         };
         
-        virtual ~ldapReader() {};
+        virtual ~ldapReader()
+        {
+            //free results and close connection
+            this->_clearResult();
+            
+            if( this->isInitialized )
+                ldap_unbind_ext_s(this->connection, NULL, NULL);
+            
+            //free controls
+            if( this->pageControl != NULL )
+                ldap_control_free(this->pageControl);
+            if( this->sortControl != NULL )
+                ldap_control_free(this->sortControl);
+            if( this->vlvControl != NULL )
+                ldap_control_free(this->vlvControl);
+            
+            //free connection parameters
+            delete[] this->uri;
+            if( this->isCredExist )
+            {
+                delete[] this->bindUser;
+                delete[] this->bindCred.bv_val;
+            }
+        };
         
         /*
          * Bind to server.
@@ -173,15 +398,290 @@ class ldapReader
             this->_bind();
         };
         
+        /*
+         * Get dn of bind user, NULL if credential is not set
+         */
+        const char* getBindUser()
+        {
+            return this->isCredExist ? this->bindUser : NULL;
+        };
+        
+        /*
+         * Close connection and connect again, then bind with last credential if exists.
+         * Useful after LDAP_SERVER_DOWN error. Results of current query are freed.
+         */
+        void reconnect()
+        {
+            this->clearQuery();
+            
+            if( this->isInitialized )
+            {
+                ldap_unbind_ext_s(this->connection, NULL, NULL);
+                this->isInitialized = false;
+                this->isBinded = false;
+            }
+            
+            this->_initialize();
+            
+            if( this->version != 0 )
+                this->_setVersion(this->version);
+            
+            if( this->isCredExist )
+                this->_bind();
+        };
+        
+        /*
+         * Check connection with a base search on root DSE.
+         * @return bool : True if server answered in time
+         * @param @timeout      int : Timeout in seconds. Example: 5
+         */
+        bool isAlive(int timeout)
+        {
+            struct timeval tv;
+            LDAPMessage* res = NULL;
+            char noAttribute[] = "1.1";
+            char* attrs[] = { noAttribute, NULL };
+            
+            tv.tv_sec = timeout;
+            tv.tv_usec = 0;
+            
+            int ret = ldap_search_ext_s(this->connection, "", LDAP_SCOPE_BASE, "(objectClass=*)", attrs, 0, NULL, NULL, &tv, 1, &res);
+            
+            if( res != NULL )
+                ldap_msgfree(res);
+            
+            return ret == LDAP_SUCCESS;
+        };
+        
+        /*
+         * Set timeouts of connection, kept after reconnect(). Default is library default, which waits without limit.
+         * A server which is down or too slow fails with LDAP_SERVER_DOWN or LDAP_TIMEOUT instead of blocking.
+         * @param @connectMs    int : Timeout of connecting in milliseconds, -1 for default. Example: 1000
+         * @param @operationMs  int : Timeout of waiting each result in milliseconds, -1 for default. Example: 5000
+         */
+        void setTimeout(int connectMs, int operationMs)
+        {
+            this->connectTimeout = connectMs;
+            this->operationTimeout = operationMs;
+            
+            if( this->isInitialized )
+                this->_setTimeout();
+        };
+        
+        /*
+         * Free results of current query and abandon page request in flight
+         */
+        void clearQuery()
+        {
+            this->_clearResult();
+        };
+        
         /*
          * Set page size for query. Default is 1000
-         * @param @ps       int: Page size. Example: 2000
+         * @param @ps       int: Page size, must be positive. Example: 2000
          */
         void setPageSize(int ps)
         {
+            if( ps <= 0 )
+                throw *(new ldapException("Invalid page size"));
+            
             this->pageSize = ps;
         };
         
+        /*
+         * Let the reader choose size of each page. Default is disabled.
+         * Each query starts with the size given to setPageSize(). After each full page, size is doubled while
+         * bytes per second of page grows, and it is limited so that received pages fit in memory budget
+         * with the measured bytes per entry. Sizes of requested pages are recorded in PAGE_SIZE statistic.
+         * @param @adaptive     bool: Enable adaptive page size. Example: true
+         * @param @memoryBudget size_t: Max bytes of received pages, including prefetched ones. Example: 8388608
+         * @param @maxSize      int: Max page size, should not exceed size limit of server. Example: 5000
+         */
+        void setAdaptivePaging(bool adaptive, size_t memoryBudget = _DEFAULT_PAGE_MEMORY_BUDGET, int maxSize = _DEFAULT_ADAPTIVE_MAX_PAGE_SIZE)
+        {
+            if( maxSize < _DEFAULT_ADAPTIVE_MIN_PAGE_SIZE )
+                throw *(new ldapException("Max page size is too small for adaptive paging"));
+            
+            this->isAdaptivePaging = adaptive;
+            this->pageMemoryBudget = memoryBudget;
+            this->maxPageSize = maxSize;
+        };
+        
+        /*
+         * Get size of the last requested page. It differs from setPageSize() only in adaptive paging.
+         */
+        int getCurrentPageSize()
+        {
+            return this->currentPageSize;
+        };
+        
+        /*
+         * Set number of pages which are requested ahead while current page is consumed. Default is 0
+         * With 0, next page is requested when the last entry of current page is fetched.
+         * With N > 0, next page request is sent as soon as a page arrives and up to N received pages are buffered.
+         * @param @pages    int: Max number of buffered pages. Example: 2
+         */
+        void setPrefetch(int pages)
+        {
+            if( pages < 0 )
+                throw *(new ldapException("Prefetch page count can not be negative"));
+
+            this->prefetchPages = pages;
+        };
+        
+        /*
+         * Set search scope. Default is LDAP_SCOPE_SUBTREE
+         * @param @sc       int: LDAP_SCOPE_BASE, LDAP_SCOPE_ONELEVEL or LDAP_SCOPE_SUBTREE. Example: LDAP_SCOPE_ONELEVEL
+         */
+        void setScope(int sc)
+        {
+            this->scope = sc;
+        };
+        
+        /*
+         * Get search scope
+         */
+        int getScope()
+        {
+            return this->scope;
+        };
+        
+        /*
+         * Enable or disable streaming mode. Default is false. Must be set before query()
+         * In streaming mode fetch() returns each entry as soon as it arrives and frees it on next fetch(),
+         * instead of waiting for the whole page. Memory usage does not depend on page size.
+         * Prefetch is not used in streaming mode, next page is requested when the end of current page arrives.
+         * Search errors are thrown from fetch() instead of query().
+         * @param @streaming    bool: Enable streaming. Example: true
+         */
+        void setStreaming(bool streaming)
+        {
+            this->isStreaming = streaming;
+        };
+        
+        /*
+         * Sort results on server (RFC 2891). Must be set before query()
+         * @param @keys     char* : Space separated attribute names, '-' prefix for reverse order. NULL disables sort. Example: "sn -givenName"
+         */
+        void setSort(const char* keys)
+        {
+            int ret;
+            LDAPSortKey** keyList = NULL;
+            
+            if( this->sortControl != NULL )
+            {
+                ldap_control_free(this->sortControl);
+                this->sortControl = NULL;
+            }
+            
+            if( keys == NULL )
+                return;
+            
+            ret = ldap_create_sort_keylist(&keyList, (char*)keys);
+            if( ret != LDAP_SUCCESS )
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            
+            //sort is critical, unsorted result must not be taken as sorted
+            ret = ldap_create_sort_control(this->connection, keyList, 1, &this->sortControl);
+            ldap_free_sort_keylist(keyList);
+            
+            if( ret != LDAP_SUCCESS )
+                throw *(new ldapException(ldap_err2string(ret), ret));
+        };
+        
+        /*
+         * Read only a window of sorted result with virtual list view. Sort must be set. Must be set before query()
+         * Paging is not used while window is set, so window must be smaller than server size limit.
+         * @param @offset   int : Position of target object in sorted list, 1 is the first. Example: 5001
+         * @param @before   int : Number of objects before target. Example: 0
+         * @param @after    int : Number of objects after target. Example: 49
+         */
+        void setWindow(int offset, int before, int after)
+        {
+            if( offset < 1 || before < 0 || after < 0 )
+                throw *(new ldapException("Invalid window"));
+            
+            this->vlvOffset = offset;
+            this->vlvBefore = before;
+            this->vlvAfter = after;
+        };
+        
+        /*
+         * Disable virtual list view, read whole result with paging
+         */
+        void clearWindow()
+        {
+            this->vlvOffset = 0;
+        };
+        
+        /*
+         * Get position of target object in sorted list, returned by server for last window query
+         */
+        int getWindowTarget()
+        {
+            return this->vlvTarget;
+        };
+        
+        /*
+         * Get number of objects in sorted list, returned by server for last window query
+         */
+        int getWindowCount()
+        {
+            return this->vlvCount;
+        };
+        
+        /*
+         * Request only attribute names without values, e.g. for existence checks. Default is false
+         * @param @attrsOnly    bool : Enable attributes only. Example: true
+         */
+        void setAttrsOnly(bool attrsOnly)
+        {
+            this->isAttrsOnly = attrsOnly;
+        };
+        
+        /*
+         * Add control sent with each query. Control is not copied or freed, it must live until clearControls()
+         * @param @ctrl     LDAPControl* : Control. Example: control created with ldap_control_create()
+         */
+        void addControl(LDAPControl* ctrl)
+        {
+            this->userControls.push_back(ctrl);
+        };
+        
+        /*
+         * Remove controls added with addControl()
+         */
+        void clearControls()
+        {
+            this->userControls.clear();
+        };
+        
+        /*
+         * Check whether sort, window, attributes only or added controls are set, which change results of query()
+         */
+        bool hasResultOptions()
+        {
+            return this->sortControl != NULL || this->vlvOffset > 0 || this->isAttrsOnly || ! this->userControls.empty();
+        };
+        
+#ifdef _LDAP_STATS
+        /*
+         * Get counters and histograms of this reader. Use ldapStats::global().snapshot() for all readers.
+         */
+        ldapStatsSnapshot getStats()
+        {
+            return this->stats.snapshot();
+        };
+        
+        /*
+         * Reset statistics of this reader
+         */
+        void resetStats()
+        {
+            this->stats.reset();
+        };
+#endif
+        
         //FIX ME: ldap func. doesn't return count??
         /*ber_int_t getResultCount()
         {
@@ -207,45 +707,46 @@ class ldapReader
          */
         void query(const char* searchFilter, const char* searchBase, unsigned int attrNum, ...)
         {
-             //allocate and set search filter
-            this->searchFilter = new char[strlen(searchFilter)+1];
-            memcpy(this->searchFilter,searchFilter,strlen(searchFilter)+1);
+            const char* attributeNames[_DEFAULT_MAX_NUMBER_OF_ATTRIBUTES];
             
-             //allocate and set search base
-            this->searchBase = new char[strlen(searchBase)+1];
-            memcpy(this->searchBase,searchBase,strlen(searchBase)+1);
-
-            if( attrNum > 0 )
+            //check requested attributes number
+            if( attrNum > _DEFAULT_MAX_NUMBER_OF_ATTRIBUTES)
+                throw *(new ldapException("Too many attributes requested."));
+            
+            va_list vp;
+            va_start(vp,attrNum);
+            
+            //get all attribute names
+            for(unsigned int i=0; i<attrNum; i++)
+                attributeNames[i] = va_arg(vp,const char*);
+            va_end(vp);
+            
+            this->query(searchFilter,searchBase,attrNum,attributeNames);
+        };
+        
+        /*
+         * Make query for attributes given in an array
+         * @param @searchFilter     char* : Ldap search filter. Example: "(&(objectClass=user)(uidNumber=*))"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         * @param @attrNum          unsigned int : Number of attributes in attributeNames
+         * @param @attributeNames   char** : Names of requested attributes. Example: {"uidNumber","memberOf"}
+         */
+        void query(const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            this->_prepareQuery(searchFilter,searchBase,attrNum,attributeNames);
+            
+            _LDAP_STAT_ADD(SEARCHES, 1);
+            _LDAP_STAT_START(start);
+            try
             {
-                //check requested attributes number
-                if( attrNum > _DEFAULT_MAX_NUMBER_OF_ATTRIBUTES)
-                    throw *(new ldapException("Too many attributes requested."));
-
-                //allocate memory for requested attribute names. +1 for NULL element
-                this->requestedAttributes = new char*[attrNum+1];
-
-                char* buf;
-                va_list vp;
-                va_start(vp,attrNum);
-                
-                //get all attribute name and set it in object
-                for(int i=0; i<attrNum; i++)
-                {
-                    buf = va_arg(vp,char*);
-                    this->requestedAttributes[i] = new char[strlen(buf)+1];
-                    memcpy(this->requestedAttributes[i],buf,strlen(buf)+1);
-                }
-                va_end(vp);
-                
-                //attribute list must end with NULL, so set last element to NULL
-                this->requestedAttributes[attrNum] = NULL;
+                this->_query();
             }
-
-            //if exist, delete old result
-            if( this->result != NULL )
-                ldap_memfree(this->result);
-            
-            this->_query();
+            catch(ldapException &)
+            {
+                _LDAP_STAT_ADD(SEARCH_ERRORS, 1);
+                throw;
+            }
+            _LDAP_STAT_TIME(SEARCH_TIME, start);
         };
         
         /*
@@ -253,67 +754,381 @@ class ldapReader
          */
         bool fetch()
         {
+            //attribute views of previous object are not valid anymore
+            if(this->viewEntry != NULL)
+                this->_clearView();
+            
+            if(this->isStreaming)
+                return this->_fetchStream();
+            
             if(this->result == NULL)
                 return false;
             else if( this->entry == NULL )
-            {
                 //set first entry
                 this->entry = ldap_first_entry(this->connection,this->result);
-
-                if( this->entry != NULL )
-                    return true;
-                else
-                    return false;
-            }
-            
-            this->entry = ldap_next_entry(this->connection,this->entry);
+            else
+                this->entry = ldap_next_entry(this->connection,this->entry);
             
             if( this->entry != NULL)
+            {
+                //check whether prefetched page arrived, so the request of following page can be sent
+                if( this->pendingMsgId != -1 && ++this->fetchCounter % _DEFAULT_PREFETCH_POLL_INTERVAL == 0 )
+                    this->_collectPages(false);
+
                 return true;
+            }
             
-            if( this->isMorePageAvailable )
-            {
-                this->_query();
+            //current page is consumed, switch to next one
+            if( this->_nextPage() )
                 return this->fetch();
-            }
             else
                 return false;
             
         }
         
+        /*
+         * Fetch next object of the received page without waiting for server. Reader must be on an object of the page.
+         * Return false at the end of the page, then fetch() continues with the next page.
+         */
+        bool fetchInPage()
+        {
+            LDAPMessage* next;
+            
+            if( this->isStreaming || this->entry == NULL )
+                return false;
+            
+            next = ldap_next_entry(this->connection, this->entry);
+            if( next == NULL )
+                return false;
+            
+            //attribute views of previous object are not valid anymore
+            if( this->viewEntry != NULL )
+                this->_clearView();
+            
+            this->entry = next;
+            return true;
+        }
+        
         /*
          * Get attribute value from current object.
          * @return berval** : Return multiple values in struct berval array
          * @param @attributeName    char* : Atrribute name. Example: "uidNumber"
          */
-        struct berval** getAttribute(char* attributeName)
+        struct berval** getAttribute(const char* attributeName)
         {
             struct berval **ret;
             
             if(this->entry == NULL)
                 throw *(new ldapException("No entry retrieved from server"));
             
+            _LDAP_STAT_START(start);
             ret = ldap_get_values_len(this->connection, this->entry, attributeName);
+            _LDAP_STAT_ADD(DECODES, 1);
+            _LDAP_STAT_TIME(DECODE_TIME, start);
             
             return ret;
             
         }
         
+        /*
+         * Get attribute values from current object without copying them.
+         * Object is decoded once on the first call, so other attributes are found without decoding again.
+         * Values point into the received message and are valid until next fetch(). They are not null terminated,
+         * use bv_len. Values must not be freed.
+         * @return int : Number of values. 0 if object doesn't have the attribute
+         * @param @attributeName    char* : Atrribute name. Example: "memberOf"
+         * @param @values           berval** : Set to array of values, NULL if object doesn't have the attribute
+         */
+        int getAttributeView(const char* attributeName, struct berval** values)
+        {
+            if(this->entry == NULL)
+                throw *(new ldapException("No entry retrieved from server"));
+            
+            if(this->viewEntry != this->entry)
+                this->_decodeView();
+            
+            for(size_t i=0; i<this->view.size(); i++)
+                if( _isAttribute(this->view[i].name, attributeName) )
+                    return this->_viewValues(i, values);
+            
+            *values = NULL;
+            return 0;
+        }
+        
+        /*
+         * Get attribute values from current object by its position in attribute list of query(), without copying them.
+         * Positions are resolved when object is decoded, so lookup does not compare names.
+         * Values are valid until next fetch(), not null terminated and must not be freed.
+         * @return int : Number of values. 0 if object doesn't have the attribute
+         * @param @index            int : Position of attribute in query(). Example: 0 for first attribute
+         * @param @values           berval** : Set to array of values, NULL if object doesn't have the attribute
+         */
+        int getAttributeViewAt(unsigned int index, struct berval** values)
+        {
+            if(this->entry == NULL)
+                throw *(new ldapException("No entry retrieved from server"));
+            
+            if( index >= this->requestedNum )
+                throw *(new ldapException("Attribute index is out of query attribute list"));
+            
+            if(this->viewEntry != this->entry)
+                this->_decodeView();
+            
+            if( this->viewIndex[index] == -1 )
+            {
+                *values = NULL;
+                return 0;
+            }
+            
+            return this->_viewValues(this->viewIndex[index], values);
+        }
+        
+        /*
+         * Get number of attributes of current object. Used with getAttributeViewNth() to read all attributes.
+         * @return unsigned int : Number of attributes
+         */
+        unsigned int getAttributeViewCount()
+        {
+            if(this->entry == NULL)
+                throw *(new ldapException("No entry retrieved from server"));
+            
+            if(this->viewEntry != this->entry)
+                this->_decodeView();
+            
+            return this->view.size();
+        }
+        
+        /*
+         * Get n-th attribute of current object in the order returned by server, without copying it.
+         * Name and values are valid until next fetch(), not null terminated and must not be freed.
+         * @return int : Number of values
+         * @param @n            unsigned int : Position of attribute, less than getAttributeViewCount(). Example: 0
+         * @param @name         berval* : Set to attribute name
+         * @param @values       berval** : Set to array of values
+         */
+        int getAttributeViewNth(unsigned int n, struct berval* name, struct berval** values)
+        {
+            if( n >= this->getAttributeViewCount() )
+                throw *(new ldapException("Attribute position is out of object"));
+            
+            *name = this->view[n].name;
+            return this->_viewValues(n, values);
+        }
+        
+        /*
+         * Get dn of current object without copying it. Valid until next fetch() and not null terminated.
+         * @return berval : Dn of the object
+         */
+        struct berval getDnView()
+        {
+            if(this->entry == NULL)
+                throw *(new ldapException("No entry retrieved from server"));
+            
+            if(this->viewEntry != this->entry)
+                this->_decodeView();
+            
+            return this->viewDn;
+        }
+        
+        /*
+         * Get dn of current object.
+         * @return char* : Dn of the object. Must be freed with clearDn()
+         */
+        char* getDn()
+        {
+            if(this->entry == NULL)
+                throw *(new ldapException("No entry retrieved from server"));
+            
+            return ldap_get_dn(this->connection, this->entry);
+        }
+        
+        /*
+         * Clear dn result from memory
+         * @param @dn       char* : Dn returned by getDn()
+         */
+        static void clearDn(char* dn)
+        {
+            if(dn != NULL)
+                ldap_memfree(dn);
+        }
+        
         /*
          * Clear attribute value result from memory
          * @param @ptr      berval** : Pointer array to berval* 
          */
         static void clearBerval(berval** ptr)
         {
+            //values and array are allocated by ldap library
             if(ptr != NULL)
+                ldap_value_free_len(ptr);
+        }
+        
+    protected:
+        //reads following attribute ranges of current object on the connection
+        friend class ldapRangeIterator;
+        
+        //free results of previous query and set parameters of new query
+        void _prepareQuery(const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            //check requested attributes number
+            if( attrNum > _DEFAULT_MAX_NUMBER_OF_ATTRIBUTES)
+                throw *(new ldapException("Too many attributes requested."));
+            
+            //if exist, delete old result and pages of previous query
+            this->_clearResult();
+            
+            //free parameters of previous query at once
+            this->queryArena.reset();
+            
+            //set search filter and base
+            this->searchFilter = this->queryArena.copy(searchFilter);
+            this->searchBase = this->queryArena.copy(searchBase);
+
+            if( attrNum > 0 )
             {
-                for(int i=0; ptr[i] != NULL; i++)
-                    ber_bvfree(ptr[i]);
-                delete [] ptr;
+                //memory for requested attribute names. +1 for NULL element
+                this->requestedAttributes = (char**)this->queryArena.allocate(sizeof(char*) * (attrNum+1));
+                
+                //set all attribute name in object
+                for(unsigned int i=0; i<attrNum; i++)
+                    this->requestedAttributes[i] = this->queryArena.copy(attributeNames[i]);
+                
+                //attribute list must end with NULL, so set last element to NULL
+                this->requestedAttributes[attrNum] = NULL;
             }
+            else
+                this->requestedAttributes = NULL;
+            
+            this->requestedNum = attrNum;
+            this->viewIndex.assign(attrNum, -1);
+            
+            //adaptive paging starts again from configured size
+            this->currentPageSize = this->pageSize;
+            this->isPageGrowing = true;
+            this->lastPageThroughput = 0;
+        }
+        
+        //attribute of current object decoded in place
+        struct ldapAttributeView
+        {
+            //attribute name, not null terminated
+            struct berval name;
+            //position of first value in viewValues
+            size_t offset;
+            int count;
+        };
+        
+        //decode all attributes of current object once into flat value table. Names and values point into the message
+        void _decodeView()
+        {
+            int ret = LDAP_SUCCESS;
+            BerElement* ber = NULL;
+            ber_tag_t tag;
+            ber_len_t len;
+            char* last;
+            struct berval value;
+            ldapAttributeView attr;
+            unsigned int guess = 0;
+            _LDAP_STAT_START(start);
+            
+            this->_clearView();
+            
+            //also limits ber to attribute list of the object
+            ret = ldap_get_dn_ber(this->connection, this->entry, &ber, &this->viewDn);
+            if( ret != LDAP_SUCCESS)
+            {
+                if( ber != NULL )
+                    ber_free(ber, 0);
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            }
+            
+            //each attribute is a sequence of name and set of values
+            while( ber_peek_tag(ber, &len) != LBER_DEFAULT )
+            {
+                if( ber_scanf(ber, "{m", &attr.name) == LBER_ERROR )
+                {
+                    ret = LDAP_DECODING_ERROR;
+                    break;
+                }
+                
+                attr.offset = this->viewValues.size();
+                attr.count = 0;
+                
+                for( tag = ber_first_element(ber, &len, &last); tag != LBER_DEFAULT; tag = ber_next_element(ber, &len, last) )
+                {
+                    if( ber_scanf(ber, "m", &value) == LBER_ERROR )
+                    {
+                        ret = LDAP_DECODING_ERROR;
+                        break;
+                    }
+                    this->viewValues.push_back(value);
+                    attr.count++;
+                }
+                
+                if( ret != LDAP_SUCCESS || ber_scanf(ber, "}") == LBER_ERROR )
+                {
+                    ret = LDAP_DECODING_ERROR;
+                    break;
+                }
+                
+                //values of each attribute end with an empty element
+                value.bv_len = 0;
+                value.bv_val = NULL;
+                this->viewValues.push_back(value);
+                
+                //map requested attribute index to decoded attribute. Server mostly returns them in requested order, so try next one first
+                if( guess >= this->requestedNum || ! _isAttribute(attr.name, this->requestedAttributes[guess]) )
+                    for( guess = 0; guess < this->requestedNum; guess++ )
+                        if( _isAttribute(attr.name, this->requestedAttributes[guess]) )
+                            break;
+                
+                if( guess < this->requestedNum )
+                    this->viewIndex[guess++] = this->view.size();
+                
+                this->view.push_back(attr);
+            }
+            
+            //ber buffer belongs to the message, only free the element
+            ber_free(ber, 0);
+            
+            if( ret != LDAP_SUCCESS)
+            {
+                this->_clearView();
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            }
+            
+            this->viewEntry = this->entry;
+            
+            _LDAP_STAT_ADD(DECODES, 1);
+            _LDAP_STAT_TIME(DECODE_TIME, start);
+        }
+        
+        //compare decoded attribute name with a name, case insensitive
+        static bool _isAttribute(const struct berval& name, const char* attributeName)
+        {
+            size_t len = strlen(attributeName);
+            
+            return name.bv_len == len && strncasecmp(name.bv_val, attributeName, len) == 0;
+        }
+        
+        //values of decoded attribute
+        int _viewValues(size_t i, struct berval** values)
+        {
+            *values = &this->viewValues[this->view[i].offset];
+            return this->view[i].count;
+        }
+        
+        //clear decoded object. Tables keep their memory for next object
+        void _clearView()
+        {
+            this->view.clear();
+            this->viewValues.clear();
+            this->viewIndex.assign(this->requestedNum, -1);
+            this->viewEntry = NULL;
+            this->viewDn.bv_len = 0;
+            this->viewDn.bv_val = NULL;
         }
         
-    private:
         //set default variables
         void _start()
         {
@@ -323,17 +1138,49 @@ class ldapReader
             this->bindCred.bv_len = 0;
             this->bindCred.bv_val = NULL;
             this->version = 0;
+            this->connectTimeout = -1;
+            this->operationTimeout = -1;
             this->searchBase = NULL;
             this->searchFilter = NULL;
             this->requestedAttributes = NULL;
+            this->requestedNum = 0;
             this->pageSize = _DEFAULT_PAGE_SIZE;
             this->isPagingCritical = _DEFAULT_PAGING_CRITICAL;
             this->pageControl = NULL;
             this->result = NULL;
             this->isMorePageAvailable = false;
             this->entry = NULL;
-            this->controls = NULL;
+            this->sortControl = NULL;
+            this->vlvControl = NULL;
+            this->vlvOffset = 0;
+            this->vlvBefore = 0;
+            this->vlvAfter = 0;
+            this->vlvTarget = 0;
+            this->vlvCount = 0;
+            this->isAttrsOnly = false;
+            this->pageSentAt = 0;
+            this->pageWaitedAt = 0;
+            this->pageReceivedAt = 0;
+            this->pageEntries = 0;
+            this->pageBytes = 0;
+            this->isAdaptivePaging = false;
+            this->pageMemoryBudget = _DEFAULT_PAGE_MEMORY_BUDGET;
+            this->maxPageSize = _DEFAULT_ADAPTIVE_MAX_PAGE_SIZE;
+            this->currentPageSize = _DEFAULT_PAGE_SIZE;
+            this->isPageGrowing = true;
+            this->lastPageThroughput = 0;
             this->resultCount = 0;
+            this->pageCookie.bv_len = 0;
+            this->pageCookie.bv_val = NULL;
+            this->prefetchPages = _DEFAULT_PREFETCH_PAGES;
+            this->pendingMsgId = -1;
+            this->fetchCounter = 0;
+            this->isStreaming = false;
+            this->scope = _DEFAULT_SCOPE;
+            this->uri = NULL;
+            this->viewEntry = NULL;
+            this->viewDn.bv_len = 0;
+            this->viewDn.bv_val = NULL;
         };
         
         //set uri
@@ -374,9 +1221,44 @@ class ldapReader
             int ret = ldap_initialize(&this->connection,this->uri);
 
             if( ret != LDAP_SUCCESS)
-                throw *(new ldapException(ldap_err2string(ret)));
+                throw *(new ldapException(ldap_err2string(ret), ret));
 
             this->isInitialized = true;
+            
+            if( this->connectTimeout >= 0 || this->operationTimeout >= 0 )
+                this->_setTimeout();
+        };
+        
+        //set timeouts, -1 sets library default
+        void _setTimeout()
+        {
+            struct timeval tv;
+            struct timeval* connect = NULL;
+            struct timeval* operation = NULL;
+            
+            if( this->connectTimeout >= 0 )
+            {
+                tv.tv_sec = this->connectTimeout / 1000;
+                tv.tv_usec = (this->connectTimeout % 1000) * 1000;
+                connect = &tv;
+            }
+            
+            int ret = ldap_set_option(this->connection, LDAP_OPT_NETWORK_TIMEOUT, connect);
+            
+            struct timeval op;
+            if( ret == LDAP_OPT_SUCCESS && this->operationTimeout >= 0 )
+            {
+                op.tv_sec = this->operationTimeout / 1000;
+                op.tv_usec = (this->operationTimeout % 1000) * 1000;
+                operation = &op;
+            }
+            
+            //results are waited without timeout argument, so api timeout of library applies
+            if( ret == LDAP_OPT_SUCCESS )
+                ret = ldap_set_option(this->connection, LDAP_OPT_TIMEOUT, operation);
+            
+            if( ret != LDAP_OPT_SUCCESS )
+                throw *(new ldapException("Can not set timeout", ret));
         };
         
         //set ldap version
@@ -387,16 +1269,22 @@ class ldapReader
             int ret = ldap_set_option(this->connection, LDAP_OPT_PROTOCOL_VERSION,&this->version);
 
             if( ret != LDAP_SUCCESS)
-                throw *(new ldapException(ldap_err2string(ret)));
+                throw *(new ldapException(ldap_err2string(ret), ret));
         };
         
         //bind
         void _bind()
         {
+            _LDAP_STAT_START(start);
             int ret = ldap_sasl_bind_s(this->connection, this->bindUser, NULL, &this->bindCred , NULL, NULL, &this->servcred );
+            _LDAP_STAT_ADD(BINDS, 1);
+            _LDAP_STAT_TIME(BIND_TIME, start);
 
             if( ret != LDAP_SUCCESS)
-                throw *(new ldapException(ldap_err2string(ret)));
+            {
+                _LDAP_STAT_ADD(BIND_ERRORS, 1);
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            }
 
             this->isBinded = true;
         };
@@ -410,28 +1298,87 @@ class ldapReader
                 this->pageControl = NULL;
             }
             
-            int ret = ldap_create_page_control(this->connection, this->pageSize, &this->pageCookie, this->isPagingCritical, &this->pageControl );
+            int ret = ldap_create_page_control(this->connection, this->currentPageSize, &this->pageCookie, this->isPagingCritical, &this->pageControl );
             
             if( ret != 0)
-                throw *(new ldapException(ldap_err2string(ret)));
+                throw *(new ldapException(ldap_err2string(ret), ret));
 
         };
         
+        void _prepareVlvControl()
+        {
+            int ret;
+            LDAPVLVInfo info;
+            
+            if(this->vlvControl != NULL)
+            {
+                ldap_control_free(this->vlvControl);
+                this->vlvControl = NULL;
+            }
+            
+            //target by offset, content count 0 lets server use offset as is
+            info.ldvlv_version = 1;
+            info.ldvlv_before_count = this->vlvBefore;
+            info.ldvlv_after_count = this->vlvAfter;
+            info.ldvlv_offset = this->vlvOffset;
+            info.ldvlv_count = 0;
+            info.ldvlv_attrvalue = NULL;
+            info.ldvlv_context = NULL;
+            info.ldvlv_extradata = NULL;
+            
+            ret = ldap_create_vlv_control(this->connection, &info, &this->vlvControl);
+            if( ret != LDAP_SUCCESS )
+                throw *(new ldapException(ldap_err2string(ret), ret));
+        }
+        
         void _prepareControls()
         {
-            //allocate controls
-            //there is only one control so far, but we cannot allocate 1 item array. make it 2 and left null
-            if( this->controls == NULL)
-                this->controls = new LDAPControl*[2];
+            this->controls.clear();
+            
+            //virtual list view replaces paging, servers do not accept both
+            if( this->vlvOffset > 0 )
+            {
+                if( this->sortControl == NULL )
+                    throw *(new ldapException("Window requires sort"));
+                
+                this->_prepareVlvControl();
+                this->controls.push_back(this->vlvControl);
+            }
+            else
+            {
+                //prepare page control variables
+                this->_preparePageControl();
+                this->controls.push_back(this->pageControl);
+            }
+            
+            if( this->sortControl != NULL )
+                this->controls.push_back(this->sortControl);
             
-            //prepare page control variables
-            this->_preparePageControl();
+            this->controls.insert(this->controls.end(), this->userControls.begin(), this->userControls.end());
             
-            this->controls[0] = this->pageControl;
-            this->controls[1] = NULL;
+            //control list must end with NULL
+            this->controls.push_back(NULL);
         }
         
+        //start query by requesting first page and wait for it
         void _query()
+        {
+            this->_sendPage();
+            
+            //in streaming mode entries are received by fetch()
+            if( this->isStreaming )
+                return;
+            
+            this->_collectPages(true);
+            
+            this->result = this->pageQueue.front();
+            this->pageQueue.pop_front();
+            
+            this->_sendPageIfRoom();
+        }
+        
+        //send request of next page without waiting for response
+        void _sendPage()
         {
             //for return value of ldap functions
             int ret;
@@ -439,22 +1386,152 @@ class ldapReader
             //prepare page control
             this->_prepareControls();
             
+            //start measure of page
+            this->pageSentAt = _now();
+            this->pageWaitedAt = this->pageSentAt;
+            this->pageEntries = 0;
+            this->pageBytes = 0;
+            _LDAP_STAT_RECORD(PAGE_SIZE, this->currentPageSize);
+            
             //do the search
-            ret = ldap_search_ext_s(this->connection, this->searchBase, LDAP_SCOPE_SUBTREE, this->searchFilter, this->requestedAttributes, 0, this->controls, NULL, LDAP_NO_LIMIT, LDAP_NO_LIMIT, &this->result);
-            //ret = ldap_search_ext_s(this->connection, this->searchBase, LDAP_SCOPE_SUBTREE, this->searchFilter, NULL, 0, this->controls, NULL, LDAP_NO_LIMIT, LDAP_NO_LIMIT, &this->result);
+            ret = ldap_search_ext(this->connection, this->searchBase, this->scope, this->searchFilter, this->requestedAttributes, this->isAttrsOnly, &this->controls[0], NULL, NULL, LDAP_NO_LIMIT, &this->pendingMsgId);
             if( ret != LDAP_SUCCESS)
-                throw *(new ldapException(ldap_err2string(ret)));
+            {
+                this->pendingMsgId = -1;
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            }
+        }
+        
+        //send request of next page if there is more page and buffer is not full
+        void _sendPageIfRoom()
+        {
+            if( this->pendingMsgId == -1 && this->isMorePageAvailable && (int)this->pageQueue.size() < this->prefetchPages )
+                this->_sendPage();
+        }
+        
+        //move arrived pages to page queue. If block is true, wait until at least one page arrives
+        void _collectPages(bool block)
+        {
+            int ret;
+            LDAPMessage* page;
+            
+            while( this->pendingMsgId != -1 )
+            {
+                ret = this->_receive(LDAP_MSG_ALL, block, &page);
+                
+                //page is not completely arrived yet
+                if( ret == 0 && ! block )
+                    return;
+                
+                //timeout set with setTimeout() passed, request is abandoned by clearQuery()
+                if( ret == 0 )
+                    throw *(new ldapException(ldap_err2string(LDAP_TIMEOUT), LDAP_TIMEOUT));
+                
+                if( ret == -1 )
+                {
+                    this->pendingMsgId = -1;
+                    ldap_get_option(this->connection, LDAP_OPT_RESULT_CODE, &ret);
+                    throw *(new ldapException(ldap_err2string(ret), ret));
+                }
+                
+                this->pendingMsgId = -1;
+                
+                //read paging cookie of the page, then put it into queue
+                try
+                {
+                    this->_parsePage(page);
+                }
+                catch(ldapException &)
+                {
+                    ldap_msgfree(page);
+                    throw;
+                }
+                this->pageQueue.push_back(page);
+                
+                if( this->_isMeasuring() )
+                {
+                    for(LDAPMessage* e = ldap_first_entry(this->connection, page); e != NULL; e = ldap_next_entry(this->connection, e))
+                        this->_measureEntry(e);
+                    this->_pageDone();
+                }
+                
+                //pipeline request of following page
+                this->_sendPageIfRoom();
+                
+                block = false;
+            }
+        }
+        
+        //receive message(s) of page request in flight. Arrived messages are taken without waiting first, so the time
+        //of the last wait tells whether the page is received as it arrives or was already waiting in the library
+        int _receive(int all, bool block, LDAPMessage** msg)
+        {
+            int ret;
+            struct timeval noWait;
+            
+            noWait.tv_sec = 0;
+            noWait.tv_usec = 0;
+            
+            ret = ldap_result(this->connection, this->pendingMsgId, all, &noWait, msg);
+            if( ret == 0 && this->_isMeasuring() )
+                this->pageWaitedAt = _now();
+            
+            if( ret == 0 && block )
+            {
+                ret = ldap_result(this->connection, this->pendingMsgId, all, NULL, msg);
+                
+                //message is received as it arrives
+                if( ret > 0 && this->_isMeasuring() )
+                    this->pageWaitedAt = _now();
+            }
             
+            if( ret > 0 && this->_isMeasuring() )
+                this->pageReceivedAt = _now();
+            
+            return ret;
+        }
+        
+        //parse search result of a page and set paging cookie
+        void _parsePage(LDAPMessage* page)
+        {
+            int ret;
             int tmp_err;
-            LDAPControl **returnedControls;
+            LDAPControl **returnedControls = NULL;
+            LDAPControl *pageResponse;
+            LDAPControl *vlvResponse;
+            ber_int_t vlvErr;
             
-            ret = ldap_parse_result(this->connection,this->result,&tmp_err,NULL,NULL,NULL,&returnedControls,false);
+            ret = ldap_parse_result(this->connection,page,&tmp_err,NULL,NULL,NULL,&returnedControls,false);
             if( ret != LDAP_SUCCESS)
-                throw *(new ldapException(ldap_err2string(ret)));
+                throw *(new ldapException(ldap_err2string(ret), ret));
             
-            ret = ldap_parse_pageresponse_control(this->connection, returnedControls[0], &this->resultCount, &this->pageCookie);
-            if( ret != LDAP_SUCCESS)
-                throw *(new ldapException(ldap_err2string(ret)));
+            if( tmp_err != LDAP_SUCCESS)
+            {
+                if (returnedControls != NULL)
+                    ldap_controls_free(returnedControls);
+                throw *(new ldapException(ldap_err2string(tmp_err), tmp_err));
+            }
+            
+            //free cookie of previous page
+            if( this->pageCookie.bv_val != NULL )
+            {
+                ber_memfree(this->pageCookie.bv_val);
+                this->pageCookie.bv_val = NULL;
+                this->pageCookie.bv_len = 0;
+            }
+            
+            pageResponse = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, returnedControls, NULL);
+            if( pageResponse != NULL )
+                ret = ldap_parse_pageresponse_control(this->connection, pageResponse, &this->resultCount, &this->pageCookie);
+            
+            //position and size of sorted list for window query
+            vlvResponse = ldap_control_find(LDAP_CONTROL_VLVRESPONSE, returnedControls, NULL);
+            if( ret == LDAP_SUCCESS && vlvResponse != NULL )
+            {
+                ret = ldap_parse_vlvresponse_control(this->connection, vlvResponse, &this->vlvTarget, &this->vlvCount, NULL, &vlvErr);
+                if( ret == LDAP_SUCCESS )
+                    ret = vlvErr;
+            }
             
             if (returnedControls != NULL)
             {
@@ -462,13 +1539,270 @@ class ldapReader
                 returnedControls = NULL;
             }
             
+            if( ret != LDAP_SUCCESS)
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            
             //check if there is more page
-            if(this->pageCookie.bv_val != NULL && (strlen(this->pageCookie.bv_val) > 0))
+            if(this->pageCookie.bv_val != NULL && this->pageCookie.bv_len > 0)
                 this->isMorePageAvailable = true;
             else
                 this->isMorePageAvailable = false;
         }
         
+        //free consumed page and take next one from queue. Return false if there is no more page
+        bool _nextPage()
+        {
+            ldap_msgfree(this->result);
+            this->result = NULL;
+            this->entry = NULL;
+            
+            //take pages which arrived in the meantime
+            this->_collectPages(false);
+            
+            if( this->pageQueue.empty() )
+            {
+                if( this->pendingMsgId == -1 )
+                {
+                    if( ! this->isMorePageAvailable )
+                        return false;
+                    
+                    this->_sendPage();
+                }
+                
+                this->_collectPages(true);
+            }
+            
+            this->result = this->pageQueue.front();
+            this->pageQueue.pop_front();
+            
+            this->_sendPageIfRoom();
+            
+            return true;
+        }
+        
+        //receive next entry in streaming mode. Return false if there is no more entry
+        bool _fetchStream()
+        {
+            int ret;
+            LDAPMessage* msg;
+            
+            //free entry of previous fetch
+            if( this->result != NULL )
+            {
+                ldap_msgfree(this->result);
+                this->result = NULL;
+                this->entry = NULL;
+            }
+            
+            while( this->pendingMsgId != -1 )
+            {
+                ret = this->_receive(LDAP_MSG_ONE, true, &msg);
+                
+                //timeout set with setTimeout() passed, stop the search so it does not stream into reused connection
+                if( ret == 0 )
+                {
+                    ldap_abandon_ext(this->connection, this->pendingMsgId, NULL, NULL);
+                    this->pendingMsgId = -1;
+                    throw *(new ldapException(ldap_err2string(LDAP_TIMEOUT), LDAP_TIMEOUT));
+                }
+                
+                if( ret == -1 )
+                {
+                    this->pendingMsgId = -1;
+                    ldap_get_option(this->connection, LDAP_OPT_RESULT_CODE, &ret);
+                    throw *(new ldapException(ldap_err2string(ret), ret));
+                }
+                
+                switch( ldap_msgtype(msg) )
+                {
+                    case LDAP_RES_SEARCH_ENTRY:
+                        this->result = msg;
+                        this->entry = msg;
+                        if( this->_isMeasuring() )
+                            this->_measureEntry(msg);
+                        return true;
+                    
+                    //end of page, request next page if there is
+                    case LDAP_RES_SEARCH_RESULT:
+                        this->pendingMsgId = -1;
+                        if( this->_isMeasuring() )
+                            this->_pageDone();
+                        try
+                        {
+                            this->_parsePage(msg);
+                        }
+                        catch(ldapException &)
+                        {
+                            ldap_msgfree(msg);
+                            throw;
+                        }
+                        ldap_msgfree(msg);
+                        
+                        if( this->isMorePageAvailable )
+                            this->_sendPage();
+                        break;
+                    
+                    //references are not followed
+                    default:
+                        ldap_msgfree(msg);
+                        break;
+                }
+            }
+            
+            return false;
+        }
+        
+#ifdef _LDAP_STATS
+        void _statAdd(ldapStats::counter c, uint64_t n)
+        {
+            this->stats.add(c, n);
+            ldapStats::global().add(c, n);
+        }
+        
+        void _statRecord(ldapStats::histogram h, uint64_t value)
+        {
+            this->stats.record(h, value);
+            ldapStats::global().record(h, value);
+        }
+        
+#endif
+        
+        //monotonic time in nanoseconds
+        static uint64_t _now()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        }
+        
+        //check whether received pages are measured, for statistics or adaptive paging. Measuring decodes dn of
+        //each object to get its size, so it is done only when one of them is enabled
+        bool _isMeasuring()
+        {
+#ifdef _LDAP_STATS
+            return true;
+#else
+            return this->isAdaptivePaging;
+#endif
+        }
+        
+        //count received object and its size in protocol message
+        void _measureEntry(LDAPMessage* e)
+        {
+            BerElement* ber = NULL;
+            struct berval dn;
+            ber_len_t bytes = 0;
+            
+            if( ldap_get_dn_ber(this->connection, e, &ber, &dn) == LDAP_SUCCESS )
+            {
+                ber_get_option(ber, LBER_OPT_TOTAL_BYTES, &bytes);
+                ber_free(ber, 0);
+            }
+            
+            this->pageEntries++;
+            this->pageBytes += bytes;
+        }
+        
+        //record page which is completely received and choose size of next page. Round trip is from sending the
+        //request to receiving the final result message, so time spent by the caller before the page is taken is
+        //not counted, and it is 0 if the arrival time is not known
+        void _pageDone()
+        {
+            uint64_t elapsed = this->pageReceivedAt - this->pageSentAt;
+            
+            if( (this->pageReceivedAt - this->pageWaitedAt) * _DEFAULT_PAGE_ARRIVAL_PRECISION > elapsed )
+                elapsed = 0;
+            
+            _LDAP_STAT_ADD(PAGES, 1);
+            _LDAP_STAT_ADD(ENTRIES, this->pageEntries);
+            _LDAP_STAT_ADD(BYTES, this->pageBytes);
+            if( elapsed > 0 )
+            {
+                _LDAP_STAT_RECORD(PAGE_TIME, elapsed);
+            }
+            _LDAP_STAT_RECORD(PAGE_ENTRIES, this->pageEntries);
+            _LDAP_STAT_RECORD(PAGE_BYTES, this->pageBytes);
+            
+            if( this->isAdaptivePaging )
+                this->_adaptPageSize(elapsed);
+        }
+        
+        //choose size of next page from round trip time and bytes of received page. Page size is kept when round
+        //trip is not known, but memory budget still applies
+        void _adaptPageSize(uint64_t elapsed)
+        {
+            //last page of result is short and tells nothing about larger pages, empty page has no entry size
+            if( this->pageEntries == 0 || this->pageEntries < (uint64_t)this->currentPageSize )
+                return;
+            
+            uint64_t nextSize = this->currentPageSize;
+            
+            if( elapsed > 0 )
+            {
+                double throughput = (double)this->pageBytes / elapsed;
+                
+                if( this->isPageGrowing )
+                {
+                    //larger page saturates link better, try larger one. Otherwise stay at current size
+                    if( throughput > this->lastPageThroughput * _DEFAULT_ADAPTIVE_GAIN )
+                        nextSize *= 2;
+                    else
+                        this->isPageGrowing = false;
+                }
+                //server or link got slower, search for new size again
+                else if( throughput * 2 < this->lastPageThroughput )
+                    this->isPageGrowing = true;
+                
+                this->lastPageThroughput = throughput;
+            }
+            
+            //current page, prefetched pages and page in flight must fit in memory budget
+            uint64_t entryBytes = this->pageBytes / this->pageEntries + 1;
+            uint64_t budgetSize = this->pageMemoryBudget / (entryBytes * (this->prefetchPages + 2));
+            if( nextSize > budgetSize )
+                nextSize = budgetSize;
+            
+            if( nextSize > (uint64_t)this->maxPageSize )
+                nextSize = this->maxPageSize;
+            if( nextSize < _DEFAULT_ADAPTIVE_MIN_PAGE_SIZE )
+                nextSize = _DEFAULT_ADAPTIVE_MIN_PAGE_SIZE;
+            
+            this->currentPageSize = (int)nextSize;
+        }
+        
+        //free current result, buffered pages and abandon page request in flight
+        void _clearResult()
+        {
+            this->_clearView();
+            
+            if( this->pendingMsgId != -1 )
+            {
+                ldap_abandon_ext(this->connection, this->pendingMsgId, NULL, NULL);
+                this->pendingMsgId = -1;
+            }
+            
+            while( ! this->pageQueue.empty() )
+            {
+                ldap_msgfree(this->pageQueue.front());
+                this->pageQueue.pop_front();
+            }
+            
+            if( this->result != NULL )
+            {
+                ldap_msgfree(this->result);
+                this->result = NULL;
+            }
+            this->entry = NULL;
+            
+            //new query must start without cookie
+            if( this->pageCookie.bv_val != NULL )
+                ber_memfree(this->pageCookie.bv_val);
+            this->pageCookie.bv_val = NULL;
+            this->pageCookie.bv_len = 0;
+            this->isMorePageAvailable = false;
+            this->fetchCounter = 0;
+        }
+        
         //ldap connection holder
         LDAP * connection;
         
@@ -478,6 +1812,10 @@ class ldapReader
         //ldap version
         unsigned int version;
         
+        //timeouts in milliseconds, -1 for library default
+        int connectTimeout;
+        int operationTimeout;
+        
         //ldap auth user
         char * bindUser;
         
@@ -487,14 +1825,21 @@ class ldapReader
         //server cred
         struct berval *servcred; 
         
+        //memory of query parameters, reset on each query
+        ldapArena queryArena;
+        
         //ldap search base
         char* searchBase;
+        
+        //ldap search scope
+        int scope;
 
         //ldap filter
         char* searchFilter;
         
         //ldap attribute
         char** requestedAttributes;
+        unsigned int requestedNum;
         
         //ldap page size
         int pageSize;
@@ -504,13 +1849,73 @@ class ldapReader
         //ldap page control variable
         LDAPControl* pageControl;
         
-        //ldap general control array
-        LDAPControl** controls;
+        //max number of pages requested ahead
+        int prefetchPages;
+        //message id of page request in flight, -1 if there is none
+        int pendingMsgId;
+        //received but not consumed pages
+        std::deque<LDAPMessage*> pageQueue;
+        //number of fetch() calls, for polling page request in flight
+        unsigned int fetchCounter;
+        
+        //sort control, NULL if results are not sorted
+        LDAPControl* sortControl;
+        //virtual list view control and window, offset 0 if window is not set
+        LDAPControl* vlvControl;
+        int vlvOffset;
+        int vlvBefore;
+        int vlvAfter;
+        //target position and list size returned by server
+        ber_int_t vlvTarget;
+        ber_int_t vlvCount;
+        //request attribute names only
+        int isAttrsOnly;
+        //controls added by user, not owned
+        std::vector<LDAPControl*> userControls;
+        
+        //ldap general control array, ends with NULL
+        std::vector<LDAPControl*> controls;
+        
+#ifdef _LDAP_STATS
+        //statistics of this reader
+        ldapStats stats;
+#endif
+        //send time, objects and bytes of page in flight
+        uint64_t pageSentAt;
+        //last time the page was seen incomplete and time its final message was received
+        uint64_t pageWaitedAt;
+        uint64_t pageReceivedAt;
+        uint64_t pageEntries;
+        uint64_t pageBytes;
+        
+        //page size is chosen by reader from measured pages
+        bool isAdaptivePaging;
+        //max bytes of received pages in adaptive paging
+        size_t pageMemoryBudget;
+        //max page size in adaptive paging
+        int maxPageSize;
+        //size of the last requested page
+        int currentPageSize;
+        //page size is doubled while throughput grows
+        bool isPageGrowing;
+        //bytes per nanosecond of the last full page
+        double lastPageThroughput;
         
         //ldap result holder
         LDAPMessage* result;
         LDAPMessage* entry;
         
+        //decoded attributes of current object
+        std::vector<ldapAttributeView> view;
+        //values of all decoded attributes
+        std::vector<struct berval> viewValues;
+        //position in view for each requested attribute, -1 if object doesn't have it
+        std::vector<int> viewIndex;
+        //object which is decoded in view, NULL if none
+        LDAPMessage* viewEntry;
+        //dn of decoded object
+        struct berval viewDn;
+        
         ber_int_t resultCount;
         
         //is paging critical? T or F
@@ -519,7 +1924,293 @@ class ldapReader
         bool isBinded;
         bool isCredExist;
         bool isMorePageAvailable;
+        bool isStreaming;
+        
+    private:
+        //a copy would free connection, credentials and controls a second time, so it is not allowed
+        ldapReader(const ldapReader&);
+        ldapReader& operator=(const ldapReader&);
+        
+};
+
+/*
+ * Iterator over all values of a multi-valued attribute of current object of ldapReader.
+ * Servers like Active Directory return large attributes in ranges (MaxValRange), as "member;range=0-1499".
+ * When a range is consumed, next one is requested with a base search on the object, so only one range is kept
+ * in memory. Attributes returned without range are iterated as they are.
+ * Values of first range belong to current object, so iteration must start before next fetch() of reader.
+ *
+ *      ldapRangeIterator members(reader, "member");
+ *      while( members.fetch() )
+ *          use(members.getValue());
+ */
+class ldapRangeIterator
+{
+    public:
+        /*
+         * Start iteration on current object of reader
+         * @param @reader           ldapReader& : Reader positioned on an object with fetch()
+         * @param @attributeName    char* : Attribute name without options. Example: "member"
+         */
+        ldapRangeIterator(ldapReader& reader, const char* attributeName) : reader(reader)
+        {
+            if( reader.entry == NULL )
+                throw *(new ldapException("No entry retrieved from server"));
+            
+            this->name.assign(attributeName, attributeName + strlen(attributeName) + 1);
+            this->dn = NULL;
+            this->message = NULL;
+            this->position = 0;
+            this->fetched = 0;
+            this->nextLow = -1;
+            this->isRanged = false;
+            this->value.bv_len = 0;
+            this->value.bv_val = NULL;
+            
+            this->_decode(reader.entry, true);
+            
+            //following ranges are searched with dn, object of reader may change meanwhile
+            if( this->nextLow != -1 )
+            {
+                this->dn = ldap_get_dn(reader.connection, reader.entry);
+                if( this->dn == NULL )
+                    throw *(new ldapException("Can not get dn of object"));
+            }
+        };
+        
+        virtual ~ldapRangeIterator()
+        {
+            if( this->message != NULL )
+                ldap_msgfree(this->message);
+            ldapReader::clearDn(this->dn);
+        };
+        
+        /*
+         * Move to next value. Next range is requested from server when current one is consumed.
+         * @return bool : false if there is no more value
+         */
+        bool fetch()
+        {
+            while( this->position >= this->values.size() )
+            {
+                if( this->nextLow == -1 )
+                    return false;
+                
+                this->_requestRange();
+            }
+            
+            this->value = this->values[this->position++];
+            this->fetched++;
+            return true;
+        };
+        
+        /*
+         * Get current value without copying it. Valid until next fetch(), not null terminated and must not be freed.
+         * @return berval : Current value
+         */
+        struct berval getValue()
+        {
+            return this->value;
+        };
+        
+        /*
+         * Get number of values fetched so far
+         */
+        unsigned long getFetchedCount()
+        {
+            return this->fetched;
+        };
+        
+        /*
+         * Check whether server returned the attribute in ranges
+         */
+        bool isRangedAttribute()
+        {
+            return this->isRanged;
+        };
+
+    private:
+        //search the object for values starting from nextLow
+        void _requestRange()
+        {
+            std::vector<char> rangeName(this->name.size() + 32);
+            char* attrs[2];
+            LDAPMessage* res = NULL;
+            long low = this->nextLow;
+            
+            snprintf(&rangeName[0], rangeName.size(), "%s;range=%ld-*", &this->name[0], low);
+            attrs[0] = &rangeName[0];
+            attrs[1] = NULL;
+            
+            //values of previous range are consumed
+            if( this->message != NULL )
+            {
+                ldap_msgfree(this->message);
+                this->message = NULL;
+            }
+            this->values.clear();
+            this->position = 0;
+            this->nextLow = -1;
+            
+            int ret = ldap_search_ext_s(this->reader.connection, this->dn, LDAP_SCOPE_BASE, "(objectClass=*)", attrs, 0, NULL, NULL, NULL, 1, &res);
+            if( ret != LDAP_SUCCESS )
+            {
+                if( res != NULL )
+                    ldap_msgfree(res);
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            }
+            this->message = res;
+            
+            LDAPMessage* e = ldap_first_entry(this->reader.connection, res);
+            if( e == NULL )
+                throw *(new ldapException("Object of attribute range is not found", LDAP_NO_SUCH_OBJECT));
+            
+            //only ranged values are taken, attribute without range would repeat first values
+            this->_decode(e, false);
+            
+            //each range must move forward, otherwise iteration would not end
+            if( this->nextLow != -1 && this->nextLow <= low )
+                throw *(new ldapException("Server returned invalid attribute range", LDAP_DECODING_ERROR));
+        }
+        
+        //take values of the attribute from object. Values point into the message
+        void _decode(LDAPMessage* e, bool withoutRange)
+        {
+            BerElement* ber = NULL;
+            struct berval entryDn;
+            struct berval attrName;
+            struct berval v;
+            ber_tag_t tag;
+            ber_len_t len;
+            char* last;
+            long high;
+            
+            int ret = ldap_get_dn_ber(this->reader.connection, e, &ber, &entryDn);
+            if( ret != LDAP_SUCCESS )
+            {
+                if( ber != NULL )
+                    ber_free(ber, 0);
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            }
+            
+            while( ber_peek_tag(ber, &len) != LBER_DEFAULT )
+            {
+                if( ber_scanf(ber, "{m", &attrName) == LBER_ERROR )
+                {
+                    ret = LDAP_DECODING_ERROR;
+                    break;
+                }
+                
+                int match = this->_matchName(attrName, &high);
+                bool take = match == _RANGE_MATCH_RANGED || (match == _RANGE_MATCH_PLAIN && withoutRange && ! this->isRanged);
+                
+                //ranged attribute replaces values of attribute without range, which is empty on Active Directory
+                if( match == _RANGE_MATCH_RANGED )
+                {
+                    this->values.clear();
+                    this->isRanged = true;
+                    this->nextLow = high;
+                }
+                
+                for( tag = ber_first_element(ber, &len, &last); tag != LBER_DEFAULT; tag = ber_next_element(ber, &len, last) )
+                {
+                    if( ber_scanf(ber, "m", &v) == LBER_ERROR )
+                    {
+                        ret = LDAP_DECODING_ERROR;
+                        break;
+                    }
+                    if( take )
+                        this->values.push_back(v);
+                }
+                
+                if( ret != LDAP_SUCCESS || ber_scanf(ber, "}") == LBER_ERROR )
+                {
+                    ret = LDAP_DECODING_ERROR;
+                    break;
+                }
+            }
+            
+            //ber buffer belongs to the message, only free the element
+            ber_free(ber, 0);
+            
+            if( ret != LDAP_SUCCESS )
+            {
+                this->values.clear();
+                this->nextLow = -1;
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            }
+        }
+        
+        enum { _RANGE_MATCH_NONE, _RANGE_MATCH_PLAIN, _RANGE_MATCH_RANGED };
+        
+        /*
+         * Compare returned attribute name with iterated attribute. Options other than range are ignored.
+         * For "name;range=low-high" next is set to high+1, or -1 if high is "*" (last range)
+         */
+        int _matchName(const struct berval& attrName, long* next)
+        {
+            size_t len = this->name.size() - 1;
+            
+            if( attrName.bv_len < len || strncasecmp(attrName.bv_val, &this->name[0], len) != 0 )
+                return _RANGE_MATCH_NONE;
+            if( attrName.bv_len == len )
+                return _RANGE_MATCH_PLAIN;
+            if( attrName.bv_val[len] != ';' )
+                return _RANGE_MATCH_NONE;
+            
+            //options are separated with ';'
+            const char* p = attrName.bv_val + len;
+            const char* end = attrName.bv_val + attrName.bv_len;
+            while( p < end )
+            {
+                p++;
+                if( end - p > 6 && strncasecmp(p, "range=", 6) == 0 )
+                {
+                    p += 6;
+                    
+                    //low bound
+                    while( p < end && *p >= '0' && *p <= '9' )
+                        p++;
+                    if( p == end || *p != '-' || ++p == end )
+                        break;
+                    
+                    if( *p == '*' )
+                    {
+                        *next = -1;
+                        return _RANGE_MATCH_RANGED;
+                    }
+                    
+                    long high = 0;
+                    while( p < end && *p >= '0' && *p <= '9' )
+                        high = high * 10 + (*p++ - '0');
+                    *next = high + 1;
+                    return _RANGE_MATCH_RANGED;
+                }
+                
+                while( p < end && *p != ';' )
+                    p++;
+            }
+            
+            return _RANGE_MATCH_PLAIN;
+        }
         
+        ldapReader& reader;
+        //iterated attribute name, null terminated
+        std::vector<char> name;
+        //dn of object, for range requests
+        char* dn;
+        //result of last range request, values point into it
+        LDAPMessage* message;
+        //values of current range
+        std::vector<struct berval> values;
+        //position of next value in current range
+        size_t position;
+        //current value
+        struct berval value;
+        unsigned long fetched;
+        //low bound of next range, -1 if there is no more range
+        long nextLow;
+        bool isRanged;
 };
 
 #endif	/* LDAPREADER_H */
\ No newline at end of file
@@ -0,0 +1,350 @@
+/*
+ * File         : ldapReaderPool.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Thread safe pool of initialized and binded ldapReader objects.
+ * Compile Opt  : -lldap -llber -pthread -std=c++11
+ *
+ * Dependency   :
+ *                  ldapReader.h
+ */
+
+#ifndef LDAPREADERPOOL_H
+#define	LDAPREADERPOOL_H
+
+#include "ldapReader.h"
+
+//for connection parameters and idle list
+#include <string>
+#include <vector>
+//for thread safety
+#include <mutex>
+#include <condition_variable>
+//for idle time
+#include <chrono>
+//for run()
+#include <functional>
+
+//default number of connections created on pool creation
+#define _DEFAULT_POOL_MIN_SIZE 2
+//default max number of connections
+#define _DEFAULT_POOL_MAX_SIZE 16
+//connections idle more than this many seconds are checked before checkout
+#define _DEFAULT_POOL_IDLE_CHECK 30
+//timeout of connection check in seconds
+#define _DEFAULT_POOL_CHECK_TIMEOUT 5
+
+/*
+ * Pool of binded readers. Readers are taken with acquire() and given back with release().
+ */
+class ldapReaderPool
+{
+    public:
+        /*
+         * Define pool and create min size connections. Min size is only the initial size: connections which are
+         * dropped later are not replaced until acquire() needs them, so a server which is down is not connected in background.
+         * @param @serverUri    char* : Server connection uri. Example: "ldap://example.org:389"
+         * @param @bindUser     char* : Full dn of bind user. Example: "cn=user1,ou=Accounts,dc=example,dc=org"
+         * @param @bindPass     char* : Password of bind user. Example: "Passw0rd"
+         * @param @minSize      int : Number of connections created at once. Example: 2
+         * @param @maxSize      int : Max number of connections. acquire() waits when all are in use. Example: 16
+         */
+        ldapReaderPool(const char* serverUri, const char* bindUser, const char* bindPass, int minSize = _DEFAULT_POOL_MIN_SIZE, int maxSize = _DEFAULT_POOL_MAX_SIZE)
+        : uri(serverUri), bindUser(bindUser), bindPass(bindPass)
+        {
+            if( minSize < 0 || maxSize < 1 || minSize > maxSize )
+                throw *(new ldapException("Invalid pool size"));
+            
+            this->maxSize = maxSize;
+            this->idleCheck = _DEFAULT_POOL_IDLE_CHECK;
+            this->connectTimeout = -1;
+            this->operationTimeout = -1;
+            this->size = 0;
+            
+            //create initial connections
+            try
+            {
+                for(int i=0; i<minSize; i++)
+                {
+                    ldapIdleReader idle;
+                    idle.reader = this->_create();
+                    idle.since = std::chrono::steady_clock::now();
+                    this->idle.push_back(idle);
+                    this->size++;
+                }
+            }
+            catch(ldapException &)
+            {
+                for(size_t i=0; i<this->idle.size(); i++)
+                    delete this->idle[i].reader;
+                throw;
+            }
+        };
+        
+        /*
+         * Close all idle connections. Readers must be released before.
+         */
+        virtual ~ldapReaderPool()
+        {
+            for(size_t i=0; i<this->idle.size(); i++)
+                delete this->idle[i].reader;
+        };
+        
+        /*
+         * Set idle time after which connection is checked before checkout. Default is 30
+         * @param @seconds      int : Idle seconds. 0 checks on every checkout, negative disables check. Example: 60
+         */
+        void setIdleCheck(int seconds)
+        {
+            this->idleCheck = seconds;
+        };
+        
+        /*
+         * Set timeouts of connections, see ldapReader::setTimeout(). Applies to idle and new connections,
+         * readers in use get it when released.
+         * @param @connectMs    int : Timeout of connecting in milliseconds, -1 for default. Example: 1000
+         * @param @operationMs  int : Timeout of waiting each result in milliseconds, -1 for default. Example: 5000
+         */
+        void setTimeout(int connectMs, int operationMs)
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            
+            this->connectTimeout = connectMs;
+            this->operationTimeout = operationMs;
+            
+            for(size_t i=0; i<this->idle.size(); i++)
+                this->idle[i].reader->setTimeout(connectMs, operationMs);
+        };
+        
+        /*
+         * Take a binded reader from pool. Create new one if none is idle and max size is not reached,
+         * otherwise wait until a reader is released.
+         * @return ldapReader* : Reader. Must be given back with release()
+         */
+        ldapReader* acquire()
+        {
+            std::unique_lock<std::mutex> lock(this->mtx);
+            
+            this->cond.wait(lock, [this]{ return ! this->idle.empty() || this->size < this->maxSize; });
+            
+            //no idle reader, create new one outside of lock
+            if( this->idle.empty() )
+            {
+                this->size++;
+                lock.unlock();
+                
+                try
+                {
+                    return this->_create();
+                }
+                catch(ldapException &)
+                {
+                    this->_forget();
+                    throw;
+                }
+            }
+            
+            //take the most recently used reader
+            ldapIdleReader taken = this->idle.back();
+            this->idle.pop_back();
+            lock.unlock();
+            
+            //check connection if it waited long
+            if( this->idleCheck >= 0 && std::chrono::steady_clock::now() - taken.since >= std::chrono::seconds(this->idleCheck) && ! taken.reader->isAlive(_DEFAULT_POOL_CHECK_TIMEOUT) )
+            {
+                try
+                {
+                    taken.reader->reconnect();
+                }
+                catch(ldapException &)
+                {
+                    delete taken.reader;
+                    this->_forget();
+                    throw;
+                }
+            }
+            
+            return taken.reader;
+        };
+        
+        /*
+         * Give reader back to pool. Results of its query are freed and options are set to defaults.
+         * Reader rebinded as another account is binded with pool's account again, or dropped if it can not.
+         * @param @reader       ldapReader* : Reader taken with acquire()
+         * @param @isBroken     bool : Connection is lost, reconnect before returning it to pool. Example: false
+         */
+        void release(ldapReader* reader, bool isBroken = false)
+        {
+            try
+            {
+                if( isBroken )
+                    reader->reconnect();
+                else
+                    reader->clearQuery();
+                
+                this->_resetOptions(reader);
+            }
+            catch(ldapException &)
+            {
+                //drop reader which can not connect, acquire() creates new one
+                delete reader;
+                this->_forget();
+                return;
+            }
+            
+            ldapIdleReader idle;
+            idle.reader = reader;
+            idle.since = std::chrono::steady_clock::now();
+            
+            std::lock_guard<std::mutex> lock(this->mtx);
+            this->idle.push_back(idle);
+            this->cond.notify_one();
+        };
+        
+        /*
+         * Drop reader whose connection is lost without reconnecting now. Next acquire() creates a new connection.
+         * @param @reader       ldapReader* : Reader taken with acquire()
+         */
+        void discard(ldapReader* reader)
+        {
+            delete reader;
+            this->_forget();
+        };
+        
+        /*
+         * Run function with a reader from pool. If connection is lost (LDAP_SERVER_DOWN),
+         * reconnect and run it once more. Reader is given back to pool whatever the job throws.
+         * @param @job      function : Job using the reader. Example: [](ldapReader& r){ r.query(...); ... }
+         */
+        void run(std::function<void(ldapReader&)> job)
+        {
+            ldapReader* reader = this->acquire();
+            //connection is lost, reconnect on release
+            bool isBroken = false;
+            
+            //errors of retry in inner handler are caught by outer handlers
+            try
+            {
+                try
+                {
+                    job(*reader);
+                }
+                catch(ldapException &e)
+                {
+                    if( e.getCode() != LDAP_SERVER_DOWN )
+                        throw;
+                    
+                    isBroken = true;
+                    reader->reconnect();
+                    isBroken = false;
+                    job(*reader);
+                }
+            }
+            catch(ldapException &e)
+            {
+                this->release(reader, isBroken || e.getCode() == LDAP_SERVER_DOWN);
+                throw;
+            }
+            catch(...)
+            {
+                this->release(reader, isBroken);
+                throw;
+            }
+            
+            this->release(reader);
+        };
+        
+        /*
+         * Get number of connections, idle or in use
+         */
+        int getSize()
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            return this->size;
+        };
+        
+        /*
+         * Get number of idle connections
+         */
+        int getIdleSize()
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            return this->idle.size();
+        };
+
+    private:
+        //reader waiting in pool
+        struct ldapIdleReader
+        {
+            ldapReader* reader;
+            std::chrono::steady_clock::time_point since;
+        };
+        
+        //create binded reader, timeouts are set before connecting
+        ldapReader* _create()
+        {
+            ldapReader* reader = new ldapReader(this->uri.c_str());
+            
+            try
+            {
+                reader->setTimeout(this->connectTimeout, this->operationTimeout);
+                reader->bind(this->bindUser.c_str(), this->bindPass.c_str());
+            }
+            catch(ldapException &)
+            {
+                delete reader;
+                throw;
+            }
+            
+            return reader;
+        };
+        
+        //decrease size after a reader is dropped
+        void _forget()
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            this->size--;
+            this->cond.notify_one();
+        };
+        
+        //set options and bind account changed by previous user to defaults
+        void _resetOptions(ldapReader* reader)
+        {
+            //job rebinded as another account, next user must get pool's account
+            const char* user = reader->getBindUser();
+            if( user == NULL || this->bindUser != user )
+                reader->bind(this->bindUser.c_str(), this->bindPass.c_str(), true);
+            
+            reader->setPageSize(_DEFAULT_PAGE_SIZE);
+            reader->setAdaptivePaging(false);
+            reader->setPrefetch(_DEFAULT_PREFETCH_PAGES);
+            reader->setStreaming(false);
+            reader->setScope(_DEFAULT_SCOPE);
+            reader->setSort(NULL);
+            reader->clearWindow();
+            reader->setAttrsOnly(false);
+            reader->clearControls();
+            reader->setTimeout(this->connectTimeout, this->operationTimeout);
+        };
+        
+        //connection parameters
+        std::string uri;
+        std::string bindUser;
+        std::string bindPass;
+        
+        //pool limits
+        int maxSize;
+        int idleCheck;
+        //timeouts of connections in milliseconds
+        int connectTimeout;
+        int operationTimeout;
+        
+        //number of connections, idle or in use
+        int size;
+        //idle readers, most recently used is the last
+        std::vector<ldapIdleReader> idle;
+        
+        std::mutex mtx;
+        std::condition_variable cond;
+};
+
+#endif	/* LDAPREADERPOOL_H */
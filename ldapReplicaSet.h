@@ -0,0 +1,700 @@
+/*
+ * File         : ldapReplicaSet.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Reads spread over replicas of a directory. Each query goes to the least loaded or fastest
+ *                replica, fails over to next one when a replica is down or too slow, and point lookups can be
+ *                hedged to a second replica after p95 latency of the first.
+ * Compile Opt  : -lldap -llber -pthread -std=c++11
+ *
+ * Dependency   :
+ *                  ldapReader.h, ldapReaderPool.h, ldapStats.h
+ */
+
+#ifndef LDAPREPLICASET_H
+#define	LDAPREPLICASET_H
+
+#include "ldapReader.h"
+#include "ldapReaderPool.h"
+#include "ldapStats.h"
+
+//for replica list and order
+#include <string>
+#include <vector>
+#include <algorithm>
+//for counters of replicas
+#include <atomic>
+//for probe thread and hedged requests
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <exception>
+
+//default max number of connections to each replica
+#define _DEFAULT_REPLICA_CONNECTIONS 8
+//default milliseconds after which a failed replica is tried again, unless a probe finds it alive before
+#define _DEFAULT_REPLICA_RETRY_AFTER 5000
+//default weight of new sample in latency average
+#define _DEFAULT_REPLICA_EWMA_WEIGHT 0.2
+//default min delay of hedged request in milliseconds
+#define _DEFAULT_REPLICA_HEDGE_MIN 2
+//number of latency samples of a replica used for its p95, then samples are collected again
+#define _DEFAULT_REPLICA_LATENCY_WINDOW 1000
+//timeout of probe in seconds
+#define _DEFAULT_REPLICA_PROBE_TIMEOUT 1
+
+/*
+ * Replica set class. Each replica has its own ldapReaderPool, connections are created when needed, so
+ * replicas which are down on creation are used when they come back.
+ *
+ *      std::vector<std::string> uris = { "ldap://ldap1.example.org", "ldap://ldap2.example.org" };
+ *      ldapReplicaSet replicas(uris, bindUser, bindPass);
+ *      replicas.setTimeout(1000, 5000);
+ *      replicas.startProbing(1000);
+ *
+ *      replicas.run([&](ldapReader& reader){ users.clear(); reader.query(...); while( reader.fetch() ) ... });
+ *
+ *      std::string mail = replicas.runHedged<std::string>([filter](ldapReader& reader){ ... return mail; });
+ *
+ * A replica fails when query or bind ends with LDAP_SERVER_DOWN, LDAP_CONNECT_ERROR, LDAP_TIMEOUT,
+ * LDAP_UNAVAILABLE or LDAP_BUSY. It is skipped until retry time passes or a probe finds it alive, and the job
+ * runs again on next replica, so jobs should clear their output at start. Other errors are thrown at once.
+ * Latency of replicas is measured by probes and runHedged() lookups only, since run() jobs may scan many pages,
+ * so start probing with LOWEST_LATENCY. Slower job of runHedged() may run after it returns, so its job must capture
+ * by value and must not refer to caller's locals.
+ */
+class ldapReplicaSet
+{
+    public:
+        //how replica of each request is chosen
+        enum policy
+        {
+            //fewest requests in progress, then lowest latency
+            LEAST_OUTSTANDING,
+            //lowest average latency multiplied by requests in progress
+            LOWEST_LATENCY
+        };
+        
+        /*
+         * Define replica set. No connection is made until first request.
+         * @param @serverUris   vector<string> : Uris of replicas. Example: {"ldap://ldap1:389", "ldap://ldap2:389"}
+         * @param @bindUser     char* : Full dn of bind user. Example: "cn=user1,ou=Accounts,dc=example,dc=org"
+         * @param @bindPass     char* : Password of bind user. Example: "Passw0rd"
+         * @param @connections  int : Max number of connections to each replica. Example: 8
+         */
+        ldapReplicaSet(const std::vector<std::string>& serverUris, const char* bindUser, const char* bindPass, int connections = _DEFAULT_REPLICA_CONNECTIONS)
+        : bindUser(bindUser), bindPass(bindPass)
+        {
+            if( serverUris.empty() )
+                throw *(new ldapException("No replica uri"));
+            
+            this->routing = LEAST_OUTSTANDING;
+            this->retryAfter = _DEFAULT_REPLICA_RETRY_AFTER;
+            this->hedgeMin = _DEFAULT_REPLICA_HEDGE_MIN;
+            this->connectTimeout = -1;
+            this->isProbing = false;
+            this->inFlight = 0;
+            this->nextStart.store(0, std::memory_order_relaxed);
+            this->hedgeCount.store(0, std::memory_order_relaxed);
+            this->hedgeWins.store(0, std::memory_order_relaxed);
+            this->failovers.store(0, std::memory_order_relaxed);
+            
+            for(size_t i=0; i<serverUris.size(); i++)
+                this->replicas.push_back(new ldapReplica(serverUris[i], bindUser, bindPass, connections));
+        };
+        
+        /*
+         * Stop probing and wait for hedged requests still running, then close connections
+         */
+        virtual ~ldapReplicaSet()
+        {
+            this->stopProbing();
+            
+            std::unique_lock<std::mutex> lock(this->mtx);
+            this->cond.wait(lock, [this]{ return this->inFlight == 0; });
+            lock.unlock();
+            
+            for(size_t i=0; i<this->replicas.size(); i++)
+                delete this->replicas[i];
+        };
+        
+        /*
+         * Set how replica of each request is chosen. Default is LEAST_OUTSTANDING
+         * @param @p        policy : Routing policy. Example: ldapReplicaSet::LOWEST_LATENCY
+         */
+        void setPolicy(policy p)
+        {
+            this->routing = p;
+        };
+        
+        /*
+         * Set timeouts of connections to all replicas, see ldapReader::setTimeout(). Failover waits at most
+         * these before trying next replica.
+         * @param @connectMs    int : Timeout of connecting in milliseconds. Example: 1000
+         * @param @operationMs  int : Timeout of waiting each result in milliseconds. Example: 5000
+         */
+        void setTimeout(int connectMs, int operationMs)
+        {
+            std::lock_guard<std::mutex> lock(this->probeMtx);
+            this->connectTimeout = connectMs;
+            
+            for(size_t i=0; i<this->replicas.size(); i++)
+                this->replicas[i]->pool.setTimeout(connectMs, operationMs);
+        };
+        
+        /*
+         * Set time after which a failed replica is tried again. Default is 5000
+         * @param @ms       int : Milliseconds. Example: 10000
+         */
+        void setRetryAfter(int ms)
+        {
+            this->retryAfter = ms;
+        };
+        
+        /*
+         * Set min delay of hedged request. Hedge is sent after p95 latency of first replica, or this delay
+         * if it is longer or latency is not measured yet. Default is 2
+         * @param @ms       int : Milliseconds. Example: 5
+         */
+        void setHedgeMin(int ms)
+        {
+            this->hedgeMin = ms;
+        };
+        
+        /*
+         * Run job with a reader of chosen replica. If replica fails, job runs on next replica until one succeeds.
+         * @param @job      function : Job using the reader. Example: [](ldapReader& r){ r.query(...); ... }
+         */
+        void run(std::function<void(ldapReader&)> job)
+        {
+            std::vector<size_t> order;
+            std::exception_ptr last;
+            
+            this->_order(order);
+            for(size_t i=0; i<order.size(); i++)
+            {
+                try
+                {
+                    this->_runOn(order[i], job, false);
+                    return;
+                }
+                catch(ldapException &e)
+                {
+                    if( ! _isFailure(e.getCode()) )
+                        throw;
+                    last = std::current_exception();
+                    if( i + 1 < order.size() )
+                        this->failovers.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            
+            std::rethrow_exception(last);
+        };
+        
+        /*
+         * Run job on chosen replica, and on second replica too if no result arrives in hedge delay.
+         * First result is returned; the slower job still runs to its end and its result is dropped.
+         * Job is copied into each thread and may run after this returns, so it must capture its state by value,
+         * never by reference to locals of the caller.
+         * Failed replicas are replaced by next ones like run(). Meant for point lookups, each job runs in its own thread.
+         * T must be default constructible and movable.
+         * @param @job      function : Job returning copied result. Example: [filter](ldapReader& r){ ...; return dn; }
+         * @return T : Result of first job which finished
+         */
+        template<typename T>
+        T runHedged(std::function<T(ldapReader&)> job)
+        {
+            std::vector<size_t> order;
+            std::shared_ptr<ldapHedge<T> > state = std::make_shared<ldapHedge<T> >();
+            size_t launched = 0;
+            bool isHedged = false;
+            
+            this->_order(order);
+            std::chrono::steady_clock::time_point hedgeAt = std::chrono::steady_clock::now() + std::chrono::nanoseconds(this->_hedgeDelay(order[0]));
+            
+            std::unique_lock<std::mutex> lock(state->mtx);
+            for(;;)
+            {
+                if( state->isDone )
+                    break;
+                
+                bool isAllFailed = state->failed == launched;
+                if( isAllFailed && ( launched == order.size() || state->isFatal ) )
+                    std::rethrow_exception(state->error);
+                
+                bool isHedgeDue = launched == 1 && ! isHedged && std::chrono::steady_clock::now() >= hedgeAt;
+                if( launched < order.size() && ( isAllFailed || isHedgeDue ) )
+                {
+                    if( isHedgeDue && ! isAllFailed )
+                    {
+                        isHedged = true;
+                        this->hedgeCount.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    else if( launched > 0 )
+                        this->failovers.fetch_add(1, std::memory_order_relaxed);
+                    
+                    this->_launch(state, order[launched], job, isHedgeDue && ! isAllFailed);
+                    launched++;
+                    continue;
+                }
+                
+                if( launched == 1 && ! isHedged && order.size() > 1 )
+                    state->cond.wait_until(lock, hedgeAt);
+                else
+                    state->cond.wait(lock);
+            }
+            
+            if( state->isHedgeWin )
+                this->hedgeWins.fetch_add(1, std::memory_order_relaxed);
+            
+            return state->value;
+        };
+        
+        /*
+         * Check all replicas once with a base search on root DSE. Latency of alive replicas is updated and
+         * failed ones are skipped until they answer a probe or retry time passes. Each replica is probed on its
+         * own connection, so a replica whose pool is busy is probed too.
+         */
+        void probe()
+        {
+            std::lock_guard<std::mutex> lock(this->probeMtx);
+            
+            for(size_t i=0; i<this->replicas.size(); i++)
+            {
+                ldapReplica& replica = *this->replicas[i];
+                bool isAlive = false;
+                uint64_t elapsed = 0;
+                
+                try
+                {
+                    if( replica.probeReader == NULL )
+                        replica.probeReader = this->_connectProbe(replica);
+                    
+                    uint64_t start = ldapStats::now();
+                    isAlive = replica.probeReader->isAlive(_DEFAULT_REPLICA_PROBE_TIMEOUT);
+                    elapsed = ldapStats::now() - start;
+                }
+                catch(ldapException &)
+                {
+                }
+                
+                if( isAlive )
+                {
+                    this->_average(replica, elapsed);
+                    replica.downUntil.store(0, std::memory_order_relaxed);
+                }
+                else
+                {
+                    //connect again on next probe
+                    delete replica.probeReader;
+                    replica.probeReader = NULL;
+                    this->_markDown(replica);
+                }
+            }
+        };
+        
+        /*
+         * Probe replicas periodically in a thread
+         * @param @intervalMs   int : Milliseconds between probes. Example: 1000
+         */
+        void startProbing(int intervalMs)
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            
+            if( this->isProbing )
+                return;
+            
+            this->isProbing = true;
+            this->prober = std::thread(&ldapReplicaSet::_probeLoop, this, intervalMs);
+        };
+        
+        /*
+         * Stop probe thread
+         */
+        void stopProbing()
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mtx);
+                if( ! this->isProbing )
+                    return;
+                this->isProbing = false;
+                this->cond.notify_all();
+            }
+            
+            this->prober.join();
+        };
+        
+        /*
+         * Get number of replicas
+         */
+        size_t getReplicaCount()
+        {
+            return this->replicas.size();
+        };
+        
+        /*
+         * Get uri of replica
+         * @param @i        size_t : Replica position, in order of uris given. Example: 0
+         */
+        const std::string& getUri(size_t i)
+        {
+            return this->replicas.at(i)->uri;
+        };
+        
+        /*
+         * Replica is not failed, or its retry time passed
+         * @param @i        size_t : Replica position. Example: 0
+         */
+        bool isUp(size_t i)
+        {
+            return this->replicas.at(i)->downUntil.load(std::memory_order_relaxed) <= ldapStats::now();
+        };
+        
+        /*
+         * Get average latency of replica in milliseconds, 0 if not measured yet
+         * @param @i        size_t : Replica position. Example: 0
+         */
+        double getLatency(size_t i)
+        {
+            return this->replicas.at(i)->latency.load(std::memory_order_relaxed) / 1e6;
+        };
+        
+        /*
+         * Get number of requests in progress on replica
+         * @param @i        size_t : Replica position. Example: 0
+         */
+        int getOutstanding(size_t i)
+        {
+            return this->replicas.at(i)->outstanding.load(std::memory_order_relaxed);
+        };
+        
+        /*
+         * Get number of hedged requests sent, and how many of them finished first
+         */
+        unsigned long getHedgeCount()
+        {
+            return this->hedgeCount.load(std::memory_order_relaxed);
+        };
+        
+        unsigned long getHedgeWins()
+        {
+            return this->hedgeWins.load(std::memory_order_relaxed);
+        };
+        
+        /*
+         * Get number of jobs run again on another replica after a failure
+         */
+        unsigned long getFailoverCount()
+        {
+            return this->failovers.load(std::memory_order_relaxed);
+        };
+
+    private:
+        struct ldapReplica
+        {
+            ldapReplica(const std::string& uri, const char* bindUser, const char* bindPass, int connections)
+            : pool(uri.c_str(), bindUser, bindPass, 0, connections), uri(uri)
+            {
+                this->outstanding.store(0, std::memory_order_relaxed);
+                this->latency.store(0, std::memory_order_relaxed);
+                this->downUntil.store(0, std::memory_order_relaxed);
+                this->hedgeDelay.store(0, std::memory_order_relaxed);
+                this->samples.store(0, std::memory_order_relaxed);
+                this->probeReader = NULL;
+            };
+            
+            ~ldapReplica()
+            {
+                delete this->probeReader;
+            };
+            
+            ldapReaderPool pool;
+            std::string uri;
+            //requests in progress
+            std::atomic<int> outstanding;
+            //average latency in nanoseconds, 0 until first sample
+            std::atomic<uint64_t> latency;
+            //failed replica is skipped until this time of ldapStats::now()
+            std::atomic<uint64_t> downUntil;
+            //p95 of last window in nanoseconds
+            std::atomic<uint64_t> hedgeDelay;
+            std::atomic<uint64_t> samples;
+            ldapHistogram window;
+            //connection used only by probe(), NULL until first probe or after a failed one
+            ldapReader* probeReader;
+        };
+        
+        //result of hedged request, shared with its jobs
+        template<typename T>
+        struct ldapHedge
+        {
+            ldapHedge() : isDone(false), isFatal(false), isHedgeWin(false), failed(0)
+            {
+            };
+            
+            std::mutex mtx;
+            std::condition_variable cond;
+            bool isDone;
+            bool isFatal;
+            bool isHedgeWin;
+            size_t failed;
+            T value;
+            std::exception_ptr error;
+        };
+        
+        //replica is unreachable or can not serve now
+        static bool _isFailure(int code)
+        {
+            return code == LDAP_SERVER_DOWN || code == LDAP_CONNECT_ERROR || code == LDAP_TIMEOUT || code == LDAP_UNAVAILABLE || code == LDAP_BUSY;
+        };
+        
+        //replicas in order of preference, failed ones last. Equal ones are rotated so load is spread
+        void _order(std::vector<size_t>& order)
+        {
+            std::vector<std::pair<double, size_t> > keys;
+            uint64_t now = ldapStats::now();
+            size_t n = this->replicas.size();
+            size_t start = this->nextStart.fetch_add(1, std::memory_order_relaxed);
+            
+            for(size_t k=0; k<n; k++)
+            {
+                size_t i = (start + k) % n;
+                ldapReplica& replica = *this->replicas[i];
+                double outstanding = replica.outstanding.load(std::memory_order_relaxed);
+                double latency = replica.latency.load(std::memory_order_relaxed);
+                double key;
+                
+                //unmeasured replicas are tried first to measure them
+                if( this->routing == LEAST_OUTSTANDING )
+                    key = outstanding * 1e12 + latency;
+                else
+                    key = latency * (outstanding + 1);
+                
+                if( replica.downUntil.load(std::memory_order_relaxed) > now )
+                    key += 1e300;
+                
+                keys.push_back(std::make_pair(key, i));
+            }
+            
+            std::stable_sort(keys.begin(), keys.end(), [](const std::pair<double, size_t>& a, const std::pair<double, size_t>& b){ return a.first < b.first; });
+            
+            order.clear();
+            for(size_t k=0; k<n; k++)
+                order.push_back(keys[k].second);
+        };
+        
+        //run job on replica and mark replica failed on connection errors. Latency of timed jobs is recorded,
+        //from after checkout so connecting and binding of new connections is not counted
+        void _runOn(size_t r, const std::function<void(ldapReader&)>& job, bool isTimed)
+        {
+            ldapReplica& replica = *this->replicas[r];
+            ldapReader* reader;
+            
+            replica.outstanding.fetch_add(1, std::memory_order_relaxed);
+            
+            try
+            {
+                reader = replica.pool.acquire();
+            }
+            catch(ldapException &e)
+            {
+                replica.outstanding.fetch_sub(1, std::memory_order_relaxed);
+                if( _isFailure(e.getCode()) )
+                    this->_markDown(replica);
+                throw;
+            }
+            
+            uint64_t start = ldapStats::now();
+            try
+            {
+                job(*reader);
+            }
+            catch(ldapException &e)
+            {
+                replica.outstanding.fetch_sub(1, std::memory_order_relaxed);
+                
+                //connection is dropped instead of reconnecting now, next acquire() connects and binds again
+                if( _isFailure(e.getCode()) )
+                {
+                    this->_markDown(replica);
+                    replica.pool.discard(reader);
+                }
+                else
+                    replica.pool.release(reader);
+                throw;
+            }
+            catch(...)
+            {
+                replica.outstanding.fetch_sub(1, std::memory_order_relaxed);
+                replica.pool.release(reader);
+                throw;
+            }
+            
+            replica.outstanding.fetch_sub(1, std::memory_order_relaxed);
+            if( isTimed )
+                this->_record(replica, ldapStats::now() - start);
+            replica.downUntil.store(0, std::memory_order_relaxed);
+            replica.pool.release(reader);
+        };
+        
+        //create binded reader of probes, outside of pool so probes do not wait for busy connections
+        ldapReader* _connectProbe(ldapReplica& replica)
+        {
+            ldapReader* reader = new ldapReader(replica.uri.c_str());
+            int probeMs = _DEFAULT_REPLICA_PROBE_TIMEOUT * 1000;
+            
+            try
+            {
+                reader->setTimeout(this->connectTimeout >= 0 ? this->connectTimeout : probeMs, probeMs);
+                reader->bind(this->bindUser.c_str(), this->bindPass.c_str());
+            }
+            catch(ldapException &)
+            {
+                delete reader;
+                throw;
+            }
+            
+            return reader;
+        };
+        
+        void _markDown(ldapReplica& replica)
+        {
+            replica.downUntil.store(ldapStats::now() + (uint64_t)this->retryAfter * 1000000, std::memory_order_relaxed);
+        };
+        
+        //add latency to average and to window of p95
+        void _record(ldapReplica& replica, uint64_t elapsed)
+        {
+            this->_average(replica, elapsed);
+            replica.window.record(elapsed);
+            
+            if( replica.samples.fetch_add(1, std::memory_order_relaxed) % _DEFAULT_REPLICA_LATENCY_WINDOW == _DEFAULT_REPLICA_LATENCY_WINDOW - 1 )
+            {
+                ldapHistogramSnapshot snap;
+                replica.window.snapshot(snap);
+                replica.window.reset();
+                replica.hedgeDelay.store(snap.percentile(0.95), std::memory_order_relaxed);
+            }
+        };
+        
+        void _average(ldapReplica& replica, uint64_t elapsed)
+        {
+            uint64_t old = replica.latency.load(std::memory_order_relaxed);
+            uint64_t next;
+            
+            do
+            {
+                next = old == 0 ? elapsed : (uint64_t)(old + _DEFAULT_REPLICA_EWMA_WEIGHT * ((double)elapsed - (double)old));
+                if( next == 0 )
+                    next = 1;
+            }
+            while( ! replica.latency.compare_exchange_weak(old, next, std::memory_order_relaxed) );
+        };
+        
+        //p95 of replica, or of samples collected so far before first window ends
+        uint64_t _hedgeDelay(size_t r)
+        {
+            ldapReplica& replica = *this->replicas[r];
+            uint64_t delay = replica.hedgeDelay.load(std::memory_order_relaxed);
+            uint64_t min = (uint64_t)this->hedgeMin * 1000000;
+            
+            if( delay == 0 && replica.samples.load(std::memory_order_relaxed) >= 20 )
+            {
+                ldapHistogramSnapshot snap;
+                replica.window.snapshot(snap);
+                delay = snap.percentile(0.95);
+                replica.hedgeDelay.store(delay, std::memory_order_relaxed);
+            }
+            
+            return delay > min ? delay : min;
+        };
+        
+        //run job of hedged request in a thread
+        template<typename T>
+        void _launch(std::shared_ptr<ldapHedge<T> > state, size_t r, std::function<T(ldapReader&)> job, bool isHedge)
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mtx);
+                this->inFlight++;
+            }
+            
+            std::thread([this, state, r, job, isHedge]()
+            {
+                try
+                {
+                    T value;
+                    this->_runOn(r, [&value, &job](ldapReader& reader){ value = job(reader); }, true);
+                    
+                    std::lock_guard<std::mutex> lock(state->mtx);
+                    if( ! state->isDone )
+                    {
+                        state->value = std::move(value);
+                        state->isDone = true;
+                        state->isHedgeWin = isHedge;
+                    }
+                }
+                catch(ldapException &e)
+                {
+                    std::lock_guard<std::mutex> lock(state->mtx);
+                    state->failed++;
+                    state->isFatal = state->isFatal || ! _isFailure(e.getCode());
+                    state->error = std::current_exception();
+                }
+                catch(...)
+                {
+                    std::lock_guard<std::mutex> lock(state->mtx);
+                    state->failed++;
+                    state->isFatal = true;
+                    state->error = std::current_exception();
+                }
+                state->cond.notify_all();
+                
+                //destructor waits for this
+                std::lock_guard<std::mutex> lock(this->mtx);
+                this->inFlight--;
+                this->cond.notify_all();
+            }).detach();
+        };
+        
+        void _probeLoop(int intervalMs)
+        {
+            std::unique_lock<std::mutex> lock(this->mtx);
+            
+            while( this->isProbing )
+            {
+                lock.unlock();
+                this->probe();
+                lock.lock();
+                
+                this->cond.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]{ return ! this->isProbing; });
+            }
+        };
+        
+        std::vector<ldapReplica*> replicas;
+        std::string bindUser;
+        std::string bindPass;
+        policy routing;
+        int retryAfter;
+        int hedgeMin;
+        //connect timeout of probe connections in milliseconds, -1 if not set
+        int connectTimeout;
+        
+        //start of rotation of equal replicas
+        std::atomic<size_t> nextStart;
+        std::atomic<unsigned long> hedgeCount;
+        std::atomic<unsigned long> hedgeWins;
+        std::atomic<unsigned long> failovers;
+        
+        //probe thread and hedged jobs in progress
+        std::mutex mtx;
+        std::condition_variable cond;
+        std::thread prober;
+        bool isProbing;
+        //probe connections are used by one probe() at a time
+        std::mutex probeMtx;
+        int inFlight;
+};
+
+#endif	/* LDAPREPLICASET_H */
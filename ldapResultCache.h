@@ -0,0 +1,530 @@
+/*
+ * File         : ldapResultCache.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Thread safe in process cache of query results with TTL and size limit.
+ * Compile Opt  : -lldap -llber -pthread -std=c++11
+ *
+ * Dependency   :
+ *                  ldapReader.h
+ */
+
+#ifndef LDAPRESULTCACHE_H
+#define	LDAPRESULTCACHE_H
+
+#include "ldapReader.h"
+
+//for keys and result buffer
+#include <string>
+#include <vector>
+#include <algorithm>
+//for shards
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include <functional>
+//for counters and ttl
+#include <atomic>
+#include <chrono>
+//for tolower
+#include <cctype>
+
+//default max memory of cached results in bytes
+#define _DEFAULT_CACHE_MAX_BYTES (64*1024*1024)
+//default lifetime of cached result in seconds
+#define _DEFAULT_CACHE_TTL 60
+//default number of independently locked parts of cache
+#define _DEFAULT_CACHE_SHARDS 16
+
+/*
+ * Result of a query kept in cache. All names and values are in one buffer.
+ * Values are not null terminated, use bv_len. Object is not changed after creation, so it can be shared between threads.
+ */
+class ldapCachedResult
+{
+    public:
+        /*
+         * Copy all objects of the query made on reader.
+         * @param @reader       ldapReader& : Reader which query() is called
+         */
+        explicit ldapCachedResult(ldapReader& reader)
+        {
+            std::vector<size_t> offsets;
+            struct berval name;
+            struct berval* values;
+            struct berval empty;
+            
+            empty.bv_len = 0;
+            empty.bv_val = NULL;
+            
+            while( reader.fetch() )
+            {
+                ldapCachedObject obj;
+                
+                offsets.push_back(this->_append(reader.getDnView()));
+                obj.attrBegin = this->attributes.size();
+                
+                unsigned int attrNum = reader.getAttributeViewCount();
+                for(unsigned int i=0; i<attrNum; i++)
+                {
+                    int count = reader.getAttributeViewNth(i, &name, &values);
+                    
+                    ldapCachedAttribute attr;
+                    offsets.push_back(this->_append(name));
+                    attr.valueBegin = this->values.size();
+                    attr.count = count;
+                    
+                    for(int j=0; j<count; j++)
+                    {
+                        offsets.push_back(this->_append(values[j]));
+                        this->values.push_back(values[j]);
+                    }
+                    
+                    //values end with an empty element, like ldapReader::getAttributeView()
+                    this->values.push_back(empty);
+                    
+                    this->attributes.push_back(attr);
+                }
+                
+                obj.attrEnd = this->attributes.size();
+                this->objects.push_back(obj);
+            }
+            
+            this->_setPointers(offsets);
+        };
+        
+        /*
+         * Get number of objects
+         */
+        size_t size() const
+        {
+            return this->objects.size();
+        };
+        
+        /*
+         * Get dn of an object
+         * @return berval : Dn, not null terminated
+         * @param @i        size_t : Position of object, less than size(). Example: 0
+         */
+        struct berval getDn(size_t i) const
+        {
+            return this->objects.at(i).dn;
+        };
+        
+        /*
+         * Get attribute values of an object
+         * @return int : Number of values. 0 if object doesn't have the attribute
+         * @param @i                size_t : Position of object, less than size(). Example: 0
+         * @param @attributeName    char* : Atrribute name. Example: "memberOf"
+         * @param @values           berval** : Set to array of values, NULL if object doesn't have the attribute
+         */
+        int getAttribute(size_t i, const char* attributeName, const struct berval** values) const
+        {
+            const ldapCachedObject& obj = this->objects.at(i);
+            size_t len = strlen(attributeName);
+            
+            for(size_t a=obj.attrBegin; a<obj.attrEnd; a++)
+            {
+                const ldapCachedAttribute& attr = this->attributes[a];
+                if( attr.name.bv_len == len && strncasecmp(attr.name.bv_val, attributeName, len) == 0 )
+                {
+                    *values = &this->values[attr.valueBegin];
+                    return attr.count;
+                }
+            }
+            
+            *values = NULL;
+            return 0;
+        };
+        
+        /*
+         * Get approximate memory usage in bytes
+         */
+        size_t getMemorySize() const
+        {
+            return sizeof(*this) + this->buffer.capacity() + this->objects.capacity() * sizeof(ldapCachedObject)
+                + this->attributes.capacity() * sizeof(ldapCachedAttribute) + this->values.capacity() * sizeof(struct berval);
+        };
+
+    private:
+        struct ldapCachedObject
+        {
+            struct berval dn;
+            size_t attrBegin;
+            size_t attrEnd;
+        };
+        
+        struct ldapCachedAttribute
+        {
+            struct berval name;
+            size_t valueBegin;
+            int count;
+        };
+        
+        //copy bytes to buffer, return offset
+        size_t _append(const struct berval& bv)
+        {
+            size_t offset = this->buffer.size();
+            this->buffer.insert(this->buffer.end(), bv.bv_val, bv.bv_val + bv.bv_len);
+            
+            return offset;
+        };
+        
+        //buffer doesn't move anymore, point names and values into it. Offsets are in order of _append() calls
+        void _setPointers(const std::vector<size_t>& offsets)
+        {
+            size_t k = 0;
+            
+            this->buffer.shrink_to_fit();
+            char* base = this->buffer.empty() ? NULL : &this->buffer[0];
+            
+            for(size_t o=0; o<this->objects.size(); o++)
+            {
+                this->objects[o].dn.bv_val = base + offsets[k++];
+                
+                for(size_t a=this->objects[o].attrBegin; a<this->objects[o].attrEnd; a++)
+                {
+                    ldapCachedAttribute& attr = this->attributes[a];
+                    attr.name.bv_val = base + offsets[k++];
+                    
+                    for(int v=0; v<attr.count; v++)
+                        this->values[attr.valueBegin + v].bv_val = base + offsets[k++];
+                }
+            }
+        };
+        
+        //all dn, name and value bytes
+        std::vector<char> buffer;
+        std::vector<ldapCachedObject> objects;
+        std::vector<ldapCachedAttribute> attributes;
+        std::vector<struct berval> values;
+};
+
+/*
+ * Cache of query results keyed on scope, base, filter, attribute list and bind user, so results are not shared
+ * between users with different access rights. Queries of readers with sort, window, attributes only or added
+ * controls are not cached, since their results differ from results of plain queries.
+ * Each shard has own lock and LRU list. Results older than TTL are not returned.
+ */
+class ldapResultCache
+{
+    public:
+        /*
+         * Define cache
+         * @param @maxBytes     size_t : Max memory of cached results. Example: 67108864
+         * @param @ttl          int : Lifetime of result in seconds. Example: 60
+         * @param @shardNum     int : Number of independently locked parts. Example: 16
+         */
+        ldapResultCache(size_t maxBytes = _DEFAULT_CACHE_MAX_BYTES, int ttl = _DEFAULT_CACHE_TTL, int shardNum = _DEFAULT_CACHE_SHARDS)
+        : shards(shardNum < 1 ? 1 : shardNum)
+        {
+            this->ttl = ttl;
+            this->shardBytes = maxBytes / this->shards.size();
+            this->hits = 0;
+            this->misses = 0;
+            this->evictions = 0;
+        };
+        
+        virtual ~ldapResultCache() {};
+        
+        /*
+         * Return cached result of the query, or make the query on reader and cache its result.
+         * @return shared_ptr<const ldapCachedResult> : Result, valid even if it is evicted from cache
+         * @param @reader           ldapReader& : Reader used on cache miss. Its scope and bind user are part of key
+         * @param @searchFilter     char* : Ldap search filter. Example: "(&(objectClass=group)(member=cn=user1,dc=example,dc=org))"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=groups,dc=example,dc=org"
+         * @param @attrNum          unsigned int : Number of attributes in attributeNames
+         * @param @attributeNames   char** : Names of requested attributes. Example: {"cn"}
+         */
+        std::shared_ptr<const ldapCachedResult> query(ldapReader& reader, const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            std::shared_ptr<const ldapCachedResult> ret;
+            
+            //reduced or changed results are not cached
+            if( reader.hasResultOptions() )
+            {
+                this->misses++;
+                reader.query(searchFilter, searchBase, attrNum, attributeNames);
+                ret = std::make_shared<const ldapCachedResult>(reader);
+                return ret;
+            }
+            
+            std::string query = this->_key(reader.getScope(), searchFilter, searchBase, attrNum, attributeNames);
+            std::string key = _userKey(query, reader.getBindUser());
+            
+            ret = this->_get(query, key);
+            if( ret )
+                return ret;
+            
+            //concurrent misses of same key make their own query, last one stays in cache
+            reader.query(searchFilter, searchBase, attrNum, attributeNames);
+            ret = std::make_shared<const ldapCachedResult>(reader);
+            
+            this->_put(query, key, ret);
+            
+            return ret;
+        };
+        
+        /*
+         * Remove results of a query from cache, for all bind users
+         * @param @scope            int : Search scope. Example: LDAP_SCOPE_SUBTREE
+         * @param @searchFilter     char* : Ldap search filter
+         * @param @searchBase       char* : Ldap search base
+         * @param @attrNum          unsigned int : Number of attributes in attributeNames
+         * @param @attributeNames   char** : Names of requested attributes
+         */
+        void invalidate(int scope, const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            std::string query = this->_key(scope, searchFilter, searchBase, attrNum, attributeNames);
+            ldapCacheShard& shard = this->_shard(query);
+            
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            
+            //results of all bind users of the query are in same shard
+            for(ldapCacheList::iterator it = shard.lru.begin(); it != shard.lru.end(); )
+            {
+                ldapCacheList::iterator cur = it++;
+                if( cur->query == query )
+                    this->_remove(shard, cur);
+            }
+        };
+        
+        /*
+         * Remove results of all queries which base is the dn or under the dn. Call after a change under the dn.
+         * Results of queries which base is above the dn are also removed, since their subtree includes the change.
+         * @param @dn       char* : Changed dn. Example: "cn=group1,ou=groups,dc=example,dc=org"
+         */
+        void invalidateDn(const char* dn)
+        {
+            std::string ndn = _normalizeDn(dn);
+            
+            for(size_t i=0; i<this->shards.size(); i++)
+            {
+                std::lock_guard<std::mutex> lock(this->shards[i].mtx);
+                
+                for(ldapCacheList::iterator it = this->shards[i].lru.begin(); it != this->shards[i].lru.end(); )
+                {
+                    ldapCacheList::iterator cur = it++;
+                    if( _isUnder(cur->base, ndn) || _isUnder(ndn, cur->base) )
+                        this->_remove(this->shards[i], cur);
+                }
+            }
+        };
+        
+        /*
+         * Remove all results
+         */
+        void clear()
+        {
+            for(size_t i=0; i<this->shards.size(); i++)
+            {
+                std::lock_guard<std::mutex> lock(this->shards[i].mtx);
+                this->shards[i].lru.clear();
+                this->shards[i].index.clear();
+                this->shards[i].bytes = 0;
+            }
+        };
+        
+        /*
+         * Get number of queries answered from cache
+         */
+        unsigned long getHits()
+        {
+            return this->hits;
+        };
+        
+        /*
+         * Get number of queries sent to server
+         */
+        unsigned long getMisses()
+        {
+            return this->misses;
+        };
+        
+        /*
+         * Get number of results removed for size limit
+         */
+        unsigned long getEvictions()
+        {
+            return this->evictions;
+        };
+
+    private:
+        struct ldapCacheItem
+        {
+            std::string key;
+            //key without bind user, for invalidate()
+            std::string query;
+            //normalized base, for invalidateDn()
+            std::string base;
+            std::shared_ptr<const ldapCachedResult> result;
+            size_t bytes;
+            std::chrono::steady_clock::time_point expire;
+        };
+        
+        typedef std::list<ldapCacheItem> ldapCacheList;
+        
+        struct ldapCacheShard
+        {
+            //most recently used first
+            ldapCacheList lru;
+            std::unordered_map<std::string, ldapCacheList::iterator> index;
+            size_t bytes;
+            std::mutex mtx;
+            
+            ldapCacheShard() : bytes(0) {};
+        };
+        
+        //make key from normalized query parameters
+        std::string _key(int scope, const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            std::vector<std::string> attrs;
+            for(unsigned int i=0; i<attrNum; i++)
+                attrs.push_back(_lower(attributeNames[i]));
+            std::sort(attrs.begin(), attrs.end());
+            
+            //filter values may be case sensitive, so it is kept as it is
+            std::string key = _normalizeDn(searchBase);
+            key += '\0';
+            key += (char)('0' + scope);
+            key += searchFilter;
+            for(size_t i=0; i<attrs.size(); i++)
+            {
+                key += '\0';
+                key += attrs[i];
+            }
+            
+            return key;
+        };
+        
+        //add bind user to key of query, after a separator which can not be in query key
+        static std::string _userKey(const std::string& query, const char* bindUser)
+        {
+            std::string key = query;
+            key += '\0';
+            key += '\0';
+            if( bindUser != NULL )
+                key += _normalizeDn(bindUser);
+            
+            return key;
+        };
+        
+        //lowercase dn and remove spaces after separators. Example: "OU=Users, DC=Example" -> "ou=users,dc=example"
+        static std::string _normalizeDn(const char* dn)
+        {
+            std::string ret;
+            bool afterSeparator = true;
+            
+            for(const char* p = dn; *p != '\0'; p++)
+            {
+                if( *p == ' ' && afterSeparator )
+                    continue;
+                
+                afterSeparator = ( *p == ',' || *p == '=' ) && ( p == dn || p[-1] != '\\' );
+                ret += (char)tolower((unsigned char)*p);
+            }
+            
+            return ret;
+        };
+        
+        static std::string _lower(const char* str)
+        {
+            std::string ret(str);
+            for(size_t i=0; i<ret.size(); i++)
+                ret[i] = (char)tolower((unsigned char)ret[i]);
+            
+            return ret;
+        };
+        
+        //check if normalized dn is equal to or under normalized base
+        static bool _isUnder(const std::string& dn, const std::string& base)
+        {
+            if( base.empty() || dn == base )
+                return true;
+            
+            return dn.size() > base.size() && dn[dn.size() - base.size() - 1] == ',' && dn.compare(dn.size() - base.size(), base.size(), base) == 0;
+        };
+        
+        ldapCacheShard& _shard(const std::string& key)
+        {
+            return this->shards[std::hash<std::string>()(key) % this->shards.size()];
+        };
+        
+        //find fresh result and move it to front of LRU. Shard is chosen by query, so invalidate() finds all bind users
+        std::shared_ptr<const ldapCachedResult> _get(const std::string& query, const std::string& key)
+        {
+            ldapCacheShard& shard = this->_shard(query);
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            
+            std::unordered_map<std::string, ldapCacheList::iterator>::iterator it = shard.index.find(key);
+            if( it == shard.index.end() )
+            {
+                this->misses++;
+                return std::shared_ptr<const ldapCachedResult>();
+            }
+            
+            if( std::chrono::steady_clock::now() >= it->second->expire )
+            {
+                this->_remove(shard, it->second);
+                this->misses++;
+                return std::shared_ptr<const ldapCachedResult>();
+            }
+            
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            this->hits++;
+            
+            return it->second->result;
+        };
+        
+        //add result and evict least recently used ones over size limit
+        void _put(const std::string& query, const std::string& key, std::shared_ptr<const ldapCachedResult> result)
+        {
+            ldapCacheShard& shard = this->_shard(query);
+            
+            ldapCacheItem item;
+            item.key = key;
+            item.query = query;
+            item.base = query.substr(0, query.find('\0'));
+            item.result = result;
+            item.bytes = result->getMemorySize() + 2 * key.size() + query.size();
+            item.expire = std::chrono::steady_clock::now() + std::chrono::seconds(this->ttl);
+            
+            //result bigger than shard is not cached
+            if( item.bytes > this->shardBytes )
+                return;
+            
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            
+            std::unordered_map<std::string, ldapCacheList::iterator>::iterator it = shard.index.find(key);
+            if( it != shard.index.end() )
+                this->_remove(shard, it->second);
+            
+            shard.lru.push_front(item);
+            shard.index[key] = shard.lru.begin();
+            shard.bytes += item.bytes;
+            
+            while( shard.bytes > this->shardBytes )
+            {
+                this->_remove(shard, --shard.lru.end());
+                this->evictions++;
+            }
+        };
+        
+        //remove item, shard must be locked
+        void _remove(ldapCacheShard& shard, ldapCacheList::iterator it)
+        {
+            shard.bytes -= it->bytes;
+            shard.index.erase(it->key);
+            shard.lru.erase(it);
+        };
+        
+        std::vector<ldapCacheShard> shards;
+        size_t shardBytes;
+        int ttl;
+        
+        std::atomic<unsigned long> hits;
+        std::atomic<unsigned long> misses;
+        std::atomic<unsigned long> evictions;
+};
+
+#endif	/* LDAPRESULTCACHE_H */
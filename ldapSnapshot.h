@@ -0,0 +1,951 @@
+/*
+ * File         : ldapSnapshot.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Local snapshot of a query result in a memory mapped file. Values are interned and stored by
+ *                attribute columns, chosen attributes have sorted indexes. Equality, prefix and presence filters
+ *                are answered from the mapped file without reading it into memory.
+ * Compile Opt  : -lldap -llber -pthread -std=c++11
+ *
+ * Dependency   :
+ *                  ldapReader.h, ldapInterner.h, ldapFilter.h
+ */
+
+#ifndef LDAPSNAPSHOT_H
+#define	LDAPSNAPSHOT_H
+
+#include "ldapReader.h"
+#include "ldapInterner.h"
+#include "ldapFilter.h"
+
+//for columns, indexes and results
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+//for writing file
+#include <cstdio>
+#include <ctime>
+//for mapping file
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//file format version, files of other versions are refused
+#define _LDAP_SNAPSHOT_VERSION 1
+#define _LDAP_SNAPSHOT_MAGIC "LDAPSNAP"
+//written as number and compared, so files of other byte order are refused
+#define _LDAP_SNAPSHOT_BYTE_ORDER 0x01020304
+
+/*
+ * File layout. All offsets are from start of file and aligned to 8 bytes.
+ *  header
+ *  string offsets      : uint64_t[stringCount + 1], string i is [offsets[i], offsets[i+1] - 1) followed by '\0'
+ *  string data
+ *  dns                 : uint32_t[objectCount], string id of dn of each object
+ *  columns             : ldapSnapshotColumn[columnCount]
+ *  for each column     : uint32_t starts[objectCount + 1], uint32_t values[valueCount] (string ids)
+ *  indexes             : ldapSnapshotIndex[indexCount]
+ *  for each index      : ldapSnapshotIndexEntry[entryCount], sorted by lowercase value then object
+ */
+struct ldapSnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t createdAt;
+    uint32_t objectCount;
+    uint32_t columnCount;
+    uint32_t indexCount;
+    uint32_t stringCount;
+    uint64_t stringOffsets;
+    uint64_t stringData;
+    uint64_t dns;
+    uint64_t columns;
+    uint64_t indexes;
+    uint64_t fileSize;
+};
+
+//values of one attribute for all objects. Values of object i are values[starts[i] .. starts[i+1])
+struct ldapSnapshotColumn
+{
+    uint32_t nameId;
+    uint32_t valueCount;
+    uint64_t starts;
+    uint64_t values;
+};
+
+struct ldapSnapshotIndex
+{
+    uint32_t column;
+    uint32_t entryCount;
+    uint64_t entries;
+};
+
+struct ldapSnapshotIndexEntry
+{
+    //string id of lowercase value
+    uint32_t keyId;
+    uint32_t object;
+};
+
+/*
+ * Snapshot writer class. Reads all objects of a query made on ldapReader and writes them to a file.
+ * Each returned attribute becomes a column. Ranged attributes of Active Directory are stored with their
+ * returned name, use ldapRangeIterator before snapshot if they are needed.
+ *
+ *      ldapSnapshotWriter writer;
+ *      writer.addIndex("uid");
+ *      reader.query("(objectClass=person)", "ou=SSO,dc=example,dc=org");
+ *      writer.write(reader, "/var/cache/sso.snap");
+ */
+class ldapSnapshotWriter
+{
+    public:
+        ldapSnapshotWriter()
+        {
+        };
+        
+        virtual ~ldapSnapshotWriter()
+        {
+        };
+        
+        /*
+         * Add sorted index on attribute, for equality and prefix filters. Matching ignores ASCII case.
+         * @param @attributeName    char* : Attribute name. Example: "uid"
+         */
+        void addIndex(const char* attributeName)
+        {
+            this->indexNames.push_back(attributeName);
+        };
+        
+        /*
+         * Fetch all remaining objects of reader and write snapshot. File is written to a temporary file and renamed,
+         * so processes which map the old file are not affected.
+         * @param @reader       ldapReader& : Reader with a query made
+         * @param @path         char* : Snapshot file. Example: "/var/cache/sso.snap"
+         * @return unsigned long : Number of objects
+         */
+        unsigned long write(ldapReader& reader, const char* path)
+        {
+            ldapInterner strings;
+            std::vector<uint32_t> dns;
+            std::vector<ldapWriterColumn> columns;
+            std::vector<std::string> columnNames;
+            
+            while( reader.fetch() )
+            {
+                uint32_t object = dns.size();
+                struct berval dn = reader.getDnView();
+                dns.push_back(strings.intern(dn.bv_val, dn.bv_len));
+                
+                unsigned int attrNum = reader.getAttributeViewCount();
+                for(unsigned int a=0; a<attrNum; a++)
+                {
+                    struct berval name;
+                    struct berval* values;
+                    int count = reader.getAttributeViewNth(a, &name, &values);
+                    
+                    size_t c = _columnOf(columnNames, name);
+                    if( c == columns.size() )
+                    {
+                        columnNames.push_back(std::string(name.bv_val, name.bv_len));
+                        columns.push_back(ldapWriterColumn());
+                        columns.back().nameId = strings.intern(name.bv_val, name.bv_len);
+                    }
+                    
+                    //objects without the attribute have empty ranges
+                    ldapWriterColumn& col = columns[c];
+                    col.starts.resize(object + 1, col.values.size());
+                    for(int i=0; i<count; i++)
+                        col.values.push_back(strings.intern(values[i].bv_val, values[i].bv_len));
+                }
+            }
+            
+            uint32_t objectCount = dns.size();
+            for(size_t c=0; c<columns.size(); c++)
+                columns[c].starts.resize(objectCount + 1, columns[c].values.size());
+            
+            //lowercase keys of indexed columns, sorted by key bytes
+            std::vector<ldapWriterIndex> indexes;
+            for(size_t i=0; i<this->indexNames.size(); i++)
+            {
+                struct berval name;
+                name.bv_val = (char*)this->indexNames[i].c_str();
+                name.bv_len = this->indexNames[i].size();
+                
+                size_t c = _columnOf(columnNames, name);
+                if( c == columns.size() )
+                    continue;
+                
+                indexes.push_back(ldapWriterIndex());
+                ldapWriterIndex& index = indexes.back();
+                index.column = c;
+                
+                std::vector<char> lower;
+                for(uint32_t o=0; o<objectCount; o++)
+                    for(uint32_t v=columns[c].starts[o]; v<columns[c].starts[o+1]; v++)
+                    {
+                        struct berval value = strings.get(columns[c].values[v]);
+                        lower.resize(value.bv_len + 1);
+                        size_t len = ldapInterner::normalize(value.bv_val, value.bv_len, ldapInterner::IGNORE_CASE, &lower[0]);
+                        
+                        ldapSnapshotIndexEntry entry;
+                        entry.keyId = strings.intern(&lower[0], len);
+                        entry.object = o;
+                        index.entries.push_back(entry);
+                    }
+                
+                std::sort(index.entries.begin(), index.entries.end(), ldapEntryLess(strings));
+            }
+            
+            this->_writeFile(path, strings, dns, columns, indexes);
+            return objectCount;
+        };
+
+    private:
+        struct ldapWriterColumn
+        {
+            uint32_t nameId;
+            std::vector<uint32_t> starts;
+            std::vector<uint32_t> values;
+        };
+        
+        struct ldapWriterIndex
+        {
+            uint32_t column;
+            std::vector<ldapSnapshotIndexEntry> entries;
+        };
+        
+        //order of index entries, by key bytes then object
+        struct ldapEntryLess
+        {
+            ldapInterner& strings;
+            
+            explicit ldapEntryLess(ldapInterner& strings) : strings(strings)
+            {
+            };
+            
+            bool operator()(const ldapSnapshotIndexEntry& a, const ldapSnapshotIndexEntry& b) const
+            {
+                if( a.keyId != b.keyId )
+                {
+                    struct berval ka = this->strings.get(a.keyId);
+                    struct berval kb = this->strings.get(b.keyId);
+                    int cmp = memcmp(ka.bv_val, kb.bv_val, std::min(ka.bv_len, kb.bv_len));
+                    if( cmp != 0 || ka.bv_len != kb.bv_len )
+                        return cmp != 0 ? cmp < 0 : ka.bv_len < kb.bv_len;
+                }
+                
+                return a.object < b.object;
+            };
+        };
+        
+        //position of column, columns.size() if it doesn't exist
+        static size_t _columnOf(const std::vector<std::string>& names, const struct berval& name)
+        {
+            for(size_t c=0; c<names.size(); c++)
+                if( names[c].size() == name.bv_len && strncasecmp(names[c].c_str(), name.bv_val, name.bv_len) == 0 )
+                    return c;
+            
+            return names.size();
+        };
+        
+        //write data and pad to 8 bytes, return offset of data
+        static uint64_t _put(FILE* f, uint64_t& offset, const void* data, size_t size)
+        {
+            uint64_t at = offset;
+            
+            if( size > 0 && fwrite(data, 1, size, f) != size )
+                throw *(new ldapException("Can not write snapshot file"));
+            
+            offset += size;
+            _pad(f, offset);
+            return at;
+        };
+        
+        //write zeros up to next 8 byte boundary
+        static void _pad(FILE* f, uint64_t& offset)
+        {
+            static const char zeros[8] = { 0 };
+            size_t pad = (8 - offset % 8) % 8;
+            
+            if( pad > 0 && fwrite(zeros, 1, pad, f) != pad )
+                throw *(new ldapException("Can not write snapshot file"));
+            
+            offset += pad;
+        };
+        
+        void _writeFile(const char* path, ldapInterner& strings, const std::vector<uint32_t>& dns, std::vector<ldapWriterColumn>& columns, std::vector<ldapWriterIndex>& indexes)
+        {
+            std::string tmp = std::string(path) + ".tmp";
+            ldapSnapshotHeader header;
+            uint64_t offset = 0;
+            
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, _LDAP_SNAPSHOT_MAGIC, 8);
+            header.version = _LDAP_SNAPSHOT_VERSION;
+            header.byteOrder = _LDAP_SNAPSHOT_BYTE_ORDER;
+            header.createdAt = time(NULL);
+            header.objectCount = dns.size();
+            header.columnCount = columns.size();
+            header.indexCount = indexes.size();
+            header.stringCount = strings.size();
+            
+            FILE* f = fopen(tmp.c_str(), "wb");
+            if( f == NULL )
+                throw *(new ldapException("Can not open snapshot file"));
+            
+            try
+            {
+                //header is written again at the end with offsets
+                _put(f, offset, &header, sizeof(header));
+                
+                std::vector<uint64_t> stringOffsets(header.stringCount + 1);
+                uint64_t dataSize = 0;
+                for(uint32_t i=0; i<header.stringCount; i++)
+                {
+                    stringOffsets[i] = dataSize;
+                    dataSize += strings.get(i).bv_len + 1;
+                }
+                stringOffsets[header.stringCount] = dataSize;
+                header.stringOffsets = _put(f, offset, &stringOffsets[0], stringOffsets.size() * sizeof(uint64_t));
+                
+                header.stringData = offset;
+                for(uint32_t i=0; i<header.stringCount; i++)
+                {
+                    struct berval s = strings.get(i);
+                    if( fwrite(s.bv_val, 1, s.bv_len + 1, f) != s.bv_len + 1 )
+                        throw *(new ldapException("Can not write snapshot file"));
+                }
+                offset += dataSize;
+                _pad(f, offset);
+                
+                header.dns = _put(f, offset, dns.empty() ? NULL : &dns[0], dns.size() * sizeof(uint32_t));
+                
+                std::vector<ldapSnapshotColumn> columnTable(columns.size());
+                uint64_t at = offset + columns.size() * sizeof(ldapSnapshotColumn);
+                for(size_t c=0; c<columns.size(); c++)
+                {
+                    columnTable[c].nameId = columns[c].nameId;
+                    columnTable[c].valueCount = columns[c].values.size();
+                    columnTable[c].starts = at;
+                    at += _padded(columns[c].starts.size() * sizeof(uint32_t));
+                    columnTable[c].values = at;
+                    at += _padded(columns[c].values.size() * sizeof(uint32_t));
+                }
+                header.columns = _put(f, offset, columnTable.empty() ? NULL : &columnTable[0], columnTable.size() * sizeof(ldapSnapshotColumn));
+                for(size_t c=0; c<columns.size(); c++)
+                {
+                    _put(f, offset, &columns[c].starts[0], columns[c].starts.size() * sizeof(uint32_t));
+                    _put(f, offset, columns[c].values.empty() ? NULL : &columns[c].values[0], columns[c].values.size() * sizeof(uint32_t));
+                }
+                
+                std::vector<ldapSnapshotIndex> indexTable(indexes.size());
+                at = offset + indexes.size() * sizeof(ldapSnapshotIndex);
+                for(size_t i=0; i<indexes.size(); i++)
+                {
+                    indexTable[i].column = indexes[i].column;
+                    indexTable[i].entryCount = indexes[i].entries.size();
+                    indexTable[i].entries = at;
+                    at += _padded(indexes[i].entries.size() * sizeof(ldapSnapshotIndexEntry));
+                }
+                header.indexes = _put(f, offset, indexTable.empty() ? NULL : &indexTable[0], indexTable.size() * sizeof(ldapSnapshotIndex));
+                for(size_t i=0; i<indexes.size(); i++)
+                    _put(f, offset, indexes[i].entries.empty() ? NULL : &indexes[i].entries[0], indexes[i].entries.size() * sizeof(ldapSnapshotIndexEntry));
+                
+                header.fileSize = offset;
+                if( fseek(f, 0, SEEK_SET) != 0 || fwrite(&header, 1, sizeof(header), f) != sizeof(header) )
+                    throw *(new ldapException("Can not write snapshot file"));
+            }
+            catch(ldapException &)
+            {
+                fclose(f);
+                remove(tmp.c_str());
+                throw;
+            }
+            
+            //readers of old file keep their mapping
+            if( fclose(f) != 0 || rename(tmp.c_str(), path) != 0 )
+            {
+                remove(tmp.c_str());
+                throw *(new ldapException("Can not write snapshot file"));
+            }
+        };
+        
+        static uint64_t _padded(uint64_t size)
+        {
+            return (size + 7) & ~(uint64_t)7;
+        };
+        
+        std::vector<std::string> indexNames;
+};
+
+/*
+ * Snapshot reader class. File is mapped read only and shared, so processes using the same snapshot share
+ * page cache. Use like ldapReader: query() then fetch(), getDnView() and getAttributeView().
+ *
+ * Equality (uid=user1), prefix (uid=user*) and presence (mail=*) items are searched in the index of
+ * attribute, or its column is scanned. Other items, like substring (mail=*@example.org) or ordering
+ * (uidNumber>=1000), are matched with ldapFilter on each object. Items are combined with &, | and !.
+ * Values are matched ignoring ASCII case.
+ */
+class ldapSnapshot
+{
+    public:
+        /*
+         * Map snapshot file
+         * @param @path     char* : Snapshot file written by ldapSnapshotWriter. Example: "/var/cache/sso.snap"
+         */
+        explicit ldapSnapshot(const char* path)
+        {
+            struct stat st;
+            
+            this->position = 0;
+            this->current = 0;
+            this->isPositioned = false;
+            
+            int fd = open(path, O_RDONLY);
+            if( fd == -1 )
+                throw *(new ldapException("Can not open snapshot file"));
+            
+            if( fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ldapSnapshotHeader) )
+            {
+                close(fd);
+                throw *(new ldapException("Invalid snapshot file"));
+            }
+            
+            this->size = st.st_size;
+            this->base = (const char*)mmap(NULL, this->size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            
+            if( this->base == MAP_FAILED )
+                throw *(new ldapException("Can not map snapshot file"));
+            
+            this->header = (const ldapSnapshotHeader*)this->base;
+            if( ! this->_isValid() )
+            {
+                munmap((void*)this->base, this->size);
+                throw *(new ldapException("Invalid snapshot file"));
+            }
+            
+            this->stringOffsets = (const uint64_t*)(this->base + this->header->stringOffsets);
+            this->stringData = this->base + this->header->stringData;
+            this->dns = (const uint32_t*)(this->base + this->header->dns);
+            this->columns = (const ldapSnapshotColumn*)(this->base + this->header->columns);
+            this->indexes = (const ldapSnapshotIndex*)(this->base + this->header->indexes);
+            this->viewValues.resize(this->header->columnCount);
+        };
+        
+        virtual ~ldapSnapshot()
+        {
+            munmap((void*)this->base, this->size);
+        };
+        
+        /*
+         * Get number of objects in snapshot
+         */
+        uint32_t getObjectCount()
+        {
+            return this->header->objectCount;
+        };
+        
+        /*
+         * Get time when snapshot is written
+         */
+        time_t getCreatedAt()
+        {
+            return this->header->createdAt;
+        };
+        
+        /*
+         * Find objects matching filter
+         * @param @searchFilter     char* : Ldap filter. Example: "(&(objectClass=person)(uid=user*))"
+         */
+        void query(const char* searchFilter)
+        {
+            this->query(searchFilter, "");
+        };
+        
+        /*
+         * Find objects matching filter under base
+         * @param @searchFilter     char* : Ldap filter. Example: "(&(objectClass=person)(uid=user*))"
+         * @param @searchBase       char* : Base dn, "" for all objects. Example: "ou=SSO,dc=example,dc=org"
+         */
+        void query(const char* searchFilter, const char* searchBase)
+        {
+            const char* p = searchFilter;
+            
+            this->result.clear();
+            this->position = 0;
+            this->isPositioned = false;
+            
+            this->_evaluate(p, this->result);
+            if( *p != '\0' )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            
+            if( searchBase[0] != '\0' )
+                this->_filterBase(searchBase, this->result);
+        };
+        
+        /*
+         * Move to next object of query
+         * @return bool : false if there is no more object
+         */
+        bool fetch()
+        {
+            if( this->position >= this->result.size() )
+            {
+                this->isPositioned = false;
+                return false;
+            }
+            
+            this->current = this->result[this->position++];
+            this->isPositioned = true;
+            return true;
+        };
+        
+        /*
+         * Get number of objects found by query
+         */
+        size_t getResultCount()
+        {
+            return this->result.size();
+        };
+        
+        /*
+         * Get dn of current object. Points into mapped file, null terminated
+         */
+        struct berval getDnView()
+        {
+            this->_checkPositioned();
+            return this->_string(this->dns[this->current]);
+        };
+        
+        /*
+         * Get attribute values of current object. Values point into mapped file and are null terminated.
+         * Value table is valid until next fetch() or getAttributeView() call for the same attribute.
+         * @return int : Number of values. 0 if object doesn't have the attribute
+         * @param @attributeName    char* : Attribute name. Example: "memberOf"
+         * @param @values           berval** : Set to array of values, NULL if object doesn't have the attribute
+         */
+        int getAttributeView(const char* attributeName, struct berval** values)
+        {
+            this->_checkPositioned();
+            
+            int c = this->_column(attributeName);
+            *values = NULL;
+            if( c == -1 )
+                return 0;
+            
+            const uint32_t* starts = this->_starts(c);
+            const uint32_t* ids = this->_values(c);
+            uint32_t first = starts[this->current];
+            uint32_t last = starts[this->current + 1];
+            
+            //each column has own table, so views of several attributes can be kept
+            std::vector<struct berval>& view = this->viewValues[c];
+            view.resize(last - first + 1);
+            for(uint32_t v=first; v<last; v++)
+                view[v - first] = this->_string(ids[v]);
+            
+            //values end with an empty element like ldapReader views
+            view[last - first].bv_len = 0;
+            view[last - first].bv_val = NULL;
+            
+            if( last > first )
+                *values = &view[0];
+            return last - first;
+        };
+
+    private:
+        //check that all tables are inside the file and ids, offsets and positions in them are in range,
+        //so a damaged file is rejected when it is opened instead of being read out of bounds later
+        bool _isValid()
+        {
+            const ldapSnapshotHeader* h = this->header;
+            
+            if( memcmp(h->magic, _LDAP_SNAPSHOT_MAGIC, 8) != 0 || h->version != _LDAP_SNAPSHOT_VERSION || h->byteOrder != _LDAP_SNAPSHOT_BYTE_ORDER || h->fileSize != this->size )
+                return false;
+            
+            if( ! this->_isInside(h->stringOffsets, ((uint64_t)h->stringCount + 1) * sizeof(uint64_t)) || ! this->_isInside(h->dns, (uint64_t)h->objectCount * sizeof(uint32_t))
+                || ! this->_isInside(h->columns, (uint64_t)h->columnCount * sizeof(ldapSnapshotColumn)) || ! this->_isInside(h->indexes, (uint64_t)h->indexCount * sizeof(ldapSnapshotIndex)) )
+                return false;
+            
+            //each string ends with '\0', so offsets grow by at least one
+            const uint64_t* offsets = (const uint64_t*)(this->base + h->stringOffsets);
+            if( offsets[0] != 0 || ! this->_isInside(h->stringData, offsets[h->stringCount]) )
+                return false;
+            for(uint32_t i=0; i<h->stringCount; i++)
+                if( offsets[i + 1] <= offsets[i] || offsets[i + 1] > offsets[h->stringCount] || this->base[h->stringData + offsets[i + 1] - 1] != '\0' )
+                    return false;
+            
+            const uint32_t* dnIds = (const uint32_t*)(this->base + h->dns);
+            for(uint32_t o=0; o<h->objectCount; o++)
+                if( dnIds[o] >= h->stringCount )
+                    return false;
+            
+            //values of object o are values[starts[o]] to values[starts[o + 1]]
+            const ldapSnapshotColumn* cols = (const ldapSnapshotColumn*)(this->base + h->columns);
+            for(uint32_t c=0; c<h->columnCount; c++)
+            {
+                if( cols[c].nameId >= h->stringCount || ! this->_isInside(cols[c].starts, ((uint64_t)h->objectCount + 1) * sizeof(uint32_t))
+                    || ! this->_isInside(cols[c].values, (uint64_t)cols[c].valueCount * sizeof(uint32_t)) )
+                    return false;
+                
+                const uint32_t* starts = (const uint32_t*)(this->base + cols[c].starts);
+                if( starts[0] != 0 || starts[h->objectCount] > cols[c].valueCount )
+                    return false;
+                for(uint32_t o=0; o<h->objectCount; o++)
+                    if( starts[o + 1] < starts[o] )
+                        return false;
+                
+                const uint32_t* ids = (const uint32_t*)(this->base + cols[c].values);
+                for(uint32_t v=0; v<cols[c].valueCount; v++)
+                    if( ids[v] >= h->stringCount )
+                        return false;
+            }
+            
+            const ldapSnapshotIndex* idx = (const ldapSnapshotIndex*)(this->base + h->indexes);
+            for(uint32_t i=0; i<h->indexCount; i++)
+            {
+                if( idx[i].column >= h->columnCount || ! this->_isInside(idx[i].entries, (uint64_t)idx[i].entryCount * sizeof(ldapSnapshotIndexEntry)) )
+                    return false;
+                
+                const ldapSnapshotIndexEntry* entries = (const ldapSnapshotIndexEntry*)(this->base + idx[i].entries);
+                for(uint32_t e=0; e<idx[i].entryCount; e++)
+                    if( entries[e].keyId >= h->stringCount || entries[e].object >= h->objectCount )
+                        return false;
+            }
+            
+            return true;
+        };
+        
+        bool _isInside(uint64_t offset, uint64_t len)
+        {
+            return offset % 8 == 0 && offset <= this->size && len <= this->size - offset;
+        };
+        
+        void _checkPositioned()
+        {
+            if( ! this->isPositioned )
+                throw *(new ldapException("No entry retrieved from snapshot"));
+        };
+        
+        struct berval _string(uint32_t id)
+        {
+            struct berval ret;
+            ret.bv_val = (char*)this->stringData + this->stringOffsets[id];
+            ret.bv_len = this->stringOffsets[id + 1] - this->stringOffsets[id] - 1;
+            return ret;
+        };
+        
+        const uint32_t* _starts(int c)
+        {
+            return (const uint32_t*)(this->base + this->columns[c].starts);
+        };
+        
+        const uint32_t* _values(int c)
+        {
+            return (const uint32_t*)(this->base + this->columns[c].values);
+        };
+        
+        //column of attribute, -1 if no object has it
+        int _column(const char* attributeName)
+        {
+            size_t len = strlen(attributeName);
+            
+            for(uint32_t c=0; c<this->header->columnCount; c++)
+            {
+                struct berval name = this->_string(this->columns[c].nameId);
+                if( name.bv_len == len && strncasecmp(name.bv_val, attributeName, len) == 0 )
+                    return c;
+            }
+            
+            return -1;
+        };
+        
+        //index of column, NULL if column is not indexed
+        const ldapSnapshotIndex* _index(int c)
+        {
+            for(uint32_t i=0; i<this->header->indexCount; i++)
+                if( (int)this->indexes[i].column == c )
+                    return &this->indexes[i];
+            
+            return NULL;
+        };
+        
+        /*
+         * Evaluate filter at p into sorted object list, p is moved after the filter
+         */
+        void _evaluate(const char*& p, std::vector<uint32_t>& out)
+        {
+            if( *p != '(' )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            p++;
+            
+            if( *p == '&' || *p == '|' )
+            {
+                char op = *p++;
+                bool isFirst = true;
+                std::vector<uint32_t> part;
+                std::vector<uint32_t> merged;
+                
+                while( *p == '(' )
+                {
+                    part.clear();
+                    this->_evaluate(p, part);
+                    
+                    if( isFirst )
+                        out.swap(part);
+                    else
+                    {
+                        merged.clear();
+                        if( op == '&' )
+                            std::set_intersection(out.begin(), out.end(), part.begin(), part.end(), std::back_inserter(merged));
+                        else
+                            std::set_union(out.begin(), out.end(), part.begin(), part.end(), std::back_inserter(merged));
+                        out.swap(merged);
+                    }
+                    isFirst = false;
+                }
+                
+                if( isFirst )
+                    throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            }
+            else if( *p == '!' )
+            {
+                std::vector<uint32_t> part;
+                p++;
+                this->_evaluate(p, part);
+                
+                size_t k = 0;
+                for(uint32_t o=0; o<this->header->objectCount; o++)
+                {
+                    if( k < part.size() && part[k] == o )
+                        k++;
+                    else
+                        out.push_back(o);
+                }
+            }
+            else
+                this->_evaluateItem(p, out);
+            
+            if( *p != ')' )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            p++;
+        };
+        
+        //equality, prefix or presence item: attr=value, attr=value*, attr=*
+        void _evaluateItem(const char*& p, std::vector<uint32_t>& out)
+        {
+            std::string attr;
+            std::string value;
+            bool isPrefix = false;
+            bool isPresence = false;
+            
+            const char* end = strchr(p, ')');
+            if( end == NULL )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            
+            if( ! _isIndexable(p, end) )
+            {
+                this->_scanFilter(std::string("(") + std::string(p, end - p) + ")", out);
+                p = end;
+                return;
+            }
+            
+            while( *p != '\0' && *p != '=' && *p != ')' && *p != '(' )
+                attr += *p++;
+            if( *p != '=' || attr.empty() )
+                throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+            p++;
+            
+            while( *p != '\0' && *p != ')' )
+            {
+                if( *p == '*' )
+                {
+                    if( value.empty() )
+                        isPresence = true;
+                    else
+                        isPrefix = true;
+                    p++;
+                    continue;
+                }
+                
+                //escaped byte, Example: \2a
+                if( *p == '\\' )
+                {
+                    int hi = _hex(p[1]);
+                    int lo = hi == -1 ? -1 : _hex(p[2]);
+                    if( lo == -1 )
+                        throw *(new ldapException("Invalid filter", LDAP_FILTER_ERROR));
+                    value += (char)(hi * 16 + lo);
+                    p += 3;
+                    continue;
+                }
+                
+                value += (char)tolower((unsigned char)*p++);
+            }
+            
+            int c = this->_column(attr.c_str());
+            if( c == -1 )
+                return;
+            
+            if( isPresence )
+            {
+                const uint32_t* starts = this->_starts(c);
+                for(uint32_t o=0; o<this->header->objectCount; o++)
+                    if( starts[o + 1] > starts[o] )
+                        out.push_back(o);
+                return;
+            }
+            
+            //escaped bytes are lowered too, matching ignores case
+            for(size_t i=0; i<value.size(); i++)
+                value[i] = (char)tolower((unsigned char)value[i]);
+            
+            const ldapSnapshotIndex* index = this->_index(c);
+            if( index != NULL )
+                this->_searchIndex(index, value, isPrefix, out);
+            else
+                this->_scanColumn(c, value, isPrefix, out);
+        };
+        
+        //equality, prefix or presence item, which can be searched in index or column
+        static bool _isIndexable(const char* p, const char* end)
+        {
+            const char* eq = (const char*)memchr(p, '=', end - p);
+            if( eq == NULL || eq == p || eq[-1] == '<' || eq[-1] == '>' || eq[-1] == '~' || memchr(p, ':', eq - p) != NULL )
+                return false;
+            
+            for(const char* q=eq+1; q<end; q++)
+                if( *q == '*' && q + 1 != end )
+                    return false;
+            
+            return true;
+        };
+        
+        //match item with ldapFilter on each object
+        void _scanFilter(const std::string& item, std::vector<uint32_t>& out)
+        {
+            ldapFilter filter(item.c_str());
+            
+            for(uint32_t o=0; o<this->header->objectCount; o++)
+            {
+                this->current = o;
+                this->isPositioned = true;
+                if( filter.match(*this) )
+                    out.push_back(o);
+            }
+            
+            this->isPositioned = false;
+        };
+        
+        static int _hex(char c)
+        {
+            if( c >= '0' && c <= '9' )
+                return c - '0';
+            if( c >= 'a' && c <= 'f' )
+                return c - 'a' + 10;
+            if( c >= 'A' && c <= 'F' )
+                return c - 'A' + 10;
+            return -1;
+        };
+        
+        //compare key with lowercase value, only first value.size() bytes if prefix
+        int _compareKey(uint32_t keyId, const std::string& value, bool isPrefix)
+        {
+            struct berval key = this->_string(keyId);
+            size_t len = isPrefix && key.bv_len > value.size() ? value.size() : key.bv_len;
+            
+            int cmp = memcmp(key.bv_val, value.data(), std::min(len, value.size()));
+            if( cmp != 0 )
+                return cmp;
+            return len < value.size() ? -1 : ( len > value.size() ? 1 : 0 );
+        };
+        
+        //binary search of sorted index
+        void _searchIndex(const ldapSnapshotIndex* index, const std::string& value, bool isPrefix, std::vector<uint32_t>& out)
+        {
+            const ldapSnapshotIndexEntry* entries = (const ldapSnapshotIndexEntry*)(this->base + index->entries);
+            uint32_t low = 0;
+            uint32_t high = index->entryCount;
+            
+            while( low < high )
+            {
+                uint32_t mid = low + (high - low) / 2;
+                if( this->_compareKey(entries[mid].keyId, value, isPrefix) < 0 )
+                    low = mid + 1;
+                else
+                    high = mid;
+            }
+            
+            for( ; low < index->entryCount && this->_compareKey(entries[low].keyId, value, isPrefix) == 0; low++ )
+                out.push_back(entries[low].object);
+            
+            //same object may have several matching values, and prefix matches are not in object order
+            std::sort(out.begin(), out.end());
+            out.erase(std::unique(out.begin(), out.end()), out.end());
+        };
+        
+        //check all values of column
+        void _scanColumn(int c, const std::string& value, bool isPrefix, std::vector<uint32_t>& out)
+        {
+            const uint32_t* starts = this->_starts(c);
+            const uint32_t* ids = this->_values(c);
+            
+            for(uint32_t o=0; o<this->header->objectCount; o++)
+                for(uint32_t v=starts[o]; v<starts[o + 1]; v++)
+                {
+                    struct berval s = this->_string(ids[v]);
+                    if( ( isPrefix ? s.bv_len >= value.size() : s.bv_len == value.size() ) && strncasecmp(s.bv_val, value.data(), value.size()) == 0 )
+                    {
+                        out.push_back(o);
+                        break;
+                    }
+                }
+        };
+        
+        //keep objects under base
+        void _filterBase(const char* searchBase, std::vector<uint32_t>& objects)
+        {
+            std::vector<char> buf(strlen(searchBase) + 1);
+            size_t len = ldapInterner::normalize(searchBase, strlen(searchBase), ldapInterner::DN, &buf[0]);
+            std::vector<char> dnBuf;
+            size_t kept = 0;
+            
+            for(size_t i=0; i<objects.size(); i++)
+            {
+                struct berval dn = this->_string(this->dns[objects[i]]);
+                dnBuf.resize(dn.bv_len + 1);
+                size_t dnLen = ldapInterner::normalize(dn.bv_val, dn.bv_len, ldapInterner::DN, &dnBuf[0]);
+                
+                if( dnLen == len ? memcmp(&dnBuf[0], &buf[0], len) == 0 : ( dnLen > len && dnBuf[dnLen - len - 1] == ',' && memcmp(&dnBuf[dnLen - len], &buf[0], len) == 0 ) )
+                    objects[kept++] = objects[i];
+            }
+            
+            objects.resize(kept);
+        };
+        
+        //mapped file
+        const char* base;
+        size_t size;
+        const ldapSnapshotHeader* header;
+        const uint64_t* stringOffsets;
+        const char* stringData;
+        const uint32_t* dns;
+        const ldapSnapshotColumn* columns;
+        const ldapSnapshotIndex* indexes;
+        
+        //objects of query, in file order
+        std::vector<uint32_t> result;
+        size_t position;
+        uint32_t current;
+        bool isPositioned;
+        //values of last getAttributeView() of each column
+        std::vector<std::vector<struct berval> > viewValues;
+};
+
+#endif	/* LDAPSNAPSHOT_H */
@@ -0,0 +1,347 @@
+/*
+ * File         : ldapStats.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Counters and latency histograms of ldapReader, per reader and global.
+ *                Snapshots are written as Prometheus text or JSON.
+ * Compile Opt  : -std=c++11
+ *
+ * Dependency   :
+ */
+
+#ifndef LDAPSTATS_H
+#define	LDAPSTATS_H
+
+//for counters
+#include <atomic>
+#include <cstdint>
+//for time
+#include <chrono>
+//for snapshots and dumps
+#include <string>
+#include <vector>
+#include <cstdio>
+
+//values below 2^_LDAP_STATS_SUB_BITS have own bucket, others share 2^_LDAP_STATS_SUB_BITS buckets per power of 2 (12.5% precision)
+#define _LDAP_STATS_SUB_BITS 3
+#define _LDAP_STATS_SUB_BUCKETS (1 << _LDAP_STATS_SUB_BITS)
+#define _LDAP_STATS_BUCKETS ((64 - _LDAP_STATS_SUB_BITS + 1) * _LDAP_STATS_SUB_BUCKETS)
+
+/*
+ * Copy of a histogram at a time
+ */
+struct ldapHistogramSnapshot
+{
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    
+    ldapHistogramSnapshot() : buckets(_LDAP_STATS_BUCKETS, 0), count(0), sum(0), max(0)
+    {
+    };
+    
+    /*
+     * Get lowest value of bucket
+     * @param @index    size_t : Bucket index
+     */
+    static uint64_t bucketLow(size_t index)
+    {
+        if( index < _LDAP_STATS_SUB_BUCKETS )
+            return index;
+        
+        unsigned int shift = index / _LDAP_STATS_SUB_BUCKETS - 1;
+        return (uint64_t)(_LDAP_STATS_SUB_BUCKETS + index % _LDAP_STATS_SUB_BUCKETS) << shift;
+    };
+    
+    /*
+     * Get value at quantile. Middle of the bucket is returned.
+     * @param @q    double : Quantile between 0 and 1. Example: 0.99
+     */
+    uint64_t percentile(double q) const
+    {
+        if( this->count == 0 )
+            return 0;
+        
+        uint64_t rank = (uint64_t)(q * this->count);
+        if( rank >= this->count )
+            rank = this->count - 1;
+        
+        uint64_t seen = 0;
+        for(size_t i=0; i<this->buckets.size(); i++)
+        {
+            seen += this->buckets[i];
+            if( seen > rank )
+            {
+                uint64_t low = bucketLow(i);
+                uint64_t mid = low + (bucketLow(i + 1) - low) / 2;
+                return mid < this->max ? mid : this->max;
+            }
+        }
+        
+        return this->max;
+    };
+    
+    double mean() const
+    {
+        return this->count == 0 ? 0 : (double)this->sum / this->count;
+    };
+};
+
+/*
+ * Log-linear histogram of 64 bit values (HDR style). Recording is lock free.
+ */
+class ldapHistogram
+{
+    public:
+        ldapHistogram()
+        {
+            this->reset();
+        };
+        
+        /*
+         * Get bucket of value
+         */
+        static size_t bucketOf(uint64_t value)
+        {
+            if( value < _LDAP_STATS_SUB_BUCKETS )
+                return value;
+            
+            unsigned int msb = 63 - __builtin_clzll(value);
+            unsigned int shift = msb - _LDAP_STATS_SUB_BITS;
+            return (shift + 1) * _LDAP_STATS_SUB_BUCKETS + ((value >> shift) & (_LDAP_STATS_SUB_BUCKETS - 1));
+        };
+        
+        void record(uint64_t value)
+        {
+            this->buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+            this->count.fetch_add(1, std::memory_order_relaxed);
+            this->sum.fetch_add(value, std::memory_order_relaxed);
+            
+            uint64_t old = this->max.load(std::memory_order_relaxed);
+            while( value > old && ! this->max.compare_exchange_weak(old, value, std::memory_order_relaxed) )
+                ;
+        };
+        
+        void snapshot(ldapHistogramSnapshot& snap) const
+        {
+            for(size_t i=0; i<_LDAP_STATS_BUCKETS; i++)
+                snap.buckets[i] = this->buckets[i].load(std::memory_order_relaxed);
+            snap.count = this->count.load(std::memory_order_relaxed);
+            snap.sum = this->sum.load(std::memory_order_relaxed);
+            snap.max = this->max.load(std::memory_order_relaxed);
+        };
+        
+        void reset()
+        {
+            for(size_t i=0; i<_LDAP_STATS_BUCKETS; i++)
+                this->buckets[i].store(0, std::memory_order_relaxed);
+            this->count.store(0, std::memory_order_relaxed);
+            this->sum.store(0, std::memory_order_relaxed);
+            this->max.store(0, std::memory_order_relaxed);
+        };
+
+    private:
+        std::atomic<uint64_t> buckets[_LDAP_STATS_BUCKETS];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+};
+
+/*
+ * Copy of all statistics at a time
+ */
+struct ldapStatsSnapshot
+{
+    std::vector<uint64_t> counters;
+    std::vector<ldapHistogramSnapshot> histograms;
+    
+    /*
+     * Write in Prometheus text format. Times are in seconds, histograms are written as summaries.
+     * @param @prefix   char* : Metric name prefix. Example: "ldapreader"
+     * @param @labels   char* : Labels added to each metric, without braces. Example: "server=\"dc1\""
+     */
+    std::string toPrometheus(const char* prefix = "ldapreader", const char* labels = "") const;
+    
+    /*
+     * Write as JSON object. Times are in seconds.
+     */
+    std::string toJson() const;
+};
+
+/*
+ * Counters and histograms of readers. Each reader has own statistics and also adds to global().
+ */
+class ldapStats
+{
+    public:
+        enum counter
+        {
+            BINDS,
+            BIND_ERRORS,
+            SEARCHES,
+            SEARCH_ERRORS,
+            PAGES,
+            ENTRIES,
+            BYTES,
+            DECODES,
+            COUNTER_NUM
+        };
+        
+        //times are in nanoseconds
+        enum histogram
+        {
+            BIND_TIME,
+            SEARCH_TIME,
+            PAGE_TIME,
+            DECODE_TIME,
+            PAGE_ENTRIES,
+            PAGE_BYTES,
+            PAGE_SIZE,
+            HISTOGRAM_NUM
+        };
+        
+        ldapStats()
+        {
+            this->reset();
+        };
+        
+        //metric name of counter
+        static const char* counterName(int c)
+        {
+            static const char* names[] = { "binds", "bind_errors", "searches", "search_errors", "pages", "entries", "bytes", "decodes" };
+            return names[c];
+        };
+        
+        //metric name of histogram
+        static const char* histogramName(int h)
+        {
+            static const char* names[] = { "bind_seconds", "search_seconds", "page_seconds", "decode_seconds", "page_entries", "page_bytes", "page_size" };
+            return names[h];
+        };
+        
+        //check if histogram keeps nanoseconds
+        static bool isTime(int h)
+        {
+            return h <= DECODE_TIME;
+        };
+        
+        /*
+         * Get monotonic time in nanoseconds
+         */
+        static uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        };
+        
+        /*
+         * Get statistics of all readers
+         */
+        static ldapStats& global()
+        {
+            static ldapStats stats;
+            return stats;
+        };
+        
+        void add(counter c, uint64_t n)
+        {
+            this->counters[c].fetch_add(n, std::memory_order_relaxed);
+        };
+        
+        void record(histogram h, uint64_t value)
+        {
+            this->histograms[h].record(value);
+        };
+        
+        /*
+         * Copy current values. Values are read one by one, so they may differ slightly while readers work.
+         */
+        ldapStatsSnapshot snapshot() const
+        {
+            ldapStatsSnapshot snap;
+            
+            snap.counters.resize(COUNTER_NUM);
+            for(int i=0; i<COUNTER_NUM; i++)
+                snap.counters[i] = this->counters[i].load(std::memory_order_relaxed);
+            
+            snap.histograms.resize(HISTOGRAM_NUM);
+            for(int i=0; i<HISTOGRAM_NUM; i++)
+                this->histograms[i].snapshot(snap.histograms[i]);
+            
+            return snap;
+        };
+        
+        void reset()
+        {
+            for(int i=0; i<COUNTER_NUM; i++)
+                this->counters[i].store(0, std::memory_order_relaxed);
+            for(int i=0; i<HISTOGRAM_NUM; i++)
+                this->histograms[i].reset();
+        };
+
+    private:
+        std::atomic<uint64_t> counters[COUNTER_NUM];
+        ldapHistogram histograms[HISTOGRAM_NUM];
+};
+
+//quantiles written for histograms
+static const double _LDAP_STATS_QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+inline std::string ldapStatsSnapshot::toPrometheus(const char* prefix, const char* labels) const
+{
+    std::string out;
+    char buf[256];
+    const char* sep = labels[0] != '\0' ? "," : "";
+    
+    for(int i=0; i<ldapStats::COUNTER_NUM; i++)
+    {
+        snprintf(buf, sizeof(buf), "# TYPE %s_%s_total counter\n%s_%s_total{%s} %llu\n", prefix, ldapStats::counterName(i), prefix, ldapStats::counterName(i), labels, (unsigned long long)this->counters[i]);
+        out += buf;
+    }
+    
+    for(int i=0; i<ldapStats::HISTOGRAM_NUM; i++)
+    {
+        const ldapHistogramSnapshot& h = this->histograms[i];
+        double scale = ldapStats::isTime(i) ? 1e-9 : 1;
+        const char* name = ldapStats::histogramName(i);
+        
+        snprintf(buf, sizeof(buf), "# TYPE %s_%s summary\n", prefix, name);
+        out += buf;
+        for(size_t q=0; q<sizeof(_LDAP_STATS_QUANTILES) / sizeof(double); q++)
+        {
+            snprintf(buf, sizeof(buf), "%s_%s{%s%squantile=\"%g\"} %.9g\n", prefix, name, labels, sep, _LDAP_STATS_QUANTILES[q], h.percentile(_LDAP_STATS_QUANTILES[q]) * scale);
+            out += buf;
+        }
+        snprintf(buf, sizeof(buf), "%s_%s_sum{%s} %.9g\n%s_%s_count{%s} %llu\n", prefix, name, labels, h.sum * scale, prefix, name, labels, (unsigned long long)h.count);
+        out += buf;
+    }
+    
+    return out;
+}
+
+inline std::string ldapStatsSnapshot::toJson() const
+{
+    std::string out = "{";
+    char buf[256];
+    
+    for(int i=0; i<ldapStats::COUNTER_NUM; i++)
+    {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%llu", i == 0 ? "" : ",", ldapStats::counterName(i), (unsigned long long)this->counters[i]);
+        out += buf;
+    }
+    
+    for(int i=0; i<ldapStats::HISTOGRAM_NUM; i++)
+    {
+        const ldapHistogramSnapshot& h = this->histograms[i];
+        double scale = ldapStats::isTime(i) ? 1e-9 : 1;
+        
+        snprintf(buf, sizeof(buf), ",\"%s\":{\"count\":%llu,\"sum\":%.9g,\"max\":%.9g,\"p50\":%.9g,\"p90\":%.9g,\"p99\":%.9g,\"p999\":%.9g}",
+            ldapStats::histogramName(i), (unsigned long long)h.count, h.sum * scale, h.max * scale,
+            h.percentile(0.5) * scale, h.percentile(0.9) * scale, h.percentile(0.99) * scale, h.percentile(0.999) * scale);
+        out += buf;
+    }
+    
+    out += "}";
+    return out;
+}
+
+#endif	/* LDAPSTATS_H */
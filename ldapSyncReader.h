@@ -0,0 +1,841 @@
+/*
+ * File         : ldapSyncReader.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Incremental read of changed objects with RFC 4533 content synchronization (syncrepl)
+ *                or modifyTimestamp/uSNChanged watermarks. State is kept between runs in a file.
+ * Compile Opt  : -lldap -llber
+ *
+ * Dependency   :
+ *                  ldapReader.h
+ */
+
+#ifndef LDAPSYNCREADER_H
+#define	LDAPSYNCREADER_H
+
+#include "ldapReader.h"
+
+//for state and queued ids
+#include <string>
+#include <deque>
+//for state file
+#include <cstdio>
+//for uSNChanged
+#include <cstdlib>
+//for modifyTimestamp
+#include <cstring>
+#include <ctime>
+
+/*
+ * Sync reader class. Use sync() instead of query() and fetchChange() instead of fetch().
+ * Attributes of changed object are read with getAttribute(), getAttributeView() and getDnView() of ldapReader.
+ *
+ *  SYNCREPL         : Server sends changes after the cookie of last run. With setPersist(true) search stays open
+ *                     and changes are received as they happen (refreshAndPersist).
+ *  MODIFY_TIMESTAMP : Objects which modifyTimestamp >= highest value of last run. Objects changed in the same
+ *                     second as last run are returned again. Deleted objects can not be detected.
+ *  USN_CHANGED      : Objects which uSNChanged > highest value of last run (Active Directory, per domain controller).
+ *                     Deleted objects can not be detected.
+ */
+class ldapSyncReader : public ldapReader
+{
+    public:
+        //change detection methods
+        enum mode
+        {
+            SYNCREPL,
+            MODIFY_TIMESTAMP,
+            USN_CHANGED
+        };
+        
+        //change types, same values with sync state control
+        enum change
+        {
+            PRESENT = 0,
+            ADD = 1,
+            MODIFY = 2,
+            DELETE = 3
+        };
+        
+        /*
+         * Define object, initialize session with server and bind.
+         * @param @serverUri    char* : Server connection uri. Example: "ldap://example.org:389"
+         * @param @bindUser     char* : Full dn of bind user. Example: "cn=user1,ou=Accounts,dc=example,dc=org"
+         * @param @bindPass     char* : Password of bind user. Example: "Passw0rd"
+         * @param @m            mode : Change detection method. Example: ldapSyncReader::SYNCREPL
+         */
+        ldapSyncReader(const char* serverUri, const char* bindUser, const char* bindPass, mode m)
+        : ldapReader(serverUri, bindUser, bindPass)
+        {
+            this->syncMode = m;
+            this->isPersist = false;
+            this->pollTimeout = -1;
+            this->syncControl = NULL;
+            this->changeType = ADD;
+            this->isSyncRunning = false;
+            this->isSyncRefreshDone = false;
+            this->hasPendingCookie = false;
+        };
+        
+        virtual ~ldapSyncReader()
+        {
+            if( this->syncControl != NULL )
+                ldap_control_free(this->syncControl);
+        };
+        
+        /*
+         * Keep search open after initial changes and receive new changes as they happen. Only for SYNCREPL. Default is false
+         * @param @persist      bool : Enable refreshAndPersist. Example: true
+         */
+        void setPersist(bool persist)
+        {
+            if( persist && this->syncMode != SYNCREPL )
+                throw *(new ldapException("Persist is only supported in syncrepl mode"));
+            
+            this->isPersist = persist;
+        };
+        
+        /*
+         * Set max wait of fetchChange() in syncrepl mode. On timeout fetchChange() returns false and isRunning() stays true.
+         * @param @ms       int : Timeout in milliseconds, -1 waits forever. Example: 1000
+         */
+        void setPollTimeout(int ms)
+        {
+            this->pollTimeout = ms;
+        };
+        
+        /*
+         * Set file which keeps the state between runs. State is loaded now if file exists,
+         * and saved when it changes after the changes before it are fetched.
+         * @param @path     char* : File path. Example: "/var/lib/app/ldap.state"
+         */
+        void setStateFile(const char* path)
+        {
+            this->stateFile = path;
+            
+            FILE* f = fopen(path, "rb");
+            if( f == NULL )
+                return;
+            
+            std::string content;
+            char buf[4096];
+            size_t n;
+            while( (n = fread(buf, 1, sizeof(buf), f)) > 0 )
+                content.append(buf, n);
+            fclose(f);
+            
+            //first line is mode, rest is state
+            size_t eol = content.find('\n');
+            if( eol == std::string::npos || content.compare(0, eol, _modeName(this->syncMode)) != 0 )
+                throw *(new ldapException("State file belongs to another mode"));
+            
+            this->state = content.substr(eol + 1);
+        };
+        
+        /*
+         * Get state: syncrepl cookie or highest watermark value. Empty before first run.
+         */
+        const std::string& getState()
+        {
+            return this->state;
+        };
+        
+        /*
+         * Set state of previous run kept elsewhere. Empty state reads all objects. In watermark modes start throws
+         * if state is not a number (uSNChanged) or generalized time (modifyTimestamp), since it goes into the filter.
+         * @param @st       string : State returned by getState()
+         */
+        void setState(const std::string& st)
+        {
+            this->state = st;
+        };
+        
+        /*
+         * Write state to state file
+         */
+        void saveState()
+        {
+            if( this->stateFile.empty() )
+                return;
+            
+            //write to temporary file and rename, so file is never half written
+            std::string tmp = this->stateFile + ".tmp";
+            FILE* f = fopen(tmp.c_str(), "wb");
+            if( f == NULL )
+                throw *(new ldapException("Can not write state file"));
+            
+            const char* name = _modeName(this->syncMode);
+            bool ok = fwrite(name, 1, strlen(name), f) == strlen(name) && fputc('\n', f) != EOF
+                && fwrite(this->state.data(), 1, this->state.size(), f) == this->state.size();
+            ok = fclose(f) == 0 && ok;
+            
+            if( ! ok || rename(tmp.c_str(), this->stateFile.c_str()) != 0 )
+                throw *(new ldapException("Can not write state file"));
+        };
+        
+        /*
+         * Start reading changes after the state, for all attributes
+         * @param @searchFilter     char* : Ldap search filter. Example: "(objectClass=user)"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         */
+        void sync(const char* searchFilter, const char* searchBase)
+        {
+            this->sync(searchFilter, searchBase, 0, NULL);
+        };
+        
+        /*
+         * Start reading changes after the state
+         * @param @searchFilter     char* : Ldap search filter. Example: "(objectClass=user)"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         * @param @attrNum          unsigned int : Number of attributes in attributeNames
+         * @param @attributeNames   char** : Names of requested attributes. Example: {"sAMAccountName","memberOf"}
+         */
+        void sync(const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            this->hasPendingCookie = false;
+            this->isSyncRefreshDone = false;
+            this->idQueue.clear();
+            
+            if( this->syncMode == SYNCREPL )
+                this->_startSyncrepl(searchFilter, searchBase, attrNum, attributeNames);
+            else
+                this->_startWatermark(searchFilter, searchBase, attrNum, attributeNames);
+            
+            this->isSyncRunning = true;
+        };
+        
+        /*
+         * Fetch next changed object. If there is no more change, return false.
+         * In persist mode, returns false only on poll timeout or if server ends the search.
+         * Objects of DELETE and PRESENT changes reported by uuid only (getEntryUUID()) have no attributes.
+         */
+        bool fetchChange()
+        {
+            if( this->syncMode == SYNCREPL )
+                return this->_fetchSyncrepl();
+            else
+                return this->_fetchWatermark();
+        };
+        
+        /*
+         * Get type of current change. In watermark modes it is always MODIFY, since add and modify can not be separated.
+         */
+        change getChangeType()
+        {
+            return this->changeType;
+        };
+        
+        /*
+         * Get entryUUID of current change in hex. Only in syncrepl mode.
+         */
+        const std::string& getEntryUUID()
+        {
+            return this->entryUUID;
+        };
+        
+        /*
+         * Check if search is still open
+         */
+        bool isRunning()
+        {
+            return this->isSyncRunning;
+        };
+        
+        /*
+         * Check if initial changes are all received. In persist mode, following changes are new ones.
+         */
+        bool isRefreshDone()
+        {
+            return this->isSyncRefreshDone;
+        };
+
+    private:
+        static const char* _modeName(mode m)
+        {
+            switch( m )
+            {
+                case SYNCREPL:
+                    return "syncrepl";
+                case MODIFY_TIMESTAMP:
+                    return "modifyTimestamp";
+                default:
+                    return "uSNChanged";
+            }
+        };
+        
+        //watermark attribute of mode
+        const char* _watermarkAttribute()
+        {
+            return this->syncMode == MODIFY_TIMESTAMP ? "modifyTimestamp" : "uSNChanged";
+        };
+        
+        //search objects changed after watermark, watermark attribute is added to requested attributes
+        void _startWatermark(const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            const char* attrs[_DEFAULT_MAX_NUMBER_OF_ATTRIBUTES];
+            
+            //operational attributes are not returned for empty list, so request all user attributes with "*"
+            if( attrNum == 0 )
+                attrs[attrNum++] = "*";
+            else
+            {
+                if( attrNum >= _DEFAULT_MAX_NUMBER_OF_ATTRIBUTES )
+                    throw *(new ldapException("Too many attributes requested."));
+                
+                for(unsigned int i=0; i<attrNum; i++)
+                    attrs[i] = attributeNames[i];
+            }
+            attrs[attrNum++] = this->_watermarkAttribute();
+            
+            std::string filter = searchFilter;
+            if( ! this->state.empty() )
+            {
+                std::string from = this->state;
+                
+                //state file may be edited or damaged, and its value goes into the filter
+                if( ! this->_isWatermark(from) )
+                    throw *(new ldapException("Invalid watermark in state"));
+                
+                //uSNChanged filter has only >=, so start from next number
+                if( this->syncMode == USN_CHANGED )
+                {
+                    char buf[32];
+                    snprintf(buf, sizeof(buf), "%llu", strtoull(this->state.c_str(), NULL, 10) + 1);
+                    from = buf;
+                }
+                
+                filter = std::string("(&") + searchFilter + "(" + this->_watermarkAttribute() + ">=" + from + "))";
+            }
+            
+            this->runWatermark = this->state;
+            this->pendingWatermark.clear();
+            
+            this->query(filter.c_str(), searchBase, attrNum, attrs);
+        };
+        
+        //check if value is a watermark of mode: number for uSNChanged, generalized time for modifyTimestamp
+        bool _isWatermark(const std::string& value)
+        {
+            long long seconds;
+            long long nanos;
+            
+            if( this->syncMode == MODIFY_TIMESTAMP )
+                return _parseTime(value, seconds, nanos);
+            
+            if( value.empty() || value.size() > 19 )
+                return false;
+            for(size_t i=0; i<value.size(); i++)
+                if( value[i] < '0' || value[i] > '9' )
+                    return false;
+            
+            return true;
+        };
+        
+        //check if watermark a is higher than b
+        bool _isHigher(const std::string& a, const std::string& b)
+        {
+            if( b.empty() )
+                return true;
+            
+            if( this->syncMode == USN_CHANGED )
+                return strtoull(a.c_str(), NULL, 10) > strtoull(b.c_str(), NULL, 10);
+            
+            //generalized time, servers may write fraction and time zone differently
+            long long secondsA, secondsB;
+            long long nanosA, nanosB;
+            if( _parseTime(a, secondsA, nanosA) && _parseTime(b, secondsB, nanosB) )
+                return secondsA > secondsB || ( secondsA == secondsB && nanosA > nanosB );
+            
+            //not a generalized time, compare as text
+            return a > b;
+        };
+        
+        //parse generalized time (RFC 4517) into UTC seconds and nanoseconds. Return false if value is not valid.
+        //Fraction belongs to the last given field, Example: "2024010112.5Z" is 12:30
+        static bool _parseTime(const std::string& value, long long& seconds, long long& nanos)
+        {
+            struct tm t;
+            int field[6] = { 0, 0, 0, 0, 0, 0 };
+            static const int width[6] = { 4, 2, 2, 2, 2, 2 };
+            static const long long unit[6] = { 0, 0, 0, 3600, 60, 1 };
+            size_t p = 0;
+            int last = 0;
+            
+            //minutes and seconds may be left out
+            for(int f=0; f<6; f++)
+            {
+                if( f >= 4 && ( p >= value.size() || value[p] < '0' || value[p] > '9' ) )
+                    break;
+                
+                for(int w=0; w<width[f]; w++, p++)
+                {
+                    if( p >= value.size() || value[p] < '0' || value[p] > '9' )
+                        return false;
+                    field[f] = field[f] * 10 + ( value[p] - '0' );
+                }
+                last = f;
+            }
+            
+            memset(&t, 0, sizeof(t));
+            t.tm_year = field[0] - 1900;
+            t.tm_mon = field[1] - 1;
+            t.tm_mday = field[2];
+            t.tm_hour = field[3];
+            t.tm_min = field[4];
+            t.tm_sec = field[5];
+            seconds = timegm(&t);
+            nanos = 0;
+            
+            //fraction in nanoseconds of last field, digits after 9th are ignored
+            if( p < value.size() && ( value[p] == '.' || value[p] == ',' ) )
+            {
+                long long fraction = 0;
+                long long scale = 100000000;
+                
+                if( ++p >= value.size() || value[p] < '0' || value[p] > '9' )
+                    return false;
+                for( ; p < value.size() && value[p] >= '0' && value[p] <= '9'; p++, scale /= 10 )
+                    fraction += ( value[p] - '0' ) * scale;
+                
+                fraction *= unit[last];
+                seconds += fraction / 1000000000;
+                nanos = fraction % 1000000000;
+            }
+            
+            //"Z" or offset from UTC, Example: "+0300"
+            if( p + 1 == value.size() && value[p] == 'Z' )
+                return true;
+            
+            if( p + 5 != value.size() || ( value[p] != '+' && value[p] != '-' ) )
+                return false;
+            for(size_t i=p+1; i<p+5; i++)
+                if( value[i] < '0' || value[i] > '9' )
+                    return false;
+            
+            long long offset = ( (value[p+1] - '0') * 10 + (value[p+2] - '0') ) * 3600 + ( (value[p+3] - '0') * 10 + (value[p+4] - '0') ) * 60;
+            seconds -= value[p] == '+' ? offset : -offset;
+            
+            return true;
+        };
+        
+        bool _fetchWatermark()
+        {
+            struct berval* values;
+            
+            //previous object is processed, count its watermark
+            if( ! this->pendingWatermark.empty() && this->_isHigher(this->pendingWatermark, this->runWatermark) )
+                this->runWatermark = this->pendingWatermark;
+            this->pendingWatermark.clear();
+            
+            if( ! this->fetch() )
+            {
+                //objects are not ordered by watermark, so state is saved only after all are read
+                if( this->isSyncRunning )
+                {
+                    this->isSyncRunning = false;
+                    this->isSyncRefreshDone = true;
+                    this->state = this->runWatermark;
+                    this->saveState();
+                }
+                return false;
+            }
+            
+            if( this->getAttributeView(this->_watermarkAttribute(), &values) > 0 )
+                this->pendingWatermark.assign(values[0].bv_val, values[0].bv_len);
+            
+            this->changeType = MODIFY;
+            this->entryUUID.clear();
+            
+            return true;
+        };
+        
+        //send search with sync request control
+        void _startSyncrepl(const char* searchFilter, const char* searchBase, unsigned int attrNum, const char** attributeNames)
+        {
+            int ret;
+            BerElement* ber;
+            struct berval value;
+            struct berval cookie;
+            LDAPControl* ctrls[2];
+            
+            this->_prepareQuery(searchFilter, searchBase, attrNum, attributeNames);
+            
+            if( this->syncControl != NULL )
+            {
+                ldap_control_free(this->syncControl);
+                this->syncControl = NULL;
+            }
+            
+            //syncRequestValue ::= SEQUENCE { mode ENUMERATED, cookie syncCookie OPTIONAL, reloadHint BOOLEAN DEFAULT FALSE }
+            ber = ber_alloc_t(LBER_USE_DER);
+            if( ber == NULL )
+                throw *(new ldapException(ldap_err2string(LDAP_NO_MEMORY), LDAP_NO_MEMORY));
+            
+            ret = ber_printf(ber, "{e", (ber_int_t)(this->isPersist ? LDAP_SYNC_REFRESH_AND_PERSIST : LDAP_SYNC_REFRESH_ONLY));
+            if( ret != -1 && ! this->state.empty() )
+            {
+                cookie.bv_val = (char*)this->state.data();
+                cookie.bv_len = this->state.size();
+                ret = ber_printf(ber, "O", &cookie);
+            }
+            if( ret != -1 )
+                ret = ber_printf(ber, "N}");
+            if( ret != -1 )
+                ret = ber_flatten2(ber, &value, 0);
+            
+            if( ret == -1 )
+            {
+                ber_free(ber, 1);
+                throw *(new ldapException(ldap_err2string(LDAP_ENCODING_ERROR), LDAP_ENCODING_ERROR));
+            }
+            
+            ret = ldap_control_create(LDAP_CONTROL_SYNC, 1, &value, 1, &this->syncControl);
+            ber_free(ber, 1);
+            if( ret != LDAP_SUCCESS )
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            
+            ctrls[0] = this->syncControl;
+            ctrls[1] = NULL;
+            
+            ret = ldap_search_ext(this->connection, this->searchBase, this->scope, this->searchFilter, this->requestedAttributes, 0, ctrls, NULL, NULL, LDAP_NO_LIMIT, &this->pendingMsgId);
+            if( ret != LDAP_SUCCESS )
+            {
+                this->pendingMsgId = -1;
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            }
+        };
+        
+        //set state from cookie and save it
+        void _commitCookie(const std::string& cookie)
+        {
+            if( cookie == this->state )
+                return;
+            
+            this->state = cookie;
+            this->saveState();
+        };
+        
+        bool _fetchSyncrepl()
+        {
+            int ret;
+            LDAPMessage* msg;
+            struct timeval tv;
+            
+            //free object of previous change
+            if( this->viewEntry != NULL )
+                this->_clearView();
+            if( this->result != NULL )
+            {
+                ldap_msgfree(this->result);
+                this->result = NULL;
+                this->entry = NULL;
+            }
+            
+            //previous object is processed, its cookie can be kept
+            if( this->hasPendingCookie )
+            {
+                this->hasPendingCookie = false;
+                this->_commitCookie(this->pendingCookie);
+            }
+            
+            for(;;)
+            {
+                //ids of deleted or present objects reported together
+                if( ! this->idQueue.empty() )
+                {
+                    this->changeType = this->idQueue.front().first;
+                    this->entryUUID = this->idQueue.front().second;
+                    this->idQueue.pop_front();
+                    return true;
+                }
+                
+                if( this->pendingMsgId == -1 )
+                    return false;
+                
+                tv.tv_sec = this->pollTimeout / 1000;
+                tv.tv_usec = (this->pollTimeout % 1000) * 1000;
+                
+                ret = ldap_result(this->connection, this->pendingMsgId, LDAP_MSG_ONE, this->pollTimeout < 0 ? NULL : &tv, &msg);
+                
+                //poll timeout, search is still open
+                if( ret == 0 )
+                    return false;
+                
+                if( ret == -1 )
+                {
+                    this->pendingMsgId = -1;
+                    this->isSyncRunning = false;
+                    ldap_get_option(this->connection, LDAP_OPT_RESULT_CODE, &ret);
+                    throw *(new ldapException(ldap_err2string(ret), ret));
+                }
+                
+                switch( ldap_msgtype(msg) )
+                {
+                    case LDAP_RES_SEARCH_ENTRY:
+                        try
+                        {
+                            this->_parseSyncState(msg);
+                        }
+                        catch(ldapException &)
+                        {
+                            ldap_msgfree(msg);
+                            throw;
+                        }
+                        this->result = msg;
+                        this->entry = msg;
+                        return true;
+                    
+                    case LDAP_RES_INTERMEDIATE:
+                        this->_parseSyncInfo(msg);
+                        ldap_msgfree(msg);
+                        break;
+                    
+                    case LDAP_RES_SEARCH_RESULT:
+                        this->pendingMsgId = -1;
+                        this->isSyncRunning = false;
+                        try
+                        {
+                            this->_parseSyncDone(msg);
+                        }
+                        catch(ldapException &)
+                        {
+                            ldap_msgfree(msg);
+                            throw;
+                        }
+                        ldap_msgfree(msg);
+                        break;
+                    
+                    //references are not followed
+                    default:
+                        ldap_msgfree(msg);
+                        break;
+                }
+            }
+        };
+        
+        //convert uuid to hex
+        static std::string _hex(const struct berval& bv)
+        {
+            static const char hex[] = "0123456789abcdef";
+            std::string ret;
+            
+            for(size_t i=0; i<bv.bv_len; i++)
+            {
+                ret += hex[((unsigned char)bv.bv_val[i]) >> 4];
+                ret += hex[((unsigned char)bv.bv_val[i]) & 0x0f];
+            }
+            
+            return ret;
+        };
+        
+        //read sync state control of object: syncStateValue ::= SEQUENCE { state ENUMERATED, entryUUID, cookie OPTIONAL }
+        void _parseSyncState(LDAPMessage* msg)
+        {
+            LDAPControl** ctrls = NULL;
+            LDAPControl* stateControl;
+            BerElement* ber;
+            ber_int_t st;
+            ber_len_t len;
+            struct berval uuid;
+            struct berval cookie;
+            
+            this->changeType = ADD;
+            this->entryUUID.clear();
+            
+            ldap_get_entry_controls(this->connection, msg, &ctrls);
+            stateControl = ldap_control_find(LDAP_CONTROL_SYNC_STATE, ctrls, NULL);
+            
+            if( stateControl != NULL )
+            {
+                ber = ber_init(&stateControl->ldctl_value);
+                if( ber == NULL || ber_scanf(ber, "{em", &st, &uuid) == LBER_ERROR )
+                {
+                    if( ber != NULL )
+                        ber_free(ber, 1);
+                    ldap_controls_free(ctrls);
+                    throw *(new ldapException(ldap_err2string(LDAP_DECODING_ERROR), LDAP_DECODING_ERROR));
+                }
+                
+                this->changeType = (change)st;
+                this->entryUUID = _hex(uuid);
+                
+                //cookie is valid after this object is processed
+                if( ber_peek_tag(ber, &len) == LDAP_TAG_SYNC_COOKIE && ber_scanf(ber, "m", &cookie) != LBER_ERROR )
+                {
+                    this->pendingCookie.assign(cookie.bv_val, cookie.bv_len);
+                    this->hasPendingCookie = true;
+                }
+                
+                ber_free(ber, 1);
+            }
+            
+            if( ctrls != NULL )
+                ldap_controls_free(ctrls);
+        };
+        
+        //read sync info message: new cookie, end of refresh phase or set of ids
+        void _parseSyncInfo(LDAPMessage* msg)
+        {
+            char* oid = NULL;
+            struct berval* data = NULL;
+            BerElement* ber;
+            ber_tag_t tag;
+            ber_len_t len;
+            char* last;
+            ber_int_t flag;
+            struct berval cookie;
+            struct berval uuid;
+            
+            if( ldap_parse_intermediate(this->connection, msg, &oid, &data, NULL, 0) != LDAP_SUCCESS || oid == NULL || data == NULL || strcmp(oid, LDAP_SYNC_INFO) != 0 )
+            {
+                ldap_memfree(oid);
+                ber_bvfree(data);
+                return;
+            }
+            
+            cookie.bv_val = NULL;
+            cookie.bv_len = 0;
+            
+            ber = ber_init(data);
+            tag = ber == NULL ? LBER_ERROR : ber_peek_tag(ber, &len);
+            
+            switch( tag )
+            {
+                case LDAP_TAG_SYNC_NEW_COOKIE:
+                    ber_scanf(ber, "m", &cookie);
+                    break;
+                
+                //refreshDelete or refreshPresent: SEQUENCE { cookie OPTIONAL, refreshDone BOOLEAN DEFAULT TRUE }
+                case LDAP_TAG_SYNC_REFRESH_DELETE:
+                case LDAP_TAG_SYNC_REFRESH_PRESENT:
+                    flag = 1;
+                    ber_scanf(ber, "{");
+                    if( ber_peek_tag(ber, &len) == LDAP_TAG_SYNC_COOKIE )
+                        ber_scanf(ber, "m", &cookie);
+                    if( ber_peek_tag(ber, &len) == LDAP_TAG_REFRESHDONE )
+                        ber_scanf(ber, "b", &flag);
+                    if( flag )
+                        this->isSyncRefreshDone = true;
+                    break;
+                
+                //syncIdSet: SEQUENCE { cookie OPTIONAL, refreshDeletes BOOLEAN DEFAULT FALSE, syncUUIDs SET OF }
+                case LDAP_TAG_SYNC_ID_SET:
+                    flag = 0;
+                    ber_scanf(ber, "{");
+                    if( ber_peek_tag(ber, &len) == LDAP_TAG_SYNC_COOKIE )
+                        ber_scanf(ber, "m", &cookie);
+                    if( ber_peek_tag(ber, &len) == LDAP_TAG_REFRESHDELETES )
+                        ber_scanf(ber, "b", &flag);
+                    for( tag = ber_first_element(ber, &len, &last); tag != LBER_DEFAULT; tag = ber_next_element(ber, &len, last) )
+                    {
+                        if( ber_scanf(ber, "m", &uuid) == LBER_ERROR )
+                            break;
+                        this->idQueue.push_back(std::make_pair(flag ? DELETE : PRESENT, _hex(uuid)));
+                    }
+                    break;
+            }
+            
+            //all changes before this message are fetched, unless ids are queued
+            if( cookie.bv_val != NULL )
+            {
+                std::string c(cookie.bv_val, cookie.bv_len);
+                if( this->idQueue.empty() )
+                    this->_commitCookie(c);
+                else
+                {
+                    this->pendingCookie = c;
+                    this->hasPendingCookie = true;
+                }
+            }
+            
+            if( ber != NULL )
+                ber_free(ber, 1);
+            ber_bvfree(data);
+            ldap_memfree(oid);
+        };
+        
+        //read result of search and sync done control: SEQUENCE { cookie OPTIONAL, refreshDeletes BOOLEAN DEFAULT FALSE }
+        void _parseSyncDone(LDAPMessage* msg)
+        {
+            int ret;
+            int err;
+            LDAPControl** ctrls = NULL;
+            LDAPControl* doneControl;
+            BerElement* ber;
+            ber_len_t len;
+            struct berval cookie;
+            
+            ret = ldap_parse_result(this->connection, msg, &err, NULL, NULL, NULL, &ctrls, 0);
+            if( ret != LDAP_SUCCESS )
+                throw *(new ldapException(ldap_err2string(ret), ret));
+            
+            //cookie is too old for server, next sync must read all objects
+            if( err == LDAP_SYNC_REFRESH_REQUIRED )
+            {
+                if( ctrls != NULL )
+                    ldap_controls_free(ctrls);
+                this->_commitCookie("");
+                throw *(new ldapException("Sync refresh required", err));
+            }
+            
+            if( err != LDAP_SUCCESS )
+            {
+                if( ctrls != NULL )
+                    ldap_controls_free(ctrls);
+                throw *(new ldapException(ldap_err2string(err), err));
+            }
+            
+            this->isSyncRefreshDone = true;
+            
+            doneControl = ldap_control_find(LDAP_CONTROL_SYNC_DONE, ctrls, NULL);
+            if( doneControl != NULL )
+            {
+                ber = ber_init(&doneControl->ldctl_value);
+                if( ber != NULL )
+                {
+                    if( ber_scanf(ber, "{") != LBER_ERROR && ber_peek_tag(ber, &len) == LDAP_TAG_SYNC_COOKIE && ber_scanf(ber, "m", &cookie) != LBER_ERROR )
+                    {
+                        std::string c(cookie.bv_val, cookie.bv_len);
+                        if( this->idQueue.empty() )
+                            this->_commitCookie(c);
+                        else
+                        {
+                            this->pendingCookie = c;
+                            this->hasPendingCookie = true;
+                        }
+                    }
+                    ber_free(ber, 1);
+                }
+            }
+            
+            if( ctrls != NULL )
+                ldap_controls_free(ctrls);
+        };
+        
+        //sync parameters
+        mode syncMode;
+        bool isPersist;
+        int pollTimeout;
+        LDAPControl* syncControl;
+        
+        //cookie or highest watermark of last completed run
+        std::string state;
+        std::string stateFile;
+        
+        //cookie which becomes state when current object is processed
+        std::string pendingCookie;
+        bool hasPendingCookie;
+        
+        //highest watermark of current run and watermark of current object
+        std::string runWatermark;
+        std::string pendingWatermark;
+        
+        //current change
+        change changeType;
+        std::string entryUUID;
+        std::deque< std::pair<change, std::string> > idQueue;
+        
+        bool isSyncRunning;
+        bool isSyncRefreshDone;
+};
+
+#endif	/* LDAPSYNCREADER_H */
@@ -0,0 +1,355 @@
+/*
+ * File         : ldapTypedReader.h
+ * Author       : B.Baransel BAĞCI
+ * Description  : Query results decoded directly into structs. Each struct declares its attribute mapping at
+ *                compile time, the attribute list of query and positions of attributes come from the mapping.
+ * Compile Opt  : -lldap -llber -std=c++14
+ *
+ * Dependency   :
+ *                  ldapReader.h
+ */
+
+#ifndef LDAPTYPEDREADER_H
+#define	LDAPTYPEDREADER_H
+
+#include "ldapReader.h"
+
+//for mapping of fields
+#include <tuple>
+#include <utility>
+#include <type_traits>
+//for field types
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+//for range of integers
+#include <limits>
+
+/*
+ * Binding of one attribute to a member of struct. Created with ldapBind()
+ */
+template<typename S, typename T>
+struct ldapField
+{
+    const char* name;
+    T S::* member;
+};
+
+/*
+ * Bind attribute to member
+ * @param @name     char* : Attribute name. Example: "uidNumber"
+ * @param @member   T S::* : Member of struct. Example: &user::uidNumber
+ */
+template<typename S, typename T>
+constexpr ldapField<S, T> ldapBind(const char* name, T S::* member)
+{
+    return ldapField<S, T>{ name, member };
+}
+
+/*
+ * Generalized time value (RFC 4517), Example: "20240131120000Z" or "20240131120000.0Z" of Active Directory
+ */
+struct ldapTime
+{
+    //seconds since epoch, UTC
+    time_t seconds;
+};
+
+/*
+ * Conversion of one attribute value to type. Specialize it for other types.
+ * decode() is called for each present value, clear() when object doesn't have the attribute.
+ */
+template<typename T, typename Enable = void>
+struct ldapValue;
+
+//text values
+template<>
+struct ldapValue<std::string>
+{
+    static void decode(const struct berval& v, std::string& out)
+    {
+        out.assign(v.bv_val, v.bv_len);
+    };
+    
+    static void clear(std::string& out)
+    {
+        out.clear();
+    };
+};
+
+//view of value in received message, valid until next fetch()
+template<>
+struct ldapValue<struct berval>
+{
+    static void decode(const struct berval& v, struct berval& out)
+    {
+        out = v;
+    };
+    
+    static void clear(struct berval& out)
+    {
+        out.bv_len = 0;
+        out.bv_val = NULL;
+    };
+};
+
+//"TRUE" or "FALSE" (RFC 4517)
+template<>
+struct ldapValue<bool>
+{
+    static void decode(const struct berval& v, bool& out)
+    {
+        out = v.bv_len == 4 && strncasecmp(v.bv_val, "TRUE", 4) == 0;
+    };
+    
+    static void clear(bool& out)
+    {
+        out = false;
+    };
+};
+
+//integers, parsed without copying value
+template<typename T>
+struct ldapValue<T, typename std::enable_if<std::is_integral<T>::value && ! std::is_same<T, bool>::value>::type>
+{
+    static void decode(const struct berval& v, T& out)
+    {
+        ber_len_t i = 0;
+        bool isNegative = false;
+        uint64_t n = 0;
+        uint64_t limit;
+        
+        if( v.bv_len > 0 && ( v.bv_val[0] == '-' || v.bv_val[0] == '+' ) )
+            isNegative = v.bv_val[i++] == '-';
+        
+        if( i == v.bv_len )
+            throw *(new ldapException("Attribute value is not an integer", LDAP_DECODING_ERROR));
+        
+        //largest magnitude of T with the sign, Example: 128 for negative int8_t, 0 for negative unsigned
+        if( ! isNegative )
+            limit = (uint64_t)std::numeric_limits<T>::max();
+        else if( std::is_signed<T>::value )
+            limit = (uint64_t)std::numeric_limits<T>::max() + 1;
+        else
+            limit = 0;
+        
+        for( ; i < v.bv_len; i++ )
+        {
+            if( v.bv_val[i] < '0' || v.bv_val[i] > '9' )
+                throw *(new ldapException("Attribute value is not an integer", LDAP_DECODING_ERROR));
+            
+            unsigned int digit = v.bv_val[i] - '0';
+            if( digit > limit || n > ( limit - digit ) / 10 )
+                throw *(new ldapException("Attribute value is out of range of integer type", LDAP_DECODING_ERROR));
+            n = n * 10 + digit;
+        }
+        
+        out = isNegative ? (T)(0 - n) : (T)n;
+    };
+    
+    static void clear(T& out)
+    {
+        out = 0;
+    };
+};
+
+template<>
+struct ldapValue<ldapTime>
+{
+    static void decode(const struct berval& v, ldapTime& out)
+    {
+        struct tm t;
+        int field[6] = { 0, 0, 0, 0, 0, 0 };
+        static const int width[6] = { 4, 2, 2, 2, 2, 2 };
+        ber_len_t p = 0;
+        
+        //minutes and seconds may be left out
+        for(int f=0; f<6; f++)
+        {
+            if( f >= 4 && ( p >= v.bv_len || v.bv_val[p] < '0' || v.bv_val[p] > '9' ) )
+                break;
+            
+            for(int w=0; w<width[f]; w++, p++)
+            {
+                if( p >= v.bv_len || v.bv_val[p] < '0' || v.bv_val[p] > '9' )
+                    throw *(new ldapException("Attribute value is not a generalized time", LDAP_DECODING_ERROR));
+                field[f] = field[f] * 10 + ( v.bv_val[p] - '0' );
+            }
+        }
+        
+        memset(&t, 0, sizeof(t));
+        t.tm_year = field[0] - 1900;
+        t.tm_mon = field[1] - 1;
+        t.tm_mday = field[2];
+        t.tm_hour = field[3];
+        t.tm_min = field[4];
+        t.tm_sec = field[5];
+        out.seconds = timegm(&t);
+        
+        //fraction is ignored, then offset from UTC, Example: "+0300"
+        while( p < v.bv_len && ( v.bv_val[p] == '.' || v.bv_val[p] == ',' || ( v.bv_val[p] >= '0' && v.bv_val[p] <= '9' ) ) )
+            p++;
+        
+        if( p < v.bv_len && ( v.bv_val[p] == '+' || v.bv_val[p] == '-' ) )
+        {
+            for(ber_len_t i=p+1; i<p+5; i++)
+                if( i >= v.bv_len || v.bv_val[i] < '0' || v.bv_val[i] > '9' )
+                    throw *(new ldapException("Attribute value is not a generalized time", LDAP_DECODING_ERROR));
+            
+            int offset = ( (v.bv_val[p+1] - '0') * 10 + (v.bv_val[p+2] - '0') ) * 3600 + ( (v.bv_val[p+3] - '0') * 10 + (v.bv_val[p+4] - '0') ) * 60;
+            out.seconds -= v.bv_val[p] == '+' ? offset : -offset;
+        }
+    };
+    
+    static void clear(ldapTime& out)
+    {
+        out.seconds = 0;
+    };
+};
+
+/*
+ * Decode all values of attribute into member. Single valued members take the first value,
+ * std::vector members take all values and keep their memory between objects.
+ */
+template<typename T>
+struct ldapMember
+{
+    static void decode(const struct berval* values, int count, T& out)
+    {
+        if( count > 0 )
+            ldapValue<T>::decode(values[0], out);
+        else
+            ldapValue<T>::clear(out);
+    };
+};
+
+template<typename T>
+struct ldapMember<std::vector<T> >
+{
+    static void decode(const struct berval* values, int count, std::vector<T>& out)
+    {
+        out.resize(count);
+        for(int i=0; i<count; i++)
+            ldapValue<T>::decode(values[i], out[i]);
+    };
+};
+
+/*
+ * Typed reader class. T must have a static constexpr function ldapFields() returning a tuple of ldapBind():
+ *
+ *      struct user
+ *      {
+ *          std::string uid;
+ *          int64_t uidNumber;
+ *          std::vector<std::string> memberOf;
+ *          ldapTime modifyTimestamp;
+ *
+ *          static constexpr auto ldapFields()
+ *          {
+ *              return std::make_tuple(ldapBind("uid", &user::uid), ldapBind("uidNumber", &user::uidNumber),
+ *                                     ldapBind("memberOf", &user::memberOf), ldapBind("modifyTimestamp", &user::modifyTimestamp));
+ *          }
+ *      };
+ *
+ *      ldapTypedReader<user> reader(uri, bindUser, bindPass);
+ *      user u;
+ *      reader.query("(objectClass=person)", base);
+ *      while( reader.fetch(u) )
+ *          ...
+ *
+ * Attributes are requested in mapping order and each member is read by its position, so no name is compared
+ * on fetch. Values are converted from the received message without berval copies.
+ */
+template<typename T>
+class ldapTypedReader : public ldapReader
+{
+    public:
+        //number of mapped attributes
+        static constexpr size_t attributeCount = std::tuple_size<decltype(T::ldapFields())>::value;
+        
+        static_assert(attributeCount <= _DEFAULT_MAX_NUMBER_OF_ATTRIBUTES, "Too many attributes in mapping");
+        
+        /*
+         * Define object, initialize session with server and bind.
+         * @param @serverUri    char* : Server connection uri. Example: "ldap://example.org:389"
+         * @param @bindUser     char* : Full dn of bind user. Example: "cn=user1,ou=Accounts,dc=example,dc=org"
+         * @param @bindPass     char* : Password of bind user. Example: "Passw0rd"
+         */
+        ldapTypedReader(const char* serverUri, const char* bindUser, const char* bindPass)
+        : ldapReader(serverUri, bindUser, bindPass)
+        {
+        };
+        
+        virtual ~ldapTypedReader()
+        {
+        };
+        
+        using ldapReader::query;
+        using ldapReader::fetch;
+        
+        /*
+         * Make query for mapped attributes of T
+         * @param @searchFilter     char* : Ldap search filter. Example: "(objectClass=person)"
+         * @param @searchBase       char* : Ldap search base. Example: "ou=users,dc=example,dc=org"
+         */
+        void query(const char* searchFilter, const char* searchBase)
+        {
+            ldapReader::query(searchFilter, searchBase, attributeCount, getAttributeNames());
+        };
+        
+        /*
+         * Move to next object and decode it into object
+         * @param @object       T& : Object to fill. Vectors and strings keep their memory, reuse it for all objects
+         * @return bool : false if there is no more object
+         */
+        bool fetch(T& object)
+        {
+            if( ! ldapReader::fetch() )
+                return false;
+            
+            this->_decode(object, std::make_index_sequence<attributeCount>());
+            return true;
+        };
+        
+        /*
+         * Get attribute names of mapping, in mapping order
+         */
+        static const char** getAttributeNames()
+        {
+            return _names(std::make_index_sequence<attributeCount>());
+        };
+
+    private:
+        template<size_t... I>
+        static const char** _names(std::index_sequence<I...>)
+        {
+            //constant initialized from mapping, no runtime copy
+            static const char* names[] = { std::get<I>(T::ldapFields()).name..., NULL };
+            return names;
+        };
+        
+        template<size_t... I>
+        void _decode(T& object, std::index_sequence<I...>)
+        {
+            //expand members in mapping order
+            int expand[] = { 0, ( this->_decodeAt<I>(object), 0 )... };
+            (void)expand;
+        };
+        
+        template<size_t I>
+        void _decodeAt(T& object)
+        {
+            constexpr auto field = std::get<I>(T::ldapFields());
+            typedef typename std::remove_reference<decltype(object.*(field.member))>::type memberType;
+            struct berval* values;
+            
+            int count = this->getAttributeViewAt(I, &values);
+            ldapMember<memberType>::decode(values, count, object.*(field.member));
+        };
+};
+
+template<typename T>
+constexpr size_t ldapTypedReader<T>::attributeCount;
+
+#endif	/* LDAPTYPEDREADER_H */
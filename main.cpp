@@ -18,7 +18,7 @@ int main(int argc, char** argv)
         reader1 = new ldapReader(serverUri,user,pass);
         
         //make query
-        reader1->query(filter,base,3,"sAMAccountName","memberOf");
+        reader1->query(filter,base,2,"sAMAccountName","memberOf");
     }
     catch(std::exception &e)
     {
@@ -61,16 +61,17 @@ int main(int argc, char** argv)
         
         //multi-value attribute (ex: group membership)
     //-------------------------------------------------------
-        //get attribute of the current object
-        value_holder = reader1->getAttribute("memberOf");
-        
-        //check for null
-        if( value_holder != NULL && value_holder[0] != NULL)
-            for(int i=0; value_holder[i] != NULL; i++)
-                std::cout << value_holder[i]->bv_val << std::endl;
+        //get attribute of the current object without copying values
+        //values are valid until next fetch(), no need to clear memory
+        berval *value_view;
+        int value_count = reader1->getAttributeView("memberOf", &value_view);
         
-        //clear memory
-        ldapReader::clearBerval(value_holder);
+        //values are not null terminated, use bv_len
+        for(int i=0; i<value_count; i++)
+        {
+            std::cout.write(value_view[i].bv_val, value_view[i].bv_len);
+            std::cout << std::endl;
+        }
     //-------------------------------------------------------    
     
     
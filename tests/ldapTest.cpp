@@ -0,0 +1,380 @@
+/*
+ * File         : ldapTest.cpp
+ * Author       : B.Baransel BAĞCI
+ * Description  : Tests of parts which work without a server: filter parser and matching, interner
+ *                normalization and histogram buckets of statistics.
+ * Compile Opt  : -O2 -lldap -llber -pthread -std=c++11
+ *
+ * Dependency   :
+ *                  ldapFilter.h, ldapInterner.h, ldapStats.h
+ *
+ * Usage        : ldapTest
+ *                Prints failed checks and returns non zero if any check fails.
+ */
+
+#include "../ldapFilter.h"
+#include "../ldapInterner.h"
+#include "../ldapStats.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(cond) \
+    do \
+    { \
+        checks++; \
+        if( ! (cond) ) \
+        { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while(0)
+
+/*
+ * Object with attribute views, matched by ldapFilter like ldapReader or ldapSnapshot
+ */
+struct testObject
+{
+    std::map< std::string, std::vector<std::string> > attributes;
+    std::vector<struct berval> view;
+    
+    void set(const std::string& name, const std::vector<std::string>& values)
+    {
+        this->attributes[name] = values;
+    };
+    
+    int getAttributeView(const char* attributeName, struct berval** values)
+    {
+        std::map< std::string, std::vector<std::string> >::iterator it = this->attributes.find(attributeName);
+        *values = NULL;
+        if( it == this->attributes.end() || it->second.empty() )
+            return 0;
+        
+        //views of each call are kept until object is destroyed, like views of a fetched object
+        size_t first = this->view.size();
+        this->view.resize(first + it->second.size());
+        for(size_t i=0; i<it->second.size(); i++)
+        {
+            this->view[first + i].bv_val = (char*)it->second[i].data();
+            this->view[first + i].bv_len = it->second[i].size();
+        }
+        
+        *values = &this->view[first];
+        return it->second.size();
+    };
+};
+
+//check if filter is refused with LDAP_FILTER_ERROR
+static bool isRefused(const char* filter)
+{
+    try
+    {
+        ldapFilter f(filter);
+    }
+    catch(ldapException &e)
+    {
+        return e.getCode() == LDAP_FILTER_ERROR;
+    }
+    
+    return false;
+}
+
+static bool matches(const char* filter, testObject& object, bool ignoreCase = true)
+{
+    ldapFilter f(filter, ignoreCase);
+    return f.match(object);
+}
+
+//match one value of attribute "v"
+static bool matchesValue(const std::string& filter, const std::string& value, bool ignoreCase = true)
+{
+    testObject object;
+    object.set("v", std::vector<std::string>(1, value));
+    return matches(filter.c_str(), object, ignoreCase);
+}
+
+static void testParser()
+{
+    const char* valid[] = { "(cn=a)", "(&(a=1)(|(b=2)(!(c=3))))", "(cn=*)", "(cn=a*b*c)", "(cn=*a)", "(cn=\\2a\\28\\29\\5c)",
+                            "(n>=5)", "(n<=-5)", "(cn~=x)", "(cn=)", "(1.2.840.113556.1.4.8=1)" };
+    for(size_t i=0; i<sizeof(valid) / sizeof(valid[0]); i++)
+        CHECK( ! isRefused(valid[i]) );
+    
+    const char* invalid[] = { "", "cn=a", "(cn=a", "(cn=a))", "(&)", "(!(a=1)(b=2))", "(=a)", "(cn:dn:=a)", "(cn:=a)",
+                              "(cn=\\2)", "(cn=\\zz)", "(cn=a\\)", "(cn>=a*)", "(cn<=*)", "(cn=a(b)", "(cn>a)", "(&(a=1)", "((a=1))" };
+    for(size_t i=0; i<sizeof(invalid) / sizeof(invalid[0]); i++)
+        CHECK( isRefused(invalid[i]) );
+    
+    //attributes are listed once, ignoring case
+    ldapFilter f("(&(mail=a)(MAIL=b)(|(uid=c)(!(mail=*))))");
+    CHECK( f.getAttributes().size() == 2 );
+    CHECK( f.getAttributes()[0] == "mail" && f.getAttributes()[1] == "uid" );
+    
+    //escaped bytes are literal, not wildcards
+    CHECK( matchesValue("(v=a\\2ab)", "a*b") );
+    CHECK( ! matchesValue("(v=a\\2ab)", "axb") );
+    CHECK( matchesValue("(v=*\\28x\\29*)", "f(x)") );
+    CHECK( matchesValue("(v=\\41bc)", "abc") );
+    
+    //presence, boolean operators and missing attributes
+    testObject object;
+    object.set("uid", std::vector<std::string>(1, "User1"));
+    object.set("mail", std::vector<std::string>(1, "user1@Example.org"));
+    CHECK( matches("(uid=*)", object) );
+    CHECK( ! matches("(description=*)", object) );
+    CHECK( matches("(&(uid=user1)(mail=*@example.org))", object) );
+    CHECK( ! matches("(&(uid=user1)(!(mail=*@example.org)))", object) );
+    CHECK( matches("(|(uid=nobody)(mail=user1@*))", object) );
+    CHECK( ! matches("(description=x)", object) );
+    CHECK( matches("(!(description=x))", object) );
+    
+    //case is ignored unless disabled
+    CHECK( matches("(uid=USER1)", object) );
+    CHECK( ! matches("(uid=USER1)", object, false) );
+    CHECK( matches("(uid=User1)", object, false) );
+    
+    //any parts are found in order without overlapping
+    CHECK( matchesValue("(v=ab*cd*ef)", "abXcdYef") );
+    CHECK( ! matchesValue("(v=ab*cd*ef)", "abXefYcd") );
+    CHECK( ! matchesValue("(v=aba*aba)", "ababa") );
+    CHECK( matchesValue("(v=*aa*aa*)", "aaaa") );
+    CHECK( ! matchesValue("(v=*aa*aa*)", "aaa") );
+}
+
+//reference search of needle in value, byte by byte
+static bool containsScalar(const std::string& value, const std::string& needle, bool ignoreCase)
+{
+    for(size_t i=0; i+needle.size()<=value.size(); i++)
+    {
+        size_t j = 0;
+        for( ; j<needle.size(); j++)
+        {
+            unsigned char a = value[i + j];
+            unsigned char b = needle[j];
+            if( ignoreCase ? tolower(a) != tolower(b) : a != b )
+                break;
+        }
+        if( j == needle.size() )
+            return true;
+    }
+    
+    return false;
+}
+
+//filter operand with all bytes escaped
+static std::string escapeAll(const std::string& value)
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string ret;
+    
+    for(size_t i=0; i<value.size(); i++)
+    {
+        unsigned char c = value[i];
+        ret += '\\';
+        ret += hex[c >> 4];
+        ret += hex[c & 0x0f];
+    }
+    
+    return ret;
+}
+
+static void testSubstringSearch()
+{
+    //letters of both cases, bytes which equal letters with lowercase bit set ('@' and '`'), and bytes above ASCII
+    static const char alphabet[] = { 'a', 'A', 'b', 'B', '@', '`', '1', '\xc1', '\xe1' };
+    int mismatches = 0;
+    
+    srand(1);
+    for(int round=0; round<20000; round++)
+    {
+        std::string value;
+        std::string needle;
+        size_t len = rand() % 100;
+        size_t needleLen = 1 + rand() % 6;
+        
+        for(size_t i=0; i<len; i++)
+            value += alphabet[rand() % sizeof(alphabet)];
+        //needle is often taken from value, so that found positions are tested as well as misses
+        if( len >= needleLen && rand() % 2 == 0 )
+            needle = value.substr(rand() % (len - needleLen + 1), needleLen);
+        else
+            for(size_t i=0; i<needleLen; i++)
+                needle += alphabet[rand() % sizeof(alphabet)];
+        
+        bool ignoreCase = rand() % 2 == 0;
+        bool expected = containsScalar(value, needle, ignoreCase);
+        
+        if( matchesValue("(v=*" + escapeAll(needle) + "*)", value, ignoreCase) != expected )
+            mismatches++;
+    }
+    
+    CHECK( mismatches == 0 );
+    
+    //needle at the last position of values longer than one SSE2 block
+    std::string value(40, 'x');
+    value += "Needle";
+    CHECK( matchesValue("(v=*needle*)", value) );
+    CHECK( ! matchesValue("(v=*needlE*)", value, false) );
+    CHECK( ! matchesValue("(v=*needles*)", value) );
+}
+
+static void testOrdering()
+{
+    //integers are compared by value
+    CHECK( matchesValue("(v>=10)", "10") );
+    CHECK( ! matchesValue("(v>=10)", "9") );
+    CHECK( matchesValue("(v>=10)", "+20") );
+    CHECK( ! matchesValue("(v>=10)", "-20") );
+    CHECK( matchesValue("(v<=-3)", "-4") );
+    CHECK( ! matchesValue("(v<=-3)", "-2") );
+    CHECK( matchesValue("(v<=0)", "-0") );
+    CHECK( matchesValue("(v>=-9223372036)", "0") );
+    
+    //other values are compared as bytes ignoring case, which orders generalized times of same form
+    CHECK( matchesValue("(v>=20240101000000Z)", "20240102000000Z") );
+    CHECK( ! matchesValue("(v>=20240101000000Z)", "20231231235959Z") );
+    CHECK( matchesValue("(v<=b)", "A") );
+    CHECK( ! matchesValue("(v<=b)", "C") );
+    CHECK( matchesValue("(v>=abc)", "abc") && matchesValue("(v<=abc)", "abc") );
+    CHECK( ! matchesValue("(v>=abc)", "ab") );
+    
+    //numbers too long for long long are compared as bytes
+    CHECK( matchesValue("(v>=1000000000000000000000)", "9") );
+    
+    //any value of attribute may match
+    testObject object;
+    std::vector<std::string> values;
+    values.push_back("5");
+    values.push_back("500");
+    object.set("n", values);
+    CHECK( matches("(n>=100)", object) );
+    CHECK( matches("(n<=10)", object) );
+    CHECK( ! matches("(n>=1000)", object) );
+}
+
+static std::string normalize(const char* value, ldapInterner::rule r)
+{
+    std::vector<char> buf(strlen(value) + 1);
+    size_t len = ldapInterner::normalize(value, strlen(value), r, &buf[0]);
+    return std::string(&buf[0], len);
+}
+
+static void testInterner()
+{
+    CHECK( normalize("CN=Admins, DC=Example", ldapInterner::DN) == "cn=admins,dc=example" );
+    CHECK( normalize(" cn = a ,  dc=b", ldapInterner::DN) == "cn =a ,dc=b" );
+    //escaped separator is part of the value, spaces after it are kept
+    CHECK( normalize("cn=a\\, b,dc=x", ldapInterner::DN) == "cn=a\\, b,dc=x" );
+    CHECK( normalize("CN=A, DC=B", ldapInterner::IGNORE_CASE) == "cn=a, dc=b" );
+    CHECK( normalize("CN=A, DC=B", ldapInterner::EXACT) == "CN=A, DC=B" );
+    CHECK( normalize("", ldapInterner::DN) == "" );
+    
+    //values with equal normalized forms share the id, first form is stored
+    ldapInterner interner;
+    uint32_t a = interner.intern("CN=Admins, DC=Example", ldapInterner::DN);
+    uint32_t b = interner.intern("cn=admins,dc=example", ldapInterner::DN);
+    uint32_t c = interner.intern("cn=admins,dc=example", ldapInterner::EXACT);
+    uint32_t d = interner.intern("cn=users,dc=example", ldapInterner::DN);
+    CHECK( a == b && a == c && a != d );
+    CHECK( strcmp(interner.get(a).bv_val, "CN=Admins, DC=Example") == 0 );
+    CHECK( interner.size() == 2 );
+    
+    uint32_t id;
+    CHECK( interner.find("Cn=Users, dc=EXAMPLE", 20, ldapInterner::DN, &id) && id == d );
+    CHECK( ! interner.find("cn=others,dc=example", 20, ldapInterner::DN, &id) );
+}
+
+static void testHistogram()
+{
+    //small values have own buckets
+    for(uint64_t v=0; v<_LDAP_STATS_SUB_BUCKETS; v++)
+        CHECK( ldapHistogram::bucketOf(v) == v && ldapHistogramSnapshot::bucketLow(v) == v );
+    
+    //each value is in [low, next low) of its bucket and buckets are at most 1/8 of their low value wide
+    std::vector<uint64_t> values;
+    for(unsigned int bit=0; bit<63; bit++)
+    {
+        values.push_back(1ULL << bit);
+        values.push_back((1ULL << bit) - 1);
+        values.push_back((1ULL << bit) + 1);
+        values.push_back(((1ULL << bit) * 3) / 2);
+    }
+    srand(2);
+    for(int i=0; i<10000; i++)
+        values.push_back(((uint64_t)rand() << 31 | rand()) >> (rand() % 62));
+    
+    int outside = 0;
+    int wide = 0;
+    for(size_t i=0; i<values.size(); i++)
+    {
+        size_t bucket = ldapHistogram::bucketOf(values[i]);
+        uint64_t low = ldapHistogramSnapshot::bucketLow(bucket);
+        uint64_t high = ldapHistogramSnapshot::bucketLow(bucket + 1);
+        
+        if( bucket >= _LDAP_STATS_BUCKETS || values[i] < low || values[i] >= high )
+            outside++;
+        if( low >= _LDAP_STATS_SUB_BUCKETS && high - low > low / _LDAP_STATS_SUB_BUCKETS )
+            wide++;
+    }
+    CHECK( outside == 0 );
+    CHECK( wide == 0 );
+    CHECK( ldapHistogram::bucketOf(UINT64_MAX) == _LDAP_STATS_BUCKETS - 1 );
+    
+    //buckets grow with values
+    for(uint64_t v=1; v<100000; v++)
+        if( ldapHistogram::bucketOf(v) < ldapHistogram::bucketOf(v - 1) )
+        {
+            CHECK( false );
+            break;
+        }
+    
+    ldapHistogram h;
+    ldapHistogramSnapshot snap;
+    h.snapshot(snap);
+    CHECK( snap.count == 0 && snap.percentile(0.5) == 0 );
+    
+    for(uint64_t v=1; v<=1000; v++)
+        h.record(v);
+    h.snapshot(snap);
+    CHECK( snap.count == 1000 && snap.sum == 500500 && snap.max == 1000 );
+    CHECK( snap.mean() == 500.5 );
+    
+    //percentiles are within bucket precision, and never above max
+    uint64_t p50 = snap.percentile(0.5);
+    uint64_t p99 = snap.percentile(0.99);
+    CHECK( p50 >= 500 - 500 / 8 && p50 <= 500 + 500 / 8 );
+    CHECK( p99 >= 990 - 990 / 8 && p99 <= 1000 );
+    CHECK( snap.percentile(1.0) <= 1000 );
+    
+    h.reset();
+    h.snapshot(snap);
+    CHECK( snap.count == 0 && snap.max == 0 );
+}
+
+int main()
+{
+    try
+    {
+        testParser();
+        testSubstringSearch();
+        testOrdering();
+        testInterner();
+        testHistogram();
+    }
+    catch(std::exception &e)
+    {
+        printf("unexpected exception: %s\n", e.what());
+        failures++;
+    }
+    
+    printf("%d checks, %d failed\n", checks, failures);
+    
+    return failures == 0 ? 0 : 1;
+}